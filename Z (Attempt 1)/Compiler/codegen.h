@@ -0,0 +1,550 @@
+#pragma once
+#include "compile.h"
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <unordered_map>
+
+namespace {
+	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+	// ## IR
+
+	// Everything a statement can do, one value (or print) at a time. The program is straight-line, so every value is
+	// defined once, by the instruction at its index, and a variable is just whichever value was last assigned to it.
+	enum class IrOp : uint8_t {
+		ADD,
+		SUB,
+		MUL,
+		DIV,
+		MOD,
+		EQ,
+		NE,
+		GT,
+		LT,
+		GE,
+		LE,
+		AND,// Both sides are always evaluated, then 1 if neither is 0
+		OR,
+		NOT,
+		INPUT,// Reads a line, and takes the number at its start
+		//
+		PRINT,
+		PRINT_STR,
+		PRINT_LN
+	};
+
+	// Either a constant, or the index of the instruction that defines the value
+	struct Operand {
+		bool isConst;
+		int32_t value;
+	};
+
+	struct IrInstr {
+		IrOp op;
+		Operand a;
+		Operand b;
+		uint32_t string;// Which global string PRINT_STR prints
+	};
+
+	bool definesValue(IrOp op) {
+		return op < IrOp::PRINT;
+	}
+
+	// Division can trap, so it's kept even if nothing uses it
+	bool hasEffect(IrOp op) {
+		return op >= IrOp::INPUT || op == IrOp::DIV || op == IrOp::MOD;
+	}
+
+	// Expanded into a few instructions that write the result before they're done reading their operands, so the result
+	// can't share a register with either of them
+	bool writesEarly(IrOp op) {
+		return op >= IrOp::EQ && op <= IrOp::NOT;
+	}
+
+	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+	// ## Registers
+
+	// R0 .. R25 are handed out by the allocator. A spilled result is put together in RESULT before it's stored, and
+	// spilled or constant operands are loaded into OPERAND_1 and OPERAND_2.
+	constexpr int NUM_ALLOC_REGISTERS = 26;
+	constexpr int RESULT = 26;
+	constexpr int OPERAND_1 = 27;
+	constexpr int OPERAND_2 = 28;
+	constexpr int WORD_SIZE = 4;
+
+	// Where a value lives for the whole of its life: a register, or a word past BP
+	struct Location {
+		int reg;// -1 if it's spilled
+		int slot;
+	};
+
+	// Reads a number for INPUT into RESULT. It's reached with call and ret, from a frame past the spill slots, and
+	// keeps everything but the scratch registers as it found them. The line goes in the 64 bytes at BP + 12, and
+	// readstrn stops the program on a longer one rather than letting it run over the rest of the stack.
+	const char* const inputRoutine =
+		"@__INPUT\n"
+		"storew BP, 4, R0\n"
+		"storew BP, 8, R1\n"
+		"movw R28, 0\n"
+		"storeb BP, 12, R28\n"
+		"movw R28, 64\n"
+		"readstrn BP, 12, R28\n"
+		"movw R26, 0\n"
+		"mov R27, BP\n"
+		"movw R28, 12\n"
+		"iadd R27, R27, R28\n"
+		"movw R1, 1\n"
+		"loadb R28, R27, 0\n"
+		"movw R0, 45\n"// -
+		"icmpeq R28, R0\n"
+		"jmpz @__INPUT_DIGITS\n"
+		"movw R1, -1\n"
+		"iinc R27\n"
+		"@__INPUT_DIGITS\n"
+		"loadb R28, R27, 0\n"
+		"movw R0, 48\n"// 0
+		"icmplt R28, R0\n"
+		"jmpnz @__INPUT_END\n"
+		"movw R0, 57\n"// 9
+		"icmpgt R28, R0\n"
+		"jmpnz @__INPUT_END\n"
+		"movw R0, 48\n"
+		"isub R28, R28, R0\n"
+		"movw R0, 10\n"
+		"imul R26, R26, R0\n"
+		"iadd R26, R26, R28\n"
+		"iinc R27\n"
+		"jmp @__INPUT_DIGITS\n"
+		"@__INPUT_END\n"
+		"imul R26, R26, R1\n"
+		"loadw R0, BP, 4\n"
+		"loadw R1, BP, 8\n"
+		"ret\n";
+
+	const char* const compareNames[] = { "icmpeq", "icmpne", "icmpgt", "icmplt", "icmpge", "icmple" };
+	const char* const arithmeticNames[] = { "iadd", "isub", "imul", "idiv", "imod" };
+
+	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+	// ## Generator
+
+	struct Generator {
+		const compile::Unit& unit;
+		std::vector<IrInstr> code;
+		std::vector<uint32_t> strings;// Token of each global string
+		std::unordered_map<std::string, Operand> variables;
+
+		std::vector<bool> isLive;
+		std::vector<int> lastUse;// Index of the last live instruction using each value
+		std::vector<Location> locations;
+		int registersUsed;
+		int slotsUsed;
+		int spills;
+		int labels;
+		uint32_t emitted;
+		bool usesInput;
+
+		explicit Generator(const compile::Unit& unitIn) : unit(unitIn), registersUsed(0), slotsUsed(0), spills(0), labels(0), emitted(0), usesInput(false) {}
+
+		std::string text(uint32_t token) const {
+			return std::string(unit.source.data + unit.tokens[token].offset, unit.tokens[token].length);
+		}
+
+		[[noreturn]] void error(compile::CompileError::ErrorType type, uint32_t token) const {
+			throw compile::CompileError(type, unit.tokens[token].offset);
+		}
+
+		// The first token of expr, for errors about the whole of it
+		uint32_t firstToken(const compile::Expr* expr) const {
+			using namespace compile;
+			switch (expr->type) {
+				case ExprType::BINARY: return firstToken(static_cast<const BinaryExpr*>(expr)->child1);
+				case ExprType::UNARY: return static_cast<const UnaryExpr*>(expr)->op;
+				case ExprType::TOKEN: return static_cast<const TokenExpr*>(expr)->token;
+				default: return firstToken(static_cast<const CallExpr*>(expr)->callee);
+			}
+		}
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// ## Building the IR
+
+		static Operand constant(int32_t value) {
+			return Operand{ true, value };
+		}
+
+		void add(IrOp op, Operand a, Operand b, uint32_t string = 0) {
+			code.push_back(IrInstr{ op, a, b, string });
+		}
+
+		// Folds op if it can, otherwise adds an instruction for it
+		Operand value(IrOp op, Operand a, Operand b) {
+			if (a.isConst && b.isConst) {
+				const uint32_t x = static_cast<uint32_t>(a.value);
+				const uint32_t y = static_cast<uint32_t>(b.value);
+				// Division by zero and the one that overflows are left to fail when the program runs
+				const bool canDivide = b.value != 0 && !(a.value == std::numeric_limits<int32_t>::min() && b.value == -1);
+				switch (op) {
+					case IrOp::ADD: return constant(static_cast<int32_t>(x + y));
+					case IrOp::SUB: return constant(static_cast<int32_t>(x - y));
+					case IrOp::MUL: return constant(static_cast<int32_t>(x * y));
+					case IrOp::DIV: if (canDivide) return constant(a.value / b.value); break;
+					case IrOp::MOD: if (canDivide) return constant(a.value % b.value); break;
+					case IrOp::EQ: return constant(a.value == b.value);
+					case IrOp::NE: return constant(a.value != b.value);
+					case IrOp::GT: return constant(a.value > b.value);
+					case IrOp::LT: return constant(a.value < b.value);
+					case IrOp::GE: return constant(a.value >= b.value);
+					case IrOp::LE: return constant(a.value <= b.value);
+					case IrOp::AND: return constant(a.value != 0 && b.value != 0);
+					case IrOp::OR: return constant(a.value != 0 || b.value != 0);
+					case IrOp::NOT: return constant(a.value == 0);
+					default: break;
+				}
+			} else if (op == IrOp::AND || op == IrOp::OR) {
+				// A constant side either decides it, or leaves it up to whether the other side is 0
+				if (a.isConst || b.isConst) {
+					const Operand known = a.isConst ? a : b;
+					const Operand other = a.isConst ? b : a;
+					if ((known.value != 0) == (op == IrOp::OR)) return constant(op == IrOp::OR);
+					return value(IrOp::NE, other, constant(0));
+				}
+			} else if ((op == IrOp::ADD || op == IrOp::SUB) && b.isConst && b.value == 0) {
+				return a;
+			} else if (op == IrOp::ADD && a.isConst) {
+				// The constant goes second, where it can be fused into the add
+				std::swap(a, b);
+				if (b.value == 0) return a;
+			}
+
+			add(op, a, b);
+			return Operand{ false, static_cast<int32_t>(code.size() - 1) };
+		}
+
+		Operand number(uint32_t token) const {
+			const std::string digits = text(token);
+			uint64_t result = 0;
+			for (const char c : digits) {
+				if (c < '0' || c > '9') error(compile::CompileError::INVALID_NUMBER, token);
+				result = result * 10 + (c - '0');
+				if (result > std::numeric_limits<uint32_t>::max()) error(compile::CompileError::INVALID_NUMBER, token);
+			}
+			return constant(static_cast<int32_t>(static_cast<uint32_t>(result)));
+		}
+
+		// Whether expr is a call to the builtin called name
+		bool isCallTo(const compile::Expr* expr, const char* name) const {
+			using namespace compile;
+			if (expr->type != ExprType::CALL) return false;
+			const Expr* const callee = static_cast<const CallExpr*>(expr)->callee;
+			return callee->type == ExprType::TOKEN && text(static_cast<const TokenExpr*>(callee)->token) == name;
+		}
+
+		Operand expr(const compile::Expr* expr_) {
+			using namespace compile;
+			switch (expr_->type) {
+				case ExprType::TOKEN: {
+					const uint32_t token = static_cast<const TokenExpr*>(expr_)->token;
+					switch (unit.tokens[token].type) {
+						case TokenType::NUMBER: return number(token);
+						case TokenType::TRUE: return constant(1);
+						case TokenType::FALSE: return constant(0);
+						case TokenType::STRING: error(CompileError::STRING_VALUE, token);
+						default: {
+							const std::unordered_map<std::string, Operand>::const_iterator found = variables.find(text(token));
+							if (found == variables.end()) error(CompileError::UNDEFINED_VARIABLE, token);
+							return found->second;
+						}
+					}
+				}
+
+				case ExprType::UNARY: {
+					const UnaryExpr* const unary = static_cast<const UnaryExpr*>(expr_);
+					const Operand child = expr(unary->child);
+					if (unit.tokens[unary->op].type == TokenType::MINUS) return value(IrOp::SUB, constant(0), child);
+					return value(IrOp::NOT, child, constant(0));
+				}
+
+				case ExprType::BINARY: {
+					const BinaryExpr* const binary = static_cast<const BinaryExpr*>(expr_);
+					const TokenType::Type op = unit.tokens[binary->op].type;
+					if (op == TokenType::EQ) {
+						if (binary->child1->type != ExprType::TOKEN || unit.tokens[static_cast<const TokenExpr*>(binary->child1)->token].type != TokenType::IDENTIFIER) {
+							error(CompileError::EXPECTED_VARIABLE, firstToken(binary->child1));
+						}
+						const Operand result = expr(binary->child2);
+						variables[text(static_cast<const TokenExpr*>(binary->child1)->token)] = result;
+						return result;
+					}
+					if (op == TokenType::PERIOD) error(CompileError::UNSUPPORTED, binary->op);
+
+					const Operand a = expr(binary->child1);
+					const Operand b = expr(binary->child2);
+					switch (op) {
+						case TokenType::PLUS: return value(IrOp::ADD, a, b);
+						case TokenType::MINUS: return value(IrOp::SUB, a, b);
+						case TokenType::AST: return value(IrOp::MUL, a, b);
+						case TokenType::SLASH: return value(IrOp::DIV, a, b);
+						case TokenType::PCT: return value(IrOp::MOD, a, b);
+						case TokenType::EQ_EQ: return value(IrOp::EQ, a, b);
+						case TokenType::NOT_EQ: return value(IrOp::NE, a, b);
+						case TokenType::GT: return value(IrOp::GT, a, b);
+						case TokenType::LT: return value(IrOp::LT, a, b);
+						case TokenType::GT_EQ: return value(IrOp::GE, a, b);
+						case TokenType::LT_EQ: return value(IrOp::LE, a, b);
+						case TokenType::AND: return value(IrOp::AND, a, b);
+						default: return value(IrOp::OR, a, b);
+					}
+				}
+
+				default:
+					if (isCallTo(expr_, "input")) {
+						if (static_cast<const CallExpr*>(expr_)->argCount != 0) error(CompileError::WRONG_ARGUMENTS, firstToken(expr_));
+						usesInput = true;
+						add(IrOp::INPUT, constant(0), constant(0));
+						return Operand{ false, static_cast<int32_t>(code.size() - 1) };
+					}
+					if (isCallTo(expr_, "print")) error(CompileError::NO_VALUE, firstToken(expr_));
+					error(CompileError::UNKNOWN_FUNCTION, firstToken(expr_));
+			}
+		}
+
+		void statement(const compile::Expr* expr_) {
+			using namespace compile;
+			if (!isCallTo(expr_, "print")) {
+				expr(expr_);
+				return;
+			}
+
+			const CallExpr* const call = static_cast<const CallExpr*>(expr_);
+			for (uint32_t i = 0; i < call->argCount; i++) {
+				const Expr* const arg = call->args[i];
+				if (arg->type == ExprType::TOKEN && unit.tokens[static_cast<const TokenExpr*>(arg)->token].type == TokenType::STRING) {
+					strings.push_back(static_cast<const TokenExpr*>(arg)->token);
+					add(IrOp::PRINT_STR, constant(0), constant(0), static_cast<uint32_t>(strings.size() - 1));
+				} else {
+					add(IrOp::PRINT, expr(arg), constant(0));
+				}
+			}
+			add(IrOp::PRINT_LN, constant(0), constant(0));
+		}
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// ## Register Allocation
+
+		// Drops whatever nothing needs, working back from the prints, and finds where each value is last used
+		void findLiveness() {
+			isLive.assign(code.size(), false);
+			lastUse.assign(code.size(), -1);
+			for (int i = static_cast<int>(code.size()) - 1; i >= 0; i--) {
+				const IrInstr& instr = code[i];
+				if (!hasEffect(instr.op) && lastUse[i] < 0) continue;
+				isLive[i] = true;
+				if (lastUse[i] < 0) lastUse[i] = i;
+				for (const Operand& operand : { instr.a, instr.b }) {
+					if (!operand.isConst && lastUse[operand.value] < 0) lastUse[operand.value] = i;
+				}
+			}
+		}
+
+		// Linear scan: values are given registers in the order they're defined, and when there are none left, whichever
+		// of them is needed furthest away goes to the stack instead
+		void allocate() {
+			locations.assign(code.size(), Location{ -1, -1 });
+			std::vector<int> active;// Values with registers, which are still needed
+			std::vector<int> spilled;// Values with slots, which are still needed
+			std::vector<int> freeSlots;
+			bool isTaken[NUM_ALLOC_REGISTERS] = {};
+
+			// A value keeps one location for its whole life, so one that's had a register up to now can't take a freed
+			// slot (something else may have been in it since the value was defined). Only a result can.
+			const auto toSlot = [&](int value, bool isResult) {
+				locations[value].reg = -1;
+				if (!isResult || freeSlots.empty()) {
+					locations[value].slot = slotsUsed++;
+				} else {
+					locations[value].slot = freeSlots.back();
+					freeSlots.pop_back();
+				}
+				spilled.push_back(value);
+				spills++;
+			};
+
+			for (int i = 0; i < static_cast<int>(code.size()); i++) {
+				if (!isLive[i] || !definesValue(code[i].op)) continue;
+
+				// Operands last used here can give their register to the result, unless it's written too early for that
+				const int lastNeeded = writesEarly(code[i].op) ? i - 1 : i;
+				active.erase(std::remove_if(active.begin(), active.end(), [&](int value) {
+					if (lastUse[value] > lastNeeded) return false;
+					isTaken[locations[value].reg] = false;
+					return true;
+				}), active.end());
+				// A spilled result is only stored once its operands are loaded, so their slots are free either way
+				spilled.erase(std::remove_if(spilled.begin(), spilled.end(), [&](int value) {
+					if (lastUse[value] > i) return false;
+					freeSlots.push_back(locations[value].slot);
+					return true;
+				}), spilled.end());
+
+				const bool* const freeReg = std::find(isTaken, isTaken + NUM_ALLOC_REGISTERS, false);
+				if (freeReg != isTaken + NUM_ALLOC_REGISTERS) {
+					locations[i].reg = static_cast<int>(freeReg - isTaken);
+					isTaken[locations[i].reg] = true;
+					registersUsed = std::max(registersUsed, locations[i].reg + 1);
+					active.push_back(i);
+					continue;
+				}
+
+				const std::vector<int>::iterator furthest = std::max_element(active.begin(), active.end(), [&](int x, int y) {
+					return lastUse[x] < lastUse[y];
+				});
+				if (lastUse[*furthest] > lastUse[i]) {
+					locations[i].reg = locations[*furthest].reg;
+					toSlot(*furthest, false);
+					*furthest = i;
+				} else {
+					toSlot(i, true);
+				}
+			}
+		}
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// ## Emitting
+
+		static const char* name(int reg) {
+			static const char* const names[] = {
+				"R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "R8", "R9",
+				"R10", "R11", "R12", "R13", "R14", "R15", "R16", "R17", "R18", "R19",
+				"R20", "R21", "R22", "R23", "R24", "R25", "R26", "R27", "R28"
+			};
+			return names[reg];
+		}
+
+		std::ostream& line(std::ostream& azm) {
+			emitted++;
+			return azm;
+		}
+
+		// The register holding operand, after loading it into scratch if it isn't in one
+		int use(std::ostream& azm, const Operand& operand, int scratch) {
+			if (operand.isConst) {
+				line(azm) << "movw " << name(scratch) << ", " << operand.value << "\n";
+				return scratch;
+			}
+			const Location& location = locations[operand.value];
+			if (location.reg >= 0) return location.reg;
+			line(azm) << "loadw " << name(scratch) << ", BP, " << location.slot * WORD_SIZE << "\n";
+			return scratch;
+		}
+
+		void label(std::ostream& azm, int at) {
+			azm << "@__L" << at << "\n";
+		}
+
+		void emit(std::ostream& azm, int i) {
+			const IrInstr& instr = code[i];
+			const int result = definesValue(instr.op) ? (locations[i].reg >= 0 ? locations[i].reg : RESULT) : -1;
+
+			switch (instr.op) {
+				case IrOp::ADD:
+				case IrOp::SUB:
+				case IrOp::MUL:
+				case IrOp::DIV:
+				case IrOp::MOD: {
+					// A constant second operand is loaded straight before, so the pair is fused into iaddimm or isubimm
+					const int a = use(azm, instr.a, OPERAND_1);
+					const int b = use(azm, instr.b, OPERAND_2);
+					line(azm) << arithmeticNames[static_cast<int>(instr.op)] << " " << name(result) << ", " << name(a) << ", " << name(b) << "\n";
+					break;
+				}
+
+				case IrOp::EQ:
+				case IrOp::NE:
+				case IrOp::GT:
+				case IrOp::LT:
+				case IrOp::GE:
+				case IrOp::LE: {
+					// The compare and the jump are fused into icmpXXjz
+					const int a = use(azm, instr.a, OPERAND_1);
+					const int b = use(azm, instr.b, OPERAND_2);
+					const int skip = labels++;
+					line(azm) << "movw " << name(result) << ", 0\n";
+					line(azm) << compareNames[static_cast<int>(instr.op) - static_cast<int>(IrOp::EQ)] << " " << name(a) << ", " << name(b) << "\n";
+					line(azm) << "jmpz @__L" << skip << "\n";
+					line(azm) << "movw " << name(result) << ", 1\n";
+					label(azm, skip);
+					break;
+				}
+
+				case IrOp::AND:
+				case IrOp::OR: {
+					const int a = use(azm, instr.a, OPERAND_1);
+					const int b = use(azm, instr.b, OPERAND_2);
+					const int skip = labels++;
+					const bool isAnd = instr.op == IrOp::AND;
+					const char* const jump = isAnd ? "jmpz" : "jmpnz";
+					line(azm) << "movw " << name(result) << ", " << (isAnd ? 0 : 1) << "\n";
+					line(azm) << "iflag " << name(a) << "\n";
+					line(azm) << jump << " @__L" << skip << "\n";
+					line(azm) << "iflag " << name(b) << "\n";
+					line(azm) << jump << " @__L" << skip << "\n";
+					line(azm) << "movw " << name(result) << ", " << (isAnd ? 1 : 0) << "\n";
+					label(azm, skip);
+					break;
+				}
+
+				case IrOp::NOT: {
+					const int a = use(azm, instr.a, OPERAND_1);
+					const int skip = labels++;
+					line(azm) << "movw " << name(result) << ", 0\n";
+					line(azm) << "iflag " << name(a) << "\n";
+					line(azm) << "jmpnz @__L" << skip << "\n";
+					line(azm) << "movw " << name(result) << ", 1\n";
+					label(azm, skip);
+					break;
+				}
+
+				case IrOp::INPUT:
+					line(azm) << "call @__INPUT, " << slotsUsed * WORD_SIZE << "\n";
+					if (result != RESULT) line(azm) << "mov " << name(result) << ", " << name(RESULT) << "\n";
+					break;
+
+				case IrOp::PRINT: {
+					const int a = use(azm, instr.a, OPERAND_1);
+					line(azm) << "rprntw " << name(a) << "\n";
+					break;
+				}
+
+				case IrOp::PRINT_STR:
+					line(azm) << "prntstr PP, %__S" << instr.string << "\n";
+					break;
+
+				case IrOp::PRINT_LN:
+					line(azm) << "prntln\n";
+					break;
+			}
+
+			if (result == RESULT) line(azm) << "storew BP, " << locations[i].slot * WORD_SIZE << ", " << name(RESULT) << "\n";
+		}
+
+		compile::CodegenInfo generate(std::ostream& azm) {
+			for (const compile::Expr* expr_ : unit.exprs) statement(expr_);
+			findLiveness();
+			allocate();
+
+			// Globals have to come before any instructions
+			for (size_t i = 0; i < strings.size(); i++) azm << "globalstr %__S" << i << ", " << text(strings[i]) << "\n";
+			for (int i = 0; i < static_cast<int>(code.size()); i++) {
+				if (isLive[i]) emit(azm, i);
+			}
+			line(azm) << "halt\n";
+			if (usesInput) azm << inputRoutine;
+
+			return compile::CodegenInfo{ emitted, static_cast<uint32_t>(registersUsed), static_cast<uint32_t>(spills), static_cast<uint32_t>(slotsUsed) };
+		}
+	};
+}
+
+compile::CodegenInfo compile::Generate(const Unit& unit, std::ostream& azm) {
+	return Generator(unit).generate(azm);
+}
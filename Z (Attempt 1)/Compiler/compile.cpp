@@ -1,7 +1,174 @@
-//// Includes the "tokenize.h" file in both debug and normal modes
-//#include "compile.h"
-//
-//#define COMP_DEBUG
-//#include "tokenize.h"
-//#undef COMP_DEBUG
-//#include "tokenize.h"
\ No newline at end of file
+// Includes the "tokenize.h" file in both debug and normal modes
+#include "compile.h"
+
+#define COMP_DEBUG
+#include "tokenize.h"
+#undef COMP_DEBUG
+#include "tokenize.h"
+#include "parse.h"
+#include "codegen.h"
+
+#include <atomic>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+constexpr const char* const compile::CompileError::strings[];
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ## Source
+
+bool compile::Source::open(const char* path) {
+	close();
+
+#ifdef _WIN32
+	const HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		CloseHandle(file);
+		return false;
+	}
+	size = static_cast<size_t>(fileSize.QuadPart);
+	if (size != 0) {
+		const HANDLE view = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		mapping = view == nullptr ? nullptr : MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0);
+		if (view != nullptr) CloseHandle(view);
+	}
+	CloseHandle(file);
+#else
+	const int fd = ::open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		::close(fd);
+		return false;
+	}
+	size = static_cast<size_t>(info.st_size);
+	if (size != 0) {
+		mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) mapping = nullptr;
+	}
+	::close(fd);
+#endif
+
+	if (size != 0 && mapping == nullptr) {
+		size = 0;
+		return false;
+	}
+	mappedSize = size;
+	data = size != 0 ? static_cast<const char*>(mapping) : "";
+	return true;
+}
+
+void compile::Source::close() {
+	if (mapping != nullptr) {
+#ifdef _WIN32
+		UnmapViewOfFile(mapping);
+#else
+		munmap(mapping, mappedSize);
+#endif
+	}
+	mapping = nullptr;
+	data = nullptr;
+	size = 0;
+}
+
+void compile::Source::position(uint32_t offset, int& line, int& column) const {
+	line = 1;
+	column = 1;
+	for (uint32_t i = 0; i < offset && i < size; i++) {
+		if (data[i] == '\n') {
+			line++;
+			column = 1;
+		} else {
+			column++;
+		}
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ## Parsing Files
+
+namespace {
+	std::string describe(const compile::Unit& unit, const compile::CompileError& e) {
+		int line, column;
+		unit.source.position(e.offset, line, column);
+		std::ostringstream message;
+		message << e.what() << " (line " << line << ", column " << column << ")";
+		return message.str();
+	}
+
+	void parseUnit(compile::Unit& unit) {
+		using namespace compile;
+
+		if (!unit.source.open(unit.path)) {
+			unit.error = "Could not open file";
+			return;
+		}
+
+		try {
+			if (unit.source.size > std::numeric_limits<uint32_t>::max()) throw CompileError(CompileError::FILE_TOO_BIG, 0);
+			Tokenize(unit.source, unit.tokens);
+			Parse(unit.tokens, unit.arena, unit.exprs);
+		} catch (const CompileError& e) {
+			unit.error = describe(unit, e);
+		}
+	}
+}
+
+void compile::ParseFiles(const std::vector<const char*>& paths, std::vector<std::unique_ptr<Unit>>& units, unsigned int threads) {
+	units.clear();
+	for (const char* path : paths) {
+		units.emplace_back(new Unit());
+		units.back()->path = path;
+	}
+
+	if (threads == 0) threads = std::thread::hardware_concurrency();
+	threads = std::max(1u, std::min(threads, static_cast<unsigned int>(paths.size())));
+
+	// Each thread takes the next file that nobody has started on
+	std::atomic<size_t> next(0);
+	const auto work = [&]() {
+		for (size_t i = next++; i < units.size(); i = next++) parseUnit(*units[i]);
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < threads; i++) workers.emplace_back(work);
+	work();
+	for (std::thread& worker : workers) worker.join();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ## Generating Files
+
+bool compile::GenerateFile(Unit& unit, const std::string& azmPath, CodegenInfo& info) {
+	// Into memory first, so an error doesn't leave half a file behind
+	std::ostringstream azm;
+	try {
+		info = Generate(unit, azm);
+	} catch (const CompileError& e) {
+		unit.error = describe(unit, e);
+		return false;
+	}
+
+	std::fstream file;
+	file.open(azmPath, std::ios::out | std::ios::trunc);
+	file << azm.str();
+	if (!file.is_open() || file.fail()) {
+		unit.error = "Could not write " + azmPath;
+		return false;
+	}
+	return true;
+}
\ No newline at end of file
@@ -1,7 +1,13 @@
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <iomanip>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #define COMP_DEBUG
@@ -14,28 +20,90 @@
 
 namespace compile {
 	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-	// ## Expressions
+	// ## Custom exceptions
 
-	enum class ExprType {
-		BINARY
-	};
+	// Error during tokenizing, parsing or codegen
+	class CompileError : public std::exception {
+	public:
 
-	struct Expr {
-		const ExprType type;
-		Expr(const ExprType typeIn) : type(typeIn) {}
+		// Error type enum
+		enum ErrorType {
+			UNKNOWN_ERROR,
+			UNEXPECTED_CHAR,
+			UNTERMINATED_STRING,
+			EXPECTED_EXPR,
+			EXPECTED_RIGHT_PAREN,
+			EXPECTED_SEMICOLON,
+			FILE_TOO_BIG,
+			INVALID_NUMBER,
+			UNDEFINED_VARIABLE,
+			EXPECTED_VARIABLE,
+			STRING_VALUE,
+			NO_VALUE,
+			UNKNOWN_FUNCTION,
+			WRONG_ARGUMENTS,
+			UNSUPPORTED
+		};
+
+		static constexpr const char* const strings[] = {
+			"Unknown error",
+			"Unexpected character",
+			"Unterminated string",
+			"Expected an expression",
+			"Expected )",
+			"Expected ;",
+			"Source files have to be under 4GB",
+			"Invalid number (numbers are words, so they have to be under 2^32)",
+			"Variable used before anything is assigned to it",
+			"Can only assign to a variable",
+			"Strings can only be printed",
+			"print doesn't have a value",
+			"Only print and input can be called (there's no way to define functions yet)",
+			"input doesn't take any arguments",
+			"Not supported yet"
+		};
+
+		const ErrorType type;
+		const uint32_t offset;// Byte offset in the source
+
+		CompileError(ErrorType eType, uint32_t offsetIn) : type(eType), offset(offsetIn) {}
+
+		virtual const char* what() const noexcept {
+			return strings[type];
+		}
 	};
 
-	/*struct BinaryExpr : Expr {
-		Expr* child1;
-		Expr* child2;
+	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+	// ## Source
+
+	// A source file mapped read-only into memory. Tokens keep offsets into it rather than copies of their text, so
+	// it stays mapped for as long as anything looks at them.
+	class Source {
+	public:
+		const char* data;
+		size_t size;
+
+		Source() : data(nullptr), size(0), mapping(nullptr) {}
+		~Source() { close(); }
+		Source(const Source&) = delete;
+		Source& operator=(const Source&) = delete;
+
+		// Returns false if the file can't be opened
+		bool open(const char* path);
+		void close();
 
-		BinaryExpr() : Expr(ExprType::BINARY), child1(nullptr), child2(nullptr) {}
-	};*/
+		// 1-based line and column of offset, for error messages
+		void position(uint32_t offset, int& line, int& column) const;
+
+	private:
+		void* mapping;// The whole mapping, which is nullptr for an empty file
+		size_t mappedSize;
+	};
 
 	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 	// ## Tokens 
 	namespace TokenType {
-		enum Type {
+		enum Type : uint8_t {
 			IDENTIFIER,
 			STRING,
 			NUMBER,
@@ -90,7 +158,9 @@ namespace compile {
 			TRUE,
 			FALSE,
 			//
-			INT
+			INT,
+			//
+			END				// After the last token, so the parser never needs to check for the end
 		};
 
 		constexpr char const chars[] = {
@@ -106,16 +176,165 @@ namespace compile {
 		};
 	}
 
-	struct Token : Expr {
+	// Where the token is in the source rather than a copy of it, so tokenizing never allocates per token
+	struct Token {
 		TokenType::Type type;
-		std::string value;
+		uint32_t offset;
+		uint32_t length;
 	};
 
 	typedef std::vector<Token> TokenList;
 
+	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+	// ## Arena
+
+	// Bump allocator for AST nodes. Nodes come out of big blocks and are never freed one at a time: the whole arena
+	// goes at once, after codegen is done with the tree, so nodes can't have anything that needs a destructor.
+	class Arena {
+	public:
+		static constexpr size_t BLOCK_SIZE = 0x10000;
+
+		Arena() : ptr(nullptr), end(nullptr) {}
+		~Arena() { release(); }
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		void* alloc(size_t size, size_t align) {
+			char* start = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(ptr) + align - 1) & ~(align - 1));
+			if (ptr == nullptr || start + size > end) {
+				// Anything bigger than a block gets one to itself
+				const size_t blockSize = size + align > BLOCK_SIZE ? size + align : BLOCK_SIZE;
+				blocks.push_back(new char[blockSize]);
+				ptr = blocks.back();
+				end = ptr + blockSize;
+				start = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(ptr) + align - 1) & ~(align - 1));
+			}
+			ptr = start + size;
+			return start;
+		}
+
+		template<typename T, typename... Args>
+		T* make(Args&&... args) {
+			static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed");
+			return new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		}
+
+		// Room for count objects, left uninitialized
+		template<typename T>
+		T* makeArray(size_t count) {
+			static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed");
+			return static_cast<T*>(alloc(sizeof(T) * (count != 0 ? count : 1), alignof(T)));
+		}
+
+		void release() {
+			for (char* block : blocks) delete[] block;
+			blocks.clear();
+			ptr = nullptr;
+			end = nullptr;
+		}
+
+	private:
+		std::vector<char*> blocks;
+		char* ptr;
+		char* end;
+	};
+
+	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+	// ## Expressions
+
+	// Every node is allocated from an Arena, and refers to its tokens by their index in the TokenList
+	enum class ExprType {
+		BINARY,
+		UNARY,
+		TOKEN,
+		CALL
+	};
+
+	struct Expr {
+		const ExprType type;
+		Expr(const ExprType typeIn) : type(typeIn) {}
+	};
+
+	// An operator between two expressions (including = and the . of a member)
+	struct BinaryExpr : Expr {
+		uint32_t op;// The operator's token
+		Expr* child1;
+		Expr* child2;
+
+		BinaryExpr(uint32_t opIn, Expr* child1In, Expr* child2In) : Expr(ExprType::BINARY), op(opIn), child1(child1In), child2(child2In) {}
+	};
+
+	// - or ! in front of an expression
+	struct UnaryExpr : Expr {
+		uint32_t op;// The operator's token
+		Expr* child;
+
+		UnaryExpr(uint32_t opIn, Expr* childIn) : Expr(ExprType::UNARY), op(opIn), child(childIn) {}
+	};
+
+	// A single token: an identifier, number, string, true or false
+	struct TokenExpr : Expr {
+		uint32_t token;
+
+		TokenExpr(uint32_t tokenIn) : Expr(ExprType::TOKEN), token(tokenIn) {}
+	};
+
+	// A function call, with its arguments in an array from the same Arena
+	struct CallExpr : Expr {
+		Expr* callee;
+		Expr** args;
+		uint32_t argCount;
+
+		CallExpr(Expr* calleeIn, Expr** argsIn, uint32_t argCountIn) : Expr(ExprType::CALL), callee(calleeIn), args(argsIn), argCount(argCountIn) {}
+	};
+
+	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+	// ## Units
+
+	// Everything one source file turns into. The tokens point into the source and the tree is in the arena, so the
+	// Unit has to be kept until codegen is done with them, and then it all goes at once.
+	struct Unit {
+		const char* path;
+		Source source;
+		TokenList tokens;
+		Arena arena;
+		std::vector<Expr*> exprs;// One for each top-level statement
+		std::string error;// Empty if it parsed
+
+		Unit() : path(nullptr) {}
+	};
+
 	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 	// ## Tokenizer Function Declarations
 
-	void Tokenize(std::iostream& file, TokenList& list);
-	void Tokenize(std::iostream& file, TokenList& list, std::ostream& debug);
+	void Tokenize(const Source& source, TokenList& list);
+	void Tokenize(const Source& source, TokenList& list, std::ostream& debug);
+
+	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+	// ## Parser Function Declarations
+
+	// Parses statements (each an expression followed by ;) until the END token
+	void Parse(const TokenList& tokens, Arena& arena, std::vector<Expr*>& exprs);
+	// Writes expr out in prefix form, with its tokens' text from source
+	void PrintExpr(std::ostream& stream, const Source& source, const TokenList& tokens, const Expr* expr);
+
+	// Maps, tokenizes and parses each file into its Unit. The files don't depend on each other, so they are spread
+	// over threads (0 for one per core). Errors don't stop the other files, and end up in each Unit's error.
+	void ParseFiles(const std::vector<const char*>& paths, std::vector<std::unique_ptr<Unit>>& units, unsigned int threads);
+
+	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+	// ## Codegen Function Declarations
+
+	struct CodegenInfo {
+		uint32_t instructions;
+		uint32_t registers;// How many of R0 .. R25 are used
+		uint32_t spills;// Values that live on the stack instead
+		uint32_t slots;// Stack words the spills share
+	};
+
+	// Writes a parsed Unit out as Z (Attempt 2) assembly (.azm), with a linear scan register allocator over an SSA IR
+	// of its statements
+	CodegenInfo Generate(const Unit& unit, std::ostream& azm);
+	// Generates the Unit into the file at azmPath. Returns false (with the Unit's error set) if it couldn't.
+	bool GenerateFile(Unit& unit, const std::string& azmPath, CodegenInfo& info);
 }
\ No newline at end of file
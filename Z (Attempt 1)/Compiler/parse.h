@@ -0,0 +1,184 @@
+#pragma once
+#include "compile.h"
+
+#include <algorithm>
+
+namespace {
+	// Binding power of a binary operator (0 if the token isn't one)
+	int precedence(compile::TokenType::Type type) {
+		using namespace compile::TokenType;
+		switch (type) {
+			case EQ:
+				return 1;
+			case OR:
+				return 2;
+			case AND:
+				return 3;
+			case EQ_EQ:
+			case NOT_EQ:
+				return 4;
+			case LT:
+			case GT:
+			case LT_EQ:
+			case GT_EQ:
+				return 5;
+			case PLUS:
+			case MINUS:
+				return 6;
+			case AST:
+			case SLASH:
+			case PCT:
+				return 7;
+			default:
+				return 0;
+		}
+	}
+
+	struct Parser {
+		const compile::TokenList& tokens;
+		compile::Arena& arena;
+		uint32_t at;
+		std::vector<compile::Expr*> args;// Arguments of every call being parsed, innermost last
+
+		Parser(const compile::TokenList& tokensIn, compile::Arena& arenaIn) : tokens(tokensIn), arena(arenaIn), at(0) {}
+
+		compile::TokenType::Type peek() const {
+			return tokens[at].type;
+		}
+
+		void expect(compile::TokenType::Type type, compile::CompileError::ErrorType error) {
+			if (peek() != type) throw compile::CompileError(error, tokens[at].offset);
+			at++;
+		}
+
+		// Operators of at least minPrecedence, all left associative apart from =
+		compile::Expr* expr(int minPrecedence) {
+			using namespace compile;
+			Expr* lhs = unary();
+			while (true) {
+				const int prec = precedence(peek());
+				if (prec == 0 || prec < minPrecedence) return lhs;
+				const uint32_t op = at++;
+				Expr* const rhs = expr(tokens[op].type == TokenType::EQ ? prec : prec + 1);
+				lhs = arena.make<BinaryExpr>(op, lhs, rhs);
+			}
+		}
+
+		compile::Expr* unary() {
+			using namespace compile;
+			if (peek() == TokenType::MINUS || peek() == TokenType::NOT) {
+				const uint32_t op = at++;
+				return arena.make<UnaryExpr>(op, unary());
+			}
+			return postfix();
+		}
+
+		compile::Expr* postfix() {
+			using namespace compile;
+			Expr* expr_ = primary();
+			while (true) {
+				if (peek() == TokenType::LEFT_PAREN) {
+					at++;
+					const size_t base = args.size();
+					if (peek() != TokenType::RIGHT_PAREN) {
+						args.push_back(expr(1));
+						while (peek() == TokenType::COMMA) {
+							at++;
+							args.push_back(expr(1));
+						}
+					}
+					expect(TokenType::RIGHT_PAREN, CompileError::EXPECTED_RIGHT_PAREN);
+
+					const uint32_t count = static_cast<uint32_t>(args.size() - base);
+					Expr** const array = arena.makeArray<Expr*>(count);
+					std::copy(args.begin() + base, args.end(), array);
+					args.resize(base);
+					expr_ = arena.make<CallExpr>(expr_, array, count);
+				} else if (peek() == TokenType::PERIOD) {
+					const uint32_t op = at++;
+					if (peek() != TokenType::IDENTIFIER) throw CompileError(CompileError::EXPECTED_EXPR, tokens[at].offset);
+					expr_ = arena.make<BinaryExpr>(op, expr_, arena.make<TokenExpr>(at++));
+				} else {
+					return expr_;
+				}
+			}
+		}
+
+		compile::Expr* primary() {
+			using namespace compile;
+			switch (peek()) {
+				case TokenType::IDENTIFIER:
+				case TokenType::NUMBER:
+				case TokenType::STRING:
+				case TokenType::TRUE:
+				case TokenType::FALSE:
+					return arena.make<TokenExpr>(at++);
+
+				case TokenType::LEFT_PAREN: {
+					at++;
+					Expr* const inner = expr(1);
+					expect(TokenType::RIGHT_PAREN, CompileError::EXPECTED_RIGHT_PAREN);
+					return inner;
+				}
+
+				default:
+					throw CompileError(CompileError::EXPECTED_EXPR, tokens[at].offset);
+			}
+		}
+	};
+}
+
+void compile::Parse(const compile::TokenList& tokens, compile::Arena& arena, std::vector<compile::Expr*>& exprs) {
+	Parser parser(tokens, arena);
+	exprs.clear();
+	while (parser.peek() != TokenType::END) {
+		exprs.push_back(parser.expr(1));
+		parser.expect(TokenType::SEMICOLON, CompileError::EXPECTED_SEMICOLON);
+	}
+}
+
+void compile::PrintExpr(std::ostream& stream, const compile::Source& source, const compile::TokenList& tokens, const compile::Expr* expr) {
+	const auto text = [&](uint32_t token) {
+		stream.write(source.data + tokens[token].offset, tokens[token].length);
+	};
+
+	switch (expr->type) {
+		case ExprType::BINARY: {
+			const BinaryExpr* const binary = static_cast<const BinaryExpr*>(expr);
+			stream << "(";
+			text(binary->op);
+			stream << " ";
+			PrintExpr(stream, source, tokens, binary->child1);
+			stream << " ";
+			PrintExpr(stream, source, tokens, binary->child2);
+			stream << ")";
+			break;
+		}
+
+		case ExprType::UNARY: {
+			const UnaryExpr* const unary = static_cast<const UnaryExpr*>(expr);
+			stream << "(";
+			text(unary->op);
+			stream << " ";
+			PrintExpr(stream, source, tokens, unary->child);
+			stream << ")";
+			break;
+		}
+
+		case ExprType::TOKEN:
+			text(static_cast<const TokenExpr*>(expr)->token);
+			break;
+
+		case ExprType::CALL: {
+			const CallExpr* const call = static_cast<const CallExpr*>(expr);
+			stream << "(call ";
+			PrintExpr(stream, source, tokens, call->callee);
+			for (uint32_t i = 0; i < call->argCount; i++) {
+				stream << " ";
+				PrintExpr(stream, source, tokens, call->args[i]);
+			}
+			stream << ")";
+			break;
+		}
+	}
+}
\ No newline at end of file
@@ -1,23 +1,66 @@
 #include "tokenizedefs.h"
 
-void compile::Tokenize(std::iostream& file, 
+void compile::Tokenize(const compile::Source& source,
 			  compile::TokenList& list
 		  #ifdef COMP_DEBUG
 			  , std::ostream& debug
 		  #endif
 			  ) {
-	char c;
-	bool end = false;
+	using namespace compile::TokenType;
+
+	const char* const start = source.data;
+	const char* const end = start + source.size;
+	const char* c = start;
 
 	list.clear();
-	file.seekg(0);
+	// Roughly one token every few characters, so the list hardly ever grows
+	list.reserve(source.size / 4 + 1);
 
 #ifdef COMP_DEBUG
 	debug << STRM_DEFAULT << "[DEBUG] Tokenization debug";
 #endif
 
-	while (!end) {
-		file.get(c);
-		end = file.eof();
+	while (true) {
+		while (c < end && (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n')) c++;
+		if (c == end) break;
+
+		const char* const tokenStart = c;
+		Type type;
+		if (isIdentifierStart(*c)) {
+			while (c < end && (isIdentifierStart(*c) || isDigit(*c))) c++;
+			type = identifierType(tokenStart, static_cast<uint32_t>(c - tokenStart));
+		} else if (isDigit(*c)) {
+			while (c < end && (isDigit(*c) || isIdentifierStart(*c))) c++;
+			type = NUMBER;
+		} else if (*c == '"') {
+			// The token keeps its quotes, and any escapes are left for whatever uses the string
+			for (c++; c < end && *c != '"'; c++) {
+				if (*c == '\\' && c + 1 < end) c++;
+			}
+			if (c == end) throw CompileError(CompileError::UNTERMINATED_STRING, static_cast<uint32_t>(tokenStart - start));
+			c++;
+			type = STRING;
+		} else if (*c == '/' && c + 1 < end && c[1] == '/') {
+			while (c < end && *c != '\n') c++;
+			continue;
+		} else if (c + 1 < end && c[1] == '=' && (*c == '<' || *c == '>' || *c == '=' || *c == '!')) {
+			type = *c == '<' ? LT_EQ : *c == '>' ? GT_EQ : *c == '=' ? EQ_EQ : NOT_EQ;
+			c += 2;
+		} else {
+			type = static_cast<unsigned char>(*c) < 128 ? singleTokens.types[static_cast<unsigned char>(*c)] : IDENTIFIER;
+			if (type == IDENTIFIER) throw CompileError(CompileError::UNEXPECTED_CHAR, static_cast<uint32_t>(c - start));
+			c++;
+		}
+
+		list.push_back(Token{ type, static_cast<uint32_t>(tokenStart - start), static_cast<uint32_t>(c - tokenStart) });
+#ifdef COMP_DEBUG
+		debug << "\n" << STRM_DEFAULT << std::setw(8) << list.back().offset << "  " << std::setw(3) << static_cast<int>(type) << "  ";
+		debug.write(tokenStart, c - tokenStart);
+#endif
 	}
+
+	list.push_back(Token{ END, static_cast<uint32_t>(source.size), 0 });
+#ifdef COMP_DEBUG
+	debug << "\n[DEBUG] " << list.size() - 1 << " tokens\n";
+#endif
 }
\ No newline at end of file
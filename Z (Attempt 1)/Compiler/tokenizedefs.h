@@ -1,10 +1,90 @@
 #pragma once
 #include "compile.h"
 
+#include <cstring>
+
 bool matchCharIn(char c, char* const& list) {
 	int i = 0;
 	while (true) {
 		if (list[i] == c) return true;
 		if (list[i++] == '\0') return false;
 	}
-}
\ No newline at end of file
+}
+
+// Keywords, which are tokenized as identifiers first and then looked up here
+struct Keyword {
+	const char* str;
+	uint32_t length;
+	compile::TokenType::Type type;
+};
+
+constexpr Keyword keywords[] = {
+	{ "if", 2, compile::TokenType::IF },
+	{ "else", 4, compile::TokenType::ELSE },
+	{ "elif", 4, compile::TokenType::ELIF },
+	{ "while", 5, compile::TokenType::WHILE },
+	{ "for", 3, compile::TokenType::FOR },
+	{ "return", 6, compile::TokenType::RETURN },
+	{ "and", 3, compile::TokenType::AND },
+	{ "or", 2, compile::TokenType::OR },
+	{ "true", 4, compile::TokenType::TRUE },
+	{ "false", 5, compile::TokenType::FALSE },
+	{ "int", 3, compile::TokenType::INT }
+};
+
+compile::TokenType::Type identifierType(const char* str, uint32_t length) {
+	for (const Keyword& keyword : keywords) {
+		if (keyword.length == length && std::memcmp(keyword.str, str, length) == 0) return keyword.type;
+	}
+	return compile::TokenType::IDENTIFIER;
+}
+
+bool isIdentifierStart(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+// Single character tokens, by character (IDENTIFIER where there isn't one)
+struct SingleTokens {
+	compile::TokenType::Type types[128];
+
+	SingleTokens() {
+		using namespace compile::TokenType;
+		for (Type& type : types) type = IDENTIFIER;
+		types['('] = LEFT_PAREN;
+		types[')'] = RIGHT_PAREN;
+		types['['] = LEFT_BRACKET;
+		types[']'] = RIGHT_BRACKET;
+		types['{'] = LEFT_CURLY;
+		types['}'] = RIGHT_CURLY;
+		types['~'] = TILDE;
+		types['`'] = BACKTICK;
+		types['!'] = NOT;
+		types['@'] = AT;
+		types['#'] = HASH;
+		types['$'] = DOLLAR;
+		types['%'] = PCT;
+		types['^'] = CARET;
+		types['&'] = AMP;
+		types['*'] = AST;
+		types['-'] = MINUS;
+		types['+'] = PLUS;
+		types['='] = EQ;
+		types['|'] = PIPE;
+		types['\\'] = BACKSLASH;
+		types[':'] = COLON;
+		types[';'] = SEMICOLON;
+		types['\''] = QUOTE;
+		types['<'] = LT;
+		types[','] = COMMA;
+		types['>'] = GT;
+		types['.'] = PERIOD;
+		types['?'] = Q_MARK;
+		types['/'] = SLASH;
+	}
+};
+
+const SingleTokens singleTokens;
\ No newline at end of file
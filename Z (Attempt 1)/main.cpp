@@ -3,7 +3,9 @@
 #include <chrono>
 #include <fstream>
 #include <string>
+#include <vector>
 #include "VM/vm.h"
+#include "Compiler/compile.h"
 
 /*#define VM_DEBUG
 #include "VM/vmassemble.h"
@@ -62,6 +64,63 @@ int exec(const char* exePath, vm::ExecOptions options, bool debugMode) {
 	return 0;
 }
 
+int parse(const std::vector<const char*>& paths, bool debugMode) {
+	std::vector<std::unique_ptr<compile::Unit>> units;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	compile::ParseFiles(paths, units, 0);
+	const long long micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+	int errors = 0;
+	for (const std::unique_ptr<compile::Unit>& unit : units) {
+		if (!unit->error.empty()) {
+			std::cout << "#### " << unit->path << " Parsed With Error\n     " << unit->error << "\n";
+			errors++;
+			continue;
+		}
+
+		std::cout << unit->path << ": " << unit->tokens.size() - 1 << " tokens, " << unit->exprs.size() << " statements\n";
+		if (debugMode) {
+			for (const compile::Expr* expr : unit->exprs) {
+				std::cout << "     ";
+				compile::PrintExpr(std::cout, unit->source, unit->tokens, expr);
+				std::cout << "\n";
+			}
+		}
+	}
+	std::cout << "Parsed " << units.size() << " files in " << micros << "us\n\n\n";
+
+	return errors != 0;
+}
+
+// Each file goes to the same path with a .azm extension, for Z (Attempt 2) to assemble
+int compileFiles(const std::vector<const char*>& paths) {
+	std::vector<std::unique_ptr<compile::Unit>> units;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	compile::ParseFiles(paths, units, 0);
+
+	int errors = 0;
+	for (const std::unique_ptr<compile::Unit>& unit : units) {
+		std::string azmPath = unit->path;
+		const size_t dot = azmPath.find_last_of('.');
+		if (dot != std::string::npos && azmPath.find_first_of("/\\", dot) == std::string::npos) azmPath.resize(dot);
+		azmPath += ".azm";
+
+		compile::CodegenInfo info;
+		if (!unit->error.empty() || !compile::GenerateFile(*unit, azmPath, info)) {
+			std::cout << "#### " << unit->path << " Compiled With Error\n     " << unit->error << "\n";
+			errors++;
+			continue;
+		}
+
+		std::cout << unit->path << " -> " << azmPath << ": " << info.instructions << " instructions, " << info.registers << " registers, "
+			<< info.spills << " spills (in " << info.slots << " stack words)\n";
+	}
+	const long long micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Compiled " << units.size() << " files in " << micros << "us\n\n\n";
+
+	return errors != 0;
+}
+
 int main(int argc, const char* args[]) {
 
 	vm::AssemblyOptions asmOptions;
@@ -74,7 +133,9 @@ int main(int argc, const char* args[]) {
 		"-exec",
 		"-debug",
 		"-nodebug",
-		"-profile"
+		"-profile",
+		"-parse",
+		"-compile"
 	};
 	constexpr int numPossArgs = sizeof(possArgs) / sizeof(std::string);
 
@@ -114,6 +175,32 @@ int main(int argc, const char* args[]) {
 					case 4: // profile
 						exeOptions.flags |= vm::ExecOptions::PROFILE;
 						break;
+
+					case 5: { // parse
+						std::vector<const char*> paths;
+						for (int k = i + 1; k < argc && args[k][0] != '-'; k++) paths.push_back(args[k]);
+						if (paths.empty()) {
+							std::cout << "Not enough arguments for parse\n\n\n";
+							return 1;
+						}
+						if (parse(paths, debugMode)) {
+							return 1;
+						}
+						break;
+					}
+
+					case 6: { // compile
+						std::vector<const char*> paths;
+						for (int k = i + 1; k < argc && args[k][0] != '-'; k++) paths.push_back(args[k]);
+						if (paths.empty()) {
+							std::cout << "Not enough arguments for compile\n\n\n";
+							return 1;
+						}
+						if (compileFiles(paths)) {
+							return 1;
+						}
+						break;
+					}
 				}
 				break;
 			}
@@ -0,0 +1,162 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+using vm::executor::Arena;
+
+vm::executor::Arena::Arena(Memory* const& memoryIn) : memory(memoryIn), memoryStart(memoryIn != nullptr ? memoryIn->used : 0), chunk(0), used(0) {
+	std::fill(freeLists, freeLists + NUM_CLASSES, nullptr);
+}
+
+vm::executor::Arena::~Arena() {
+	release();
+	if (memory == nullptr) {
+		for (char* const& c : chunks) delete[] c;
+	}
+}
+
+char* vm::executor::Arena::alloc(const types::word_t& size) {
+	if (size < 0) throw std::bad_alloc();
+
+	const size_t total = static_cast<size_t>(size) + sizeof(Header);
+	char* block;
+
+	if (total > MAX_SMALL) {
+		block = memory != nullptr ? memory->take(total) : new char[total];
+		*reinterpret_cast<Header*>(block) = { -1, static_cast<types::word_t>(large.size()) };
+		large.push_back(block);
+		return block + sizeof(Header);
+	}
+
+	const int sizeClass = static_cast<int>((total - 1) / GRANULE);
+	if (freeLists[sizeClass] != nullptr) {
+		block = freeLists[sizeClass];
+		freeLists[sizeClass] = *reinterpret_cast<char**>(block + sizeof(Header));
+		return block + sizeof(Header);
+	}
+
+	const size_t blockSize = (sizeClass + 1) * GRANULE;
+	if (chunks.empty() || used + blockSize > CHUNK_SIZE) {
+		if (!chunks.empty()) chunk++;
+		if (chunk == chunks.size()) chunks.push_back(memory != nullptr ? memory->take(CHUNK_SIZE) : new char[CHUNK_SIZE]);
+		used = 0;
+	}
+	block = chunks[chunk] + used;
+	used += blockSize;
+
+	*reinterpret_cast<Header*>(block) = { sizeClass, 0 };
+	return block + sizeof(Header);
+}
+
+void vm::executor::Arena::free(char* const& ptr) {
+	if (ptr == nullptr) return;
+
+	char* const block = ptr - sizeof(Header);
+	const Header& header = *reinterpret_cast<Header*>(block);
+	if (header.sizeClass < 0) {
+		if (memory == nullptr) delete[] large[header.largeIndex];
+		large[header.largeIndex] = nullptr;
+	} else {
+		*reinterpret_cast<char**>(ptr) = freeLists[header.sizeClass];
+		freeLists[header.sizeClass] = block;
+	}
+}
+
+void vm::executor::Arena::push() {
+	marks.emplace_back();
+	Mark& mark = marks.back();
+	mark.chunk = chunk;
+	mark.used = used;
+	mark.large = large.size();
+	std::copy(freeLists, freeLists + NUM_CLASSES, mark.freeLists);
+	std::fill(freeLists, freeLists + NUM_CLASSES, nullptr);
+}
+
+void vm::executor::Arena::pop() {
+	if (marks.empty()) return;
+
+	const Mark& mark = marks.back();
+	chunk = mark.chunk;
+	used = mark.used;
+	if (memory == nullptr) {
+		for (size_t i = mark.large; i < large.size(); i++) delete[] large[i];
+	}
+	large.resize(mark.large);
+	std::copy(mark.freeLists, mark.freeLists + NUM_CLASSES, freeLists);
+	marks.pop_back();
+}
+
+void vm::executor::Arena::release() {
+	if (memory == nullptr) {
+		for (char* const& block : large) delete[] block;
+	} else {
+		// Everything after the start goes back at once, and the chunks are taken again (at the same addresses)
+		memory->used = memoryStart;
+		chunks.clear();
+	}
+	large.clear();
+	chunk = 0;
+	used = 0;
+	std::fill(freeLists, freeLists + NUM_CLASSES, nullptr);
+	marks.clear();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Snapshots
+
+// Everything is saved as 64-bit words: the counts, then chunk and used, then each chunk, each big block, each free
+// list, and finally each mark (chunk, used, large, then its free lists). Pointers are only valid in the same Memory.
+void vm::executor::Arena::save(std::vector<char>& out) const {
+	std::vector<uint64_t> words = { chunks.size(), large.size(), marks.size(), chunk, used };
+	for (char* const& c : chunks) words.push_back(reinterpret_cast<uint64_t>(c));
+	for (char* const& block : large) words.push_back(reinterpret_cast<uint64_t>(block));
+	for (char* const& list : freeLists) words.push_back(reinterpret_cast<uint64_t>(list));
+	for (const Mark& mark : marks) {
+		words.insert(words.end(), { mark.chunk, mark.used, mark.large });
+		for (char* const& list : mark.freeLists) words.push_back(reinterpret_cast<uint64_t>(list));
+	}
+
+	const char* const bytes = reinterpret_cast<const char*>(words.data());
+	out.insert(out.end(), bytes, bytes + words.size() * sizeof(uint64_t));
+}
+
+bool vm::executor::Arena::load(const char* const& data, const size_t& size) {
+	if (memory == nullptr || size % sizeof(uint64_t) != 0 || size < 5 * sizeof(uint64_t)) return false;
+	std::vector<uint64_t> words(size / sizeof(uint64_t));
+	std::memcpy(words.data(), data, size);
+
+	const uint64_t chunkCount = words[0], largeCount = words[1], markCount = words[2];
+	if (chunkCount > words.size() || largeCount > words.size() || markCount > words.size() ||
+		words.size() != 5 + chunkCount + largeCount + NUM_CLASSES + markCount * (3 + NUM_CLASSES)) return false;
+	if (words[3] > chunkCount || words[4] > CHUNK_SIZE) return false;
+
+	// Every pointer has to be into the arena's part of memory (or null, for a freed big block or an empty list)
+	const uint64_t low = reinterpret_cast<uint64_t>(memory->base + memoryStart), high = reinterpret_cast<uint64_t>(memory->base + memory->used);
+	const auto isValid = [&](const uint64_t& pointer) { return pointer == 0 || (low <= pointer && pointer < high); };
+	const size_t marksStart = static_cast<size_t>(5 + chunkCount + largeCount + NUM_CLASSES);
+	for (size_t i = 5; i < marksStart; i++) {
+		if (!isValid(words[i])) return false;
+	}
+	for (size_t i = marksStart; i < words.size(); i++) {
+		if ((i - marksStart) % (3 + NUM_CLASSES) >= 3 && !isValid(words[i])) return false;
+	}
+
+	const uint64_t* word = words.data() + 5;
+	chunks.resize(static_cast<size_t>(chunkCount));
+	for (char*& c : chunks) c = reinterpret_cast<char*>(*word++);
+	large.resize(static_cast<size_t>(largeCount));
+	for (char*& block : large) block = reinterpret_cast<char*>(*word++);
+	for (char*& list : freeLists) list = reinterpret_cast<char*>(*word++);
+	marks.resize(static_cast<size_t>(markCount));
+	for (Mark& mark : marks) {
+		mark.chunk = static_cast<size_t>(*word++);
+		mark.used = static_cast<size_t>(*word++);
+		mark.large = static_cast<size_t>(*word++);
+		for (char*& list : mark.freeLists) list = reinterpret_cast<char*>(*word++);
+	}
+	chunk = static_cast<size_t>(words[3]);
+	used = static_cast<size_t>(words[4]);
+	return true;
+}
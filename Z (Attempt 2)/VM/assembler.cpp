@@ -1,16 +1,62 @@
 #include "vm.h"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <ios>
-#include <unordered_map>
+#include <thread>
 
 using vm::assembler::AssemblerException;
+using vm::assembler::Linked;
+using vm::assembler::StringView;
+using vm::assembler::Symbol;
 using std::cout;
 
-#define ASM_DEBUG(thing) if (isDebug) stream << IO_DEBUG << thing << IO_NORM "\n"
-#define ASM_WRITERAW(thing, sz) outputFile.write(thing, sz); byteCounter += sz
-#define ASM_WRITE(thing, type) outputFile.write(TO_CH_PT(thing), sizeof(type)); byteCounter += sizeof(type)
+namespace {
+	// Reads all of stream into source, in large blocks
+	void readSource(std::istream& stream, std::vector<char>& source) {
+		constexpr std::streamsize BLOCK_SIZE = 0x100000;
+
+		std::streamsize got = BLOCK_SIZE;
+		while (got == BLOCK_SIZE) {
+			const size_t used = source.size();
+			source.resize(used + BLOCK_SIZE);
+			got = stream.rdbuf()->sgetn(source.data() + used, BLOCK_SIZE);
+			source.resize(used + static_cast<size_t>(got));
+		}
+	}
+}
+
+namespace {
+	// Assembles the sources, unless the cache has them already. Debug mode always assembles, so the output shows up.
+	int assembleCached(const std::vector<StringView>& sources, std::vector<char>& output, vm::assembler::AssemblerSettings& assemblerSettings) {
+		using namespace vm::assembler;
+
+		const bool useCache = assemblerSettings.cachePath != nullptr && !assemblerSettings.flags.hasFlags(vm::FLAG_DEBUG);
+		uint64_t key = 0;
+		if (useCache) {
+			key = cacheKey(sources, assemblerSettings);
+			if (loadCached(assemblerSettings.cachePath, key, output)) {
+				cout << "Using the cached program in \"" << assemblerSettings.cachePath << "\"\n";
+				return 0;
+			}
+		}
+
+		if (assemble_(sources, output, assemblerSettings, std::cout)) return 1;
+
+		if (useCache && !storeCached(assemblerSettings.cachePath, key, output, assemblerSettings.cacheLimit)) {
+			cout << IO_WARN "Could not store the program in the cache \"" << assemblerSettings.cachePath << "\"" IO_NORM "\n";
+		}
+		return 0;
+	}
+}
 
 int vm::assembler::assemble(const char* const& assemblyPath, const char* const& outputPath, AssemblerSettings& assemblerSettings) {
+	std::vector<char> output;
+	return assemble(assemblyPath, outputPath, assemblerSettings, output);
+}
+
+int vm::assembler::assemble(const char* const& assemblyPath, const char* const& outputPath, AssemblerSettings& assemblerSettings, std::vector<char>& output) {
 	cout << "Attempting to assemble file \"" << assemblyPath << "\" into output file \"" << outputPath << "\"\n";
 
 	std::fstream assemblyFile, outputFile;
@@ -28,7 +74,13 @@ int vm::assembler::assemble(const char* const& assemblyPath, const char* const&
 	}
 
 	try {
-		return vm::assembler::assemble_(assemblyFile, outputFile, assemblerSettings, std::cout);
+		std::vector<char> source;
+		readSource(assemblyFile, source);
+		assemblyFile.close();
+
+		if (assembleCached(std::vector<StringView>{ StringView(source.data(), source.size()) }, output, assemblerSettings)) return 1;
+		outputFile.write(output.data(), output.size());
+		return 0;
 	} catch (AssemblerException& e) {
 		cout << IO_ERR "Error during assembly at LINE " << e.line << ", COLUMN " << e.column << " : " << e.what() << IO_NORM IO_END;
 	} catch (std::exception& e) {
@@ -38,63 +90,265 @@ int vm::assembler::assemble(const char* const& assemblyPath, const char* const&
 	return 1;
 }
 
-int vm::assembler::assemble_(std::iostream& assemblyFile, std::iostream& outputFile, AssemblerSettings& assemblerSettings, std::ostream& stream) {
-	using namespace vm::opcode;
-	using namespace vm::types;
+int vm::assembler::assemble(const std::vector<const char*>& assemblyPaths, const char* const& outputPath, AssemblerSettings& assemblerSettings) {
+	cout << "Attempting to assemble files ";
+	for (size_t i = 0; i < assemblyPaths.size(); i++) cout << (i == 0 ? "\"" : ", \"") << assemblyPaths[i] << "\"";
+	cout << " into output file \"" << outputPath << "\"\n";
+
+	std::vector<std::vector<char>> sources(assemblyPaths.size());
+	std::vector<StringView> views;
+	for (size_t i = 0; i < assemblyPaths.size(); i++) {
+		std::fstream assemblyFile;
+		assemblyFile.open(assemblyPaths[i], std::ios::in);
+		if (!assemblyFile.is_open()) {
+			cout << IO_ERR "Could not open file \"" << assemblyPaths[i] << "\"" IO_NORM IO_END;
+			return 1;
+		}
+		readSource(assemblyFile, sources[i]);
+		views.push_back(StringView(sources[i].data(), sources[i].size()));
+	}
 
-	// Flags/settings
-	const bool isDebug = assemblerSettings.flags.hasFlags(vm::FLAG_DEBUG);
+	std::fstream outputFile;
+	outputFile.open(outputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!outputFile.is_open()) {
+		cout << IO_ERR "Could not open file \"" << outputPath << "\"" IO_NORM IO_END;
+		return 1;
+	}
+
+	try {
+		std::vector<char> output;
+		if (assembleCached(views, output, assemblerSettings)) return 1;
+		outputFile.write(output.data(), output.size());
+		return 0;
+	} catch (AssemblerException& e) {
+		cout << IO_ERR "Error during assembly of \"" << assemblyPaths[e.file] << "\" at LINE " << e.line << ", COLUMN " << e.column << " : " << e.what() << IO_NORM IO_END;
+	} catch (std::exception& e) {
+		cout << IO_ERR "An unknown error ocurred during assembly. This error is most likely an issue with the c++ assembler code, not your code. Sorry. The provided error message is as follows:\n" << e.what() << IO_NORM IO_END;
+	}
+
+	return 1;
+}
 
-	// File setup
+int vm::assembler::assemble_(std::iostream& assemblyFile, std::iostream& outputFile, AssemblerSettings& assemblerSettings, std::ostream& stream) {
 	assemblyFile.clear();
 	assemblyFile.seekg(0, std::ios::beg);
 	outputFile.clear();
 	outputFile.seekp(0, std::ios::beg);
-	const std::streampos assemblyFileBeg = assemblyFile.tellg();
-	const std::streampos outputFileBeg = outputFile.tellp();
-	int byteCounter = 0;
 
-	// String
-	char str[vm::assembler::MAX_STR_SIZE];
-	int strlen = 0;
-	char c = -1;
-	int line = 0;
-	int column = -1;
+	std::vector<char> source;
+	readSource(assemblyFile, source);
+
+	std::vector<char> output;
+	if (assemble_(source.data(), source.size(), output, assemblerSettings, stream)) return 1;
+	outputFile.write(output.data(), output.size());
+	return 0;
+}
+
+namespace {
+	constexpr vm::assembler::PerfectHash<vm::opcode::count, 0x1000> opcodeTable(vm::opcode::strings);
+	constexpr vm::assembler::PerfectHash<vm::register_::R0 + vm::register_::NUM_GEN_REGISTERS, 0x400> registerTable(vm::register_::names);
+	constexpr vm::assembler::PerfectHash<vm::register_::NUM_VEC_REGISTERS, 0x40> vectorRegisterTable(vm::register_::vectorNames);
+
+	inline bool isDelimiter(const char& c) {
+		return c == ' ' || c == ',' || c == '\n' || c == '\t';
+	}
+
+	// Strings, comments and parentheses
+	inline bool isSpecial(const char& c) {
+		return c == '"' || c == ';' || c == '(';
+	}
+
+	// Splits assembly source into tokens. A token is normally a view straight into the source; only one with a string,
+	// comment or parenthesis inside it (which all get spliced into whatever token they interrupt) is built up in a
+	// scratch buffer instead.
+	class Scanner {
+	public:
+		// Where the character that ended the last token is, for error messages
+		int line;
+		int column;
+		// Set if the source ran out partway through a token (or a string, comment or parenthesis), so the source
+		// that follows on from this one would have carried on with it
+		bool isCut;
+
+		Scanner(const char* const& sourceIn, const size_t& lengthIn) : line(0), column(0), isCut(false), p(sourceIn), end(sourceIn + lengthIn), lineStart(sourceIn), currentLine(0) {}
+
+		int lines() const {
+			return currentLine;
+		}
+
+		// Returns false once there are no tokens left. isCopied is set if the token is in the scratch buffer, which
+		// the next call overwrites.
+		bool next(StringView& token, bool& isCopied) {
+			while (p < end && isDelimiter(*p)) advance();
+			if (p == end) return false;
+
+			const char* const start = p;
+			while (p < end && !isDelimiter(*p) && !isSpecial(*p)) p++;
+			if (p - start > vm::assembler::MAX_STR_SIZE) {
+				p = start + vm::assembler::MAX_STR_SIZE;
+				throw AssemblerException(AssemblerException::STRING_TOO_LONG, currentLine, static_cast<int>(p - lineStart));
+			}
+
+			if (p == end || isDelimiter(*p)) {
+				token = StringView(start, p - start);
+				isCopied = false;
+				isCut = p == end;
+				endToken();
+				return true;
+			}
+
+			scratch.assign(start, p);
+			if (!splice()) return false;
+			token = StringView(scratch.data(), scratch.size());
+			isCopied = true;
+			return true;
+		}
+
+	private:
+		const char* p;
+		const char* const end;
+		const char* lineStart;
+		int currentLine;
+		std::vector<char> scratch;
+
+		void advance() {
+			if (*p == '\n') {
+				currentLine++;
+				lineStart = p + 1;
+			}
+			p++;
+		}
+
+		void endToken() {
+			line = currentLine;
+			column = static_cast<int>(p - lineStart);
+			if (p < end) advance();
+		}
+
+		void append(const char& c) {
+			if (scratch.size() >= vm::assembler::MAX_STR_SIZE) {
+				throw AssemblerException(AssemblerException::STRING_TOO_LONG, currentLine, static_cast<int>(p - lineStart));
+			}
+			scratch.push_back(c);
+		}
+
+		// Carries on the token in scratch, character by character, until a delimiter. Returns false if the source ran
+		// out inside a string, comment or parenthesis (or straight after a string), which drops the token.
+		bool splice() {
+			bool isStr = false;
+			bool isEscaped = false;
+			bool isComment = false;
+			bool isParen = false;
+
+			for (; p < end; advance()) {
+				char c = *p;
+
+				if (isStr) {
+					if (isEscaped) {
+						if (c == 'n') {
+							c = '\n';
+							lineStart = p + 1;
+						} else if (c == 'c') {
+							c = '\033';
+						}
+						// nothing on c == '"'
+
+						isEscaped = false;
+					} else if (c == '"') {
+						isStr = false;
+						continue;
+					} else if (c == '\\') {
+						isEscaped = true;
+						continue;
+					}
+
+					append(c);
+					continue;
+				}
+
+				if (c == '"') {
+					isStr = true;
+					isEscaped = false;
+					continue;
+				}
+
+				if (isComment) {
+					if (c == '\n') isComment = false;
+					continue;
+				}
+
+				if (isParen) {
+					if (c == ')') isParen = false;
+					continue;
+				}
+
+				if (c == ';') {
+					isComment = true;
+					continue;
+				}
+
+				if (c == '(') {
+					isParen = true;
+					continue;
+				}
+
+				if (isDelimiter(c)) {
+					if (scratch.empty()) continue;
+					endToken();
+					return true;
+				}
+
+				append(c);
+			}
+
+			line = currentLine;
+			column = static_cast<int>(p - lineStart);
+			isCut = isStr || isComment || isParen || !scratch.empty();
+			return !isStr && !isComment && !isParen && end[-1] != '"' && !scratch.empty();
+		}
+	};
+}
+
+#define ASM_DEBUG(thing) if (isDebug) stream << IO_DEBUG << thing << IO_NORM "\n"
+#define ASM_WRITERAW(thing, sz) output.insert(output.end(), thing, thing + (sz))
+#define ASM_WRITE(thing, type) ASM_WRITERAW(TO_CH_PT(thing), sizeof(type))
+
+void vm::assembler::assembleFragment(const char* const& source, const size_t& sourceLength, Fragment& fragment, AssemblerSettings& assemblerSettings, std::ostream& stream) {
+	using namespace vm::opcode;
+	using namespace vm::types;
+	typedef Fragment::Label Label;
+
+	// Flags/settings
+	const bool isDebug = assemblerSettings.flags.hasFlags(vm::FLAG_DEBUG);
+
+	// Tokens
+	Scanner scanner(source, sourceLength);
+	StringView str;
+	bool isCopied = false;
 
 	// Booleans
-	bool end = false;
-	bool isComment = false;
-	bool isParen = false;
-	bool isStr = false;
-	bool isEscaped = false;
 	bool isSettingGlobals = true;
 
 	// Labels and Vars
-	struct Label {
-		struct Ref {
-			const std::streampos pos;
-			const int line;
-			const int column;
-
-			Ref(std::streampos posIn, int lineIn, int columnIn) : pos(posIn), line(lineIn), column(columnIn) {}
-		};
-		word_t val;
-		std::vector<Ref> refs;
-		bool isDef;
-
-		Label() : val(0), isDef(false) {}
-		Label(vm::types::word_t valIn) : val(valIn), isDef(true) {}
+	std::unordered_map<StringView, Label, StringView::Hash>& labels = fragment.labels;
+	const auto labelAt = [&](const StringView& name) -> Label& {
+		// Names that came out of the scanner's scratch buffer need somewhere to live
+		if (!isCopied) return labels[name];
+		auto found = labels.find(name);
+		if (found != labels.end()) return found->second;
+		fragment.names.emplace_back(name.data, name.length);
+		return labels[StringView(fragment.names.back().data(), name.length)];
 	};
-	std::unordered_map<std::string, Label> labels;
-	std::string startstr = "@__START__";
-	labels[startstr].isDef = true;
-	labels[startstr].val = format::GLOBAL_TABLE_LOCATION; // TODO : set this later, to point after global data
-	labels[startstr].refs.push_back(Label::Ref(outputFileBeg + static_cast<std::streamoff>(format::FIRST_INSTR_ADDR_LOCATION), -1, -1));
 	word_t labelPlaceholder = wordPlaceholder;
-	word_t labelErr = wordErr;
 
-	// Lonely stdstr
-	std::string stdstr;
+	// Everything is emitted into the fragment, and placed (and has its labels filled in) by link()
+	std::vector<char>& output = fragment.bytes;
+	output.clear();
+	output.reserve(sourceLength / 2);
+	labels.clear();
+	fragment.globalsSize = 0;
+	fragment.firstGlobalLine = -1;
+	fragment.firstGlobalColumn = -1;
 
 	// Arguments, opcodes
 	int carg = 0;
@@ -106,222 +360,469 @@ int vm::assembler::assemble_(std::iostream& assemblyFile, std::iostream& outputF
 	byte_t byte = 0;
 	short_t short_ = 0;
 
-	// Pre-assembly file writing
-	word_t dummy = labelErr;
-	ASM_WRITE(dummy, word_t); // First instruction addr (to be overwritten later)
-
 	// Da big loop
-	while (!end) {
-		// Update char and file pos
-		if (c == '\n') {
-			line++;
-			column = 0;
-		} else {
-			column++;
-		}
-		assemblyFile.get(c);
-		if (assemblyFile.eof()) end = true;
-
-		// Dealing with strings and comments
-		if (isStr) {
-			if (isEscaped) {
-				if (c == 'n') {
-					c = '\n';
-					line--;
-				} else if (c == 'c') {
-					c = '\033';
+	while (scanner.next(str, isCopied)) {
+		const int strlen = static_cast<int>(str.length);
+		const int& line = scanner.line;
+		const int& column = scanner.column;
+		const word_t byteCounter = static_cast<word_t>(format::GLOBAL_TABLE_LOCATION + output.size());// Where this would be in a program on its own
+
+		if (opcode == NOP) ASM_DEBUG("");
+		ASM_DEBUG((opcode == NOP ? ":: " : "|  ") << str);
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+		if (opcode == NOP) {
+			if (str.data[0] == '@') {
+				Label& label = labelAt(str);
+				label.pos = output.size();
+				label.isDef = true;
+				ASM_DEBUG("Label Location: " << byteCounter);
+			} else {
+				const int match = opcodeTable.find(str.data, str.length);
+				if (match < 0) {
+					throw AssemblerException(AssemblerException::INVALID_OPCODE_PARSE, line, column);
 				}
-				// nothing on c == '"'
+				opcode = static_cast<opcode_t>(match);
 
-				isEscaped = false;
-			} else {
-				if (c == '"') {
-					isStr = false;
-					continue;
+				if (isSettingGlobals && opcode < GLOBAL_BREAK) {
+					isSettingGlobals = false;
+					fragment.globalsSize = output.size();
 				}
 
-				if (c == '\\') {
-					isEscaped = true;
-					continue;
+				if (opcode >= GLOBAL_BREAK && fragment.firstGlobalLine < 0) {
+					fragment.firstGlobalLine = line;
+					fragment.firstGlobalColumn = column;
+				}
+
+				if (!isSettingGlobals) {
+					if (opcode >= GLOBAL_BREAK) {
+						throw AssemblerException(AssemblerException::MISPLACED_GLOBAL, line, column);
+					} else {
+						ASM_WRITE(opcode, opcode_t);
+					}
 				}
-			}
 
-			if (strlen >= MAX_STR_SIZE) {
-				throw AssemblerException(AssemblerException::STRING_TOO_LONG, line, column);
+				carg = 0;
+				ASM_DEBUG("Opcode: " << static_cast<int>(opcode));
+				if (args[opcode][0] == 0) opcode = NOP;
 			}
-			str[strlen++] = c;
-			continue;
+
 		} else {
-			if (c == '"') {
-				isStr = true;
-				isEscaped = false;
-				continue;
+			switch (args[opcode][carg]) {
+				case 0: // ARG_NONE
+					// THIS SHOULD NEVER BE CALLED
+					carg = MAX_ARGS;
+					break;
+
+				case 1: // ARG_REG
+					reg = parseRegister(str.data, strlen, line, column);
+					ASM_WRITE(reg, reg_t);
+					break;
+
+				case 7: // ARG_VREG
+					reg = parseVectorRegister(str.data, strlen, line, column);
+					ASM_WRITE(reg, reg_t);
+					break;
+
+				case 2: // ARG_WORD
+					if (str.data[0] == '@' || str.data[0] == '%') {
+						labelAt(str).refs.push_back(Fragment::Ref(output.size(), line, column));
+						ASM_WRITE(labelPlaceholder, word_t);
+					} else {
+						// TODO : printed wrong line/column?
+						word = parseNumber<word_t, AssemblerException::INVALID_WORD_PARSE>(str.data, strlen, line, column);
+						ASM_WRITE(word, word_t);
+					}
+					break;
+
+				case 3: // ARG_BYTE
+					byte = parseNumber<byte_t, AssemblerException::INVALID_BYTE_PARSE>(str.data, strlen, line, column);
+					ASM_WRITE(byte, byte_t);
+					break;
+
+				case 4: // ARG_SHORT
+					short_ = parseNumber<short_t, AssemblerException::INVALID_SHORT_PARSE>(str.data, strlen, line, column);
+					ASM_WRITE(short_, short_t);
+					break;
+
+				case 5: // ARG_VAR
+					if (str.data[0] == '%') {
+						Label& label = labelAt(str);
+						label.pos = output.size();
+						label.isDef = true;
+						ASM_DEBUG("Var Location: " << byteCounter);
+					} else {
+						throw AssemblerException(AssemblerException::INVALID_VAR_PARSE, line, column);
+					}
+					break;
+
+				case 6: // ARG_STR
+					ASM_WRITERAW(str.data, strlen);
+					output.push_back('\0');
+					break;
 			}
 
-			if (isComment) {
-				if (c == '\n') isComment = false;
-				continue;
+			carg++;
+			if (carg >= MAX_ARGS || args[opcode][carg] == 0) {
+				opcode = NOP;
 			}
+		}
+	}
+
+	/*
+	opcode = HALT;
+	ASM_WRITE(opcode, opcode_t);
+	*/
+
+	if (isSettingGlobals) fragment.globalsSize = output.size();
+	fragment.hasCode = !isSettingGlobals;
+	fragment.lines = scanner.lines();
+	fragment.isClean = !scanner.isCut && opcode == NOP;
+
+	ASM_DEBUG(IO_END);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Linking
+
+void vm::assembler::link(const std::vector<Fragment>& fragments, Linked& program) {
+	using namespace vm::types;
+
+	std::vector<char>& output = program.image;
+	std::vector<Symbol>& symbols = program.symbols;
+	size_t& codeStart = program.codeStart;
+
+	// Every fragment's globals come first, in order, then every fragment's instructions
+	std::vector<size_t> globalsBase(fragments.size());
+	std::vector<size_t> codeBase(fragments.size());
+	size_t size = format::GLOBAL_TABLE_LOCATION;
+	for (size_t i = 0; i < fragments.size(); i++) {
+		globalsBase[i] = size;
+		size += fragments[i].globalsSize;
+	}
+	codeStart = size;
+	bool hasCode = false;
+	for (size_t i = 0; i < fragments.size(); i++) {
+		codeBase[i] = size;
+		size += fragments[i].bytes.size() - fragments[i].globalsSize;
+		hasCode = hasCode || fragments[i].hasCode;
+	}
 
-			if (isParen) {
-				if (c == ')') isParen = false;
-				continue;
+	output.clear();
+	output.resize(size);
+	program.relocations.clear();
+	for (size_t i = 0; i < fragments.size(); i++) {
+		const Fragment& fragment = fragments[i];
+		std::copy(fragment.bytes.begin(), fragment.bytes.begin() + fragment.globalsSize, output.begin() + globalsBase[i]);
+		std::copy(fragment.bytes.begin() + fragment.globalsSize, fragment.bytes.end(), output.begin() + codeBase[i]);
+	}
+
+	const auto place = [&](const size_t& i, const size_t& pos) -> size_t {
+		return pos < fragments[i].globalsSize ? globalsBase[i] + pos : codeBase[i] + (pos - fragments[i].globalsSize);
+	};
+
+	// A later definition replaces an earlier one, just like within a file, so the last fragment that defines a name
+	// has the definition that counts. Usually that's the fragment with the reference, found without another lookup.
+	const auto findDef = [&](const StringView& name, const size_t& i, const Fragment::Label& own, word_t& val) -> bool {
+		for (size_t k = fragments.size(); k-- > 0;) {
+			const Fragment::Label* label = &own;
+			if (k != i) {
+				auto found = fragments[k].labels.find(name);
+				if (found == fragments[k].labels.end()) continue;
+				label = &found->second;
 			}
+			if (label->isDef) {
+				val = static_cast<word_t>(place(k, label->pos));
+				return true;
+			}
+		}
+		return false;
+	};
 
-			if (c == ';') {
-				isComment = true;
-				continue;
+	const StringView startstr("@__START__", 10);
+	word_t start = static_cast<word_t>(hasCode ? codeStart : format::GLOBAL_TABLE_LOCATION); // TODO : point after global data when there are no instructions?
+	for (size_t i = 0; i < fragments.size(); i++) {
+		auto own = fragments[i].labels.find(startstr);
+		if (own != fragments[i].labels.end()) {
+			findDef(startstr, i, own->second, start);
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < fragments.size(); i++) {
+		for (const std::pair<const StringView, Fragment::Label>& pair : fragments[i].labels) {
+			if (pair.second.refs.empty()) continue;
+
+			word_t val = start;
+			if (findDef(pair.first, i, pair.second, val) || pair.first == startstr) {
+				for (const Fragment::Ref& ref : pair.second.refs) {
+					std::memcpy(output.data() + place(i, ref.pos), &val, sizeof(word_t));
+					program.relocations.push_back(place(i, ref.pos));
+				}
+			} else {
+				const Fragment::Ref& ref = pair.second.refs[0];
+				const std::string name(pair.first.data, pair.first.length);
+				AssemblerException e(name[0] == '@' ? AssemblerException::UNDEFINED_LABEL : AssemblerException::UNDEFINED_VAR, fragments[i].firstLine + ref.line, ref.column, name);
+				e.file = fragments[i].file;
+				throw e;
 			}
+		}
+	}
 
-			if (c == '(') {
-				isParen = true;
-				continue;
+	std::memcpy(output.data() + format::FIRST_INSTR_ADDR_LOCATION, &start, sizeof(word_t));
+
+	// Only the definitions that count, sorted so the table comes out the same however the sources were split up
+	symbols.clear();
+	for (size_t i = 0; i < fragments.size(); i++) {
+		for (const std::pair<const StringView, Fragment::Label>& pair : fragments[i].labels) {
+			word_t val;
+			if (pair.second.isDef && findDef(pair.first, i, pair.second, val) && static_cast<size_t>(val) == place(i, pair.second.pos)) {
+				symbols.push_back(Symbol{ pair.first, val });
 			}
 		}
+	}
+	std::sort(symbols.begin(), symbols.end(), [](const Symbol& a, const Symbol& b) {
+		if (a.value != b.value) return a.value < b.value;
+		const int order = std::memcmp(a.name.data, b.name.data, std::min(a.name.length, b.name.length));
+		return order != 0 ? order < 0 : a.name.length < b.name.length;
+	});
+}
 
-		// At the end of a token:
-		if (c == ' ' || c == ',' || c == '\n' || c == '\t' || end) {
-			if (strlen == 0) continue;
-			str[strlen] = '\0';
-			if (opcode == NOP) ASM_DEBUG("");
-			ASM_DEBUG((opcode == NOP ? ":: " : "|  ") << str);
-
-			// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
-
-			if (opcode == NOP) {
-				if (str[0] == '@') {
-					stdstr = str;
-					labels[stdstr].val = byteCounter;
-					labels[stdstr].isDef = true;
-					ASM_DEBUG("Label Location: " << byteCounter);
-				} else {
-					opcode = stringMatchAt(str, strings, count);
-					if (opcode == INVALID) { // opcode == 255, meaning stringMatchAt returned -1
-						throw AssemblerException(AssemblerException::INVALID_OPCODE_PARSE, line, column);
-					}
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Output
 
-					if (isSettingGlobals && opcode < GLOBAL_BREAK) {
-						isSettingGlobals = false;
-						labels[startstr].val = byteCounter;
-					}
+namespace {
+	uint32_t alignToPage(const size_t& offset) {
+		return static_cast<uint32_t>((offset + vm::format::PAGE_SIZE - 1) / vm::format::PAGE_SIZE * vm::format::PAGE_SIZE);
+	}
 
-					if (!isSettingGlobals) {
-						if (opcode >= GLOBAL_BREAK) {
-							throw AssemblerException(AssemblerException::MISPLACED_GLOBAL, line, column);
-						} else {
-							ASM_WRITE(opcode, opcode_t);
-						}
-					}
+	template<typename T>
+	void appendValue(std::vector<char>& out, const T& value) {
+		const char* const bytes = reinterpret_cast<const char*>(&value);
+		out.insert(out.end(), bytes, bytes + sizeof(T));
+	}
+}
 
-					carg = 0;
-					ASM_DEBUG("Opcode: " << static_cast<int>(opcode));
-					if (args[opcode][0] == 0) opcode = NOP;
-				}
+void vm::assembler::writeContainer(const Linked& program, AssemblerSettings& assemblerSettings, std::vector<char>& output) {
+	using namespace format;
+	using vm::types::word_t;
+
+	const std::vector<char>& image = program.image;
+	const std::vector<Symbol>& symbols = program.symbols;
+	const size_t& codeStart = program.codeStart;
+
+	// Each symbol is its value, the length of its name, then the name
+	std::vector<char> symbolBytes;
+	appendValue(symbolBytes, static_cast<uint32_t>(symbols.size()));
+	for (const Symbol& symbol : symbols) {
+		appendValue(symbolBytes, symbol.value);
+		appendValue(symbolBytes, static_cast<uint32_t>(symbol.name.length));
+		symbolBytes.insert(symbolBytes.end(), symbol.name.data, symbol.name.data + symbol.name.length);
+	}
 
-			} else {
-				switch (args[opcode][carg]) {
-					case 0: // ARG_NONE
-						// THIS SHOULD NEVER BE CALLED
-						carg = MAX_ARGS;
-						break;
-
-					case 1: // ARG_REG
-						reg = parseRegister(str, strlen, line, column);
-						ASM_WRITE(reg, reg_t);
-						break;
-
-					case 2: // ARG_WORD
-						if (str[0] == '@' || str[0] == '%') {
-							stdstr = str;
-							labels[stdstr].refs.push_back(Label::Ref(outputFile.tellp(), line, column));
-							ASM_WRITE(labelPlaceholder, word_t);
-						} else {
-							// TODO : printed wrong line/column?
-							word = parseNumber<word_t, AssemblerException::INVALID_WORD_PARSE>(str, strlen, line, column);
-							ASM_WRITE(word, word_t);
-						}
-						break;
-
-					case 3: // ARG_BYTE
-						byte = parseNumber<byte_t, AssemblerException::INVALID_BYTE_PARSE>(str, strlen, line, column);
-						ASM_WRITE(byte, byte_t);
-						break;
-
-					case 4: // ARG_SHORT
-						short_ = parseNumber<short_t, AssemblerException::INVALID_SHORT_PARSE>(str, strlen, line, column);
-						ASM_WRITE(short_, short_t);
-						break;
-
-					case 5: // ARG_VAR
-						if (str[0] == '%') {
-							stdstr = str;
-							labels[stdstr].val = byteCounter;
-							labels[stdstr].isDef = true;
-							ASM_DEBUG("Var Location: " << byteCounter);
-						} else {
-							throw AssemblerException(AssemblerException::INVALID_VAR_PARSE, line, column);
-						}
-						break;
+	std::vector<char> decodedBytes;
+	if (assemblerSettings.flags.hasFlags(vm::FLAG_PREDECODE)) {
+		word_t entryLoc;
+		std::memcpy(&entryLoc, image.data() + FIRST_INSTR_ADDR_LOCATION, sizeof(entryLoc));
 
-					case 6: // ARG_STR
-						ASM_WRITERAW(str, strlen + 1);
-						break;
-				}
+		executor::Program loaded(image);
+		executor::DecodedProgram decoded(loaded, assemblerSettings.flags.hasFlags(vm::FLAG_FUSE));
+		decoded.decode(entryLoc);
+		decoded.save(decodedBytes);
+	}
 
-				carg++;
-				if (carg >= MAX_ARGS || args[opcode][carg] == 0) {
-					opcode = NOP;
-				}
-			}
+	std::vector<Section> sections;
+	sections.push_back(Section{ SECTION_DATA, 0, 0, static_cast<uint32_t>(codeStart) });
+	sections.push_back(Section{ SECTION_CODE, SECTION_READ_ONLY, 0, static_cast<uint32_t>(image.size() - codeStart) });
+	sections.push_back(Section{ SECTION_BSS, 0, 0, 0 });
+	sections.push_back(Section{ SECTION_SYMBOLS, SECTION_READ_ONLY, 0, static_cast<uint32_t>(symbolBytes.size()) });
+	if (!decodedBytes.empty()) sections.push_back(Section{ SECTION_DECODED, SECTION_READ_ONLY, 0, static_cast<uint32_t>(decodedBytes.size()) });
+
+	// The data ends where a page starts, so the code starts on one
+	const size_t tableEnd = sizeof(Header) + sections.size() * sizeof(Section);
+	sections[0].offset = alignToPage(tableEnd + codeStart) - static_cast<uint32_t>(codeStart);
+	sections[1].offset = sections[0].offset + sections[0].size;
+	sections[3].offset = alignToPage(sections[1].offset + sections[1].size);
+	if (!decodedBytes.empty()) sections[4].offset = alignToPage(sections[3].offset + sections[3].size);
+	const Section& last = sections.back();
+
+	Header header;
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.sectionCount = static_cast<uint32_t>(sections.size());
+	std::memcpy(&header.entry, image.data() + FIRST_INSTR_ADDR_LOCATION, sizeof(header.entry));
+
+	output.assign(last.offset + last.size, 0);
+	std::memcpy(output.data(), &header, sizeof(header));
+	std::memcpy(output.data() + sizeof(header), sections.data(), sections.size() * sizeof(Section));
+	std::copy(image.begin(), image.end(), output.begin() + sections[0].offset);
+	std::copy(symbolBytes.begin(), symbolBytes.end(), output.begin() + sections[3].offset);
+	std::copy(decodedBytes.begin(), decodedBytes.end(), output.begin() + (decodedBytes.empty() ? 0 : sections[4].offset));
+}
 
-			// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+namespace {
+	using vm::assembler::Fragment;
 
-			strlen = 0;
-			continue;
+	// Sources smaller than this are never split
+	constexpr size_t MIN_CHUNK_SIZE = 0x100000;
+
+	struct Chunk {
+		const char* source;
+		size_t length;
+		size_t file;
+	};
+
+	// Finds the start of the first line after p that starts with a label, or returns end
+	const char* findLabelLine(const char* p, const char* const& end) {
+		while (true) {
+			p = static_cast<const char*>(std::memchr(p, '\n', end - p));
+			if (p == nullptr) return end;
+			p++;
+
+			const char* label = p;
+			while (label < end && (*label == ' ' || *label == '\t')) label++;
+			if (label < end && *label == '@') return p;
 		}
+	}
+
+	// Splits source into (up to) count chunks, each starting on a label line
+	void split(const StringView& source, const unsigned int& count, const size_t& file, std::vector<Chunk>& chunks) {
+		const char* start = source.data;
+		const char* const end = source.data + source.length;
+
+		for (unsigned int i = 1; i < count; i++) {
+			const char* const target = source.data + static_cast<size_t>(static_cast<unsigned long long>(source.length) * i / count);
+			if (target <= start) continue;
 
-		// Add char to string
-		if (strlen >= MAX_STR_SIZE) {
-			throw AssemblerException(AssemblerException::STRING_TOO_LONG, line, column);
+			const char* const cut = findLabelLine(target, end);
+			if (cut == end) break;
+			chunks.push_back(Chunk{ start, static_cast<size_t>(cut - start), file });
+			start = cut;
 		}
-		str[strlen++] = c;
+
+		chunks.push_back(Chunk{ start, static_cast<size_t>(end - start), file });
 	}
+}
 
-	/*
-	opcode = HALT;
-	ASM_WRITE(opcode, opcode_t);
-	*/
+int vm::assembler::assemble_(const std::vector<StringView>& sources, std::vector<char>& output, AssemblerSettings& assemblerSettings, std::ostream& stream) {
+	// Debug output has to come out in order, so it's all done on this thread
+	const bool isDebug = assemblerSettings.flags.hasFlags(vm::FLAG_DEBUG);
+	unsigned int threads = assemblerSettings.threads != 0 ? assemblerSettings.threads : std::thread::hardware_concurrency();
+	if (threads == 0 || isDebug) threads = 1;
+
+	std::vector<Chunk> chunks;
+	for (size_t file = 0; file < sources.size(); file++) {
+		const size_t most = sources[file].length / MIN_CHUNK_SIZE;
+		split(sources[file], static_cast<unsigned int>(std::max<size_t>(1, std::min<size_t>(threads, most))), file, chunks);
+	}
+
+	// Every chunk is assembled on its own. Errors are kept until the end, since an error in one chunk only counts if
+	// every chunk before it in the file really did end cleanly.
+	std::vector<Fragment> fragments(chunks.size());
+	std::vector<std::exception_ptr> errors(chunks.size());
+	const auto assembleChunk = [&](const size_t& i) {
+		try {
+			assembleFragment(chunks[i].source, chunks[i].length, fragments[i], assemblerSettings, stream);
+		} catch (...) {
+			errors[i] = std::current_exception();
+		}
+	};
+
+	if (threads == 1 || chunks.size() == 1) {
+		for (size_t i = 0; i < chunks.size(); i++) assembleChunk(i);
+	} else {
+		std::atomic<size_t> next(0);
+		std::vector<std::thread> workers;
+		for (unsigned int worker = 0; worker < threads && worker < chunks.size(); worker++) {
+			workers.emplace_back([&]() {
+				for (size_t i = next++; i < chunks.size(); i = next++) assembleChunk(i);
+			});
+		}
+		for (std::thread& worker : workers) worker.join();
+	}
 
-	for (const std::pair<std::string, Label>& pair : labels) {
-		if (pair.second.isDef) {
-			for (const Label::Ref& ref : pair.second.refs) {
-				outputFile.seekp(ref.pos);
-				outputFile.write(reinterpret_cast<char*>(const_cast<word_t*>(&pair.second.val)), sizeof(word_t));
+	// Go through each file's chunks in order. If one stopped partway through an instruction, string, comment or
+	// parenthesis, the chunks after it were assembled from the wrong starting point, so the file is done again whole.
+	// Reserved, since growing would copy fragments (a deque's move can throw), leaving labels pointing at the old names
+	std::vector<Fragment> linked;
+	linked.reserve(chunks.size());
+	size_t first = 0;
+	while (first < chunks.size()) {
+		size_t last = first;
+		while (last + 1 < chunks.size() && chunks[last + 1].file == chunks[first].file) last++;
+
+		bool isSplit = last != first;
+		for (size_t i = first; i < last && isSplit; i++) {
+			if (errors[i] != nullptr) break;
+			if (!fragments[i].isClean) isSplit = false;
+		}
+		const size_t file = chunks[first].file;
+		if (!isSplit && last != first) {
+			linked.emplace_back();
+			try {
+				assembleFragment(sources[file].data, sources[file].length, linked.back(), assemblerSettings, stream);
+			} catch (AssemblerException& e) {
+				e.file = file;
+				throw;
 			}
-		} else {
-			if (pair.first[0] == '@') {
-				throw AssemblerException(AssemblerException::UNDEFINED_LABEL, pair.second.refs[0].line, pair.second.refs[0].column, pair.first);
-			} else {
-				throw AssemblerException(AssemblerException::UNDEFINED_VAR, pair.second.refs[0].line, pair.second.refs[0].column, pair.first);
+			linked.back().file = file;
+			first = last + 1;
+			continue;
+		}
+
+		int line = 0;
+		bool hasCode = false;
+		for (size_t i = first; i <= last; i++) {
+			if (errors[i] != nullptr) {
+				try {
+					std::rethrow_exception(errors[i]);
+				} catch (AssemblerException& e) {
+					AssemblerException moved(e.eType, line + e.line, e.column, e.extra);
+					moved.file = file;
+					throw moved;
+				}
 			}
+
+			// Each chunk only knows about its own instructions, so globals after an earlier chunk's are caught here
+			Fragment& fragment = fragments[i];
+			if (hasCode && fragment.firstGlobalLine >= 0) {
+				AssemblerException e(AssemblerException::MISPLACED_GLOBAL, line + fragment.firstGlobalLine, fragment.firstGlobalColumn);
+				e.file = file;
+				throw e;
+			}
+			hasCode = hasCode || fragment.hasCode;
+
+			fragment.file = file;
+			fragment.firstLine = line;
+			line += fragment.lines;
+			linked.push_back(std::move(fragment));
 		}
-	}
 
-	ASM_DEBUG(IO_END);
+		first = last + 1;
+	}
 
+	Linked program;
+	link(linked, program);
+	if (assemblerSettings.flags.hasFlags(vm::FLAG_OPTIMIZE)) optimize(program, assemblerSettings, stream);
+	writeContainer(program, assemblerSettings, output);
 	return 0;
 }
 
+int vm::assembler::assemble_(const char* const& source, const size_t& sourceLength, std::vector<char>& output, AssemblerSettings& assemblerSettings, std::ostream& stream) {
+	return assemble_(std::vector<StringView>{ StringView(source, sourceLength) }, output, assemblerSettings, stream);
+}
+
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Parsing
 
-vm::types::reg_t vm::assembler::parseRegister(char* const& str, const int& strlen, const int& line, const int& column) {
+vm::types::reg_t vm::assembler::parseRegister(const char* const& str, const int& strlen, const int& line, const int& column) {
 	if (strlen < 2) throw AssemblerException(AssemblerException::INVALID_REG_PARSE, line, column);
 
-	int match = stringMatchAt(str, register_::strings, register_::R0);
+	int match = registerTable.find(str, strlen);
 
 	if (match >= 0) return match;
-	else if (str[0] == 'R') {
+	else if (str[0] == 'R') { // Anything else that still parses, like R03 or R0x1C
 		types::reg_t out = parseNumber<types::reg_t, AssemblerException::INVALID_REG_PARSE>(str + 1, strlen - 1, line, column);
 
 		if (out >= register_::NUM_GEN_REGISTERS || out < 0) {
@@ -334,6 +835,25 @@ vm::types::reg_t vm::assembler::parseRegister(char* const& str, const int& strle
 	throw AssemblerException(AssemblerException::INVALID_REG_PARSE, line, column);
 }
 
+vm::types::reg_t vm::assembler::parseVectorRegister(const char* const& str, const int& strlen, const int& line, const int& column) {
+	if (strlen < 2) throw AssemblerException(AssemblerException::INVALID_REG_PARSE, line, column);
+
+	int match = vectorRegisterTable.find(str, strlen);
+
+	if (match >= 0) return match;
+	else if (str[0] == 'V') { // Anything else that still parses, like V03 or V0x7
+		types::reg_t out = parseNumber<types::reg_t, AssemblerException::INVALID_REG_PARSE>(str + 1, strlen - 1, line, column);
+
+		if (out >= register_::NUM_VEC_REGISTERS) {
+			throw AssemblerException(AssemblerException::INVALID_REG_PARSE, line, column);
+		}
+
+		return out;
+	}
+
+	throw AssemblerException(AssemblerException::INVALID_REG_PARSE, line, column);
+}
+
 template<typename T, vm::assembler::AssemblerException::ErrorType eType>
 T vm::assembler::parseNumber(const char* str, int strlen, const int& line, const int& column) {
 	T base = 10;
@@ -0,0 +1,231 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+using std::cout;
+
+namespace {
+	struct Run {
+		std::string name;
+		std::string input;
+		std::string output;
+		bool failed;
+		bool done;
+
+		Run(const std::string& nameIn, const std::string& inputIn) : name(nameIn), input(inputIn), failed(false), done(false) {}
+	};
+
+	// A fixed set of tasks, dealt out to one queue per worker up front. Workers take from the back of their own queue,
+	// and once that's empty steal from the front of everyone else's, so a few slow runs don't hold up the rest.
+	class WorkStealingPool {
+	public:
+		WorkStealingPool(const unsigned int& threads, const int& tasks) : queues(threads) {
+			for (int i = 0; i < tasks; i++) queues[i % threads].tasks.push_back(i);
+		}
+
+		// Calls task(worker, index) for every task, and returns once they are all done
+		template<typename Task>
+		void run(const Task& task) {
+			std::vector<std::thread> workers;
+			for (unsigned int worker = 0; worker < queues.size(); worker++) {
+				workers.emplace_back([this, &task, worker]() {
+					int index;
+					while (take(worker, index)) task(worker, index);
+				});
+			}
+			for (std::thread& worker : workers) worker.join();
+		}
+
+	private:
+		struct Queue {
+			std::mutex mutex;
+			std::deque<int> tasks;
+		};
+
+		std::vector<Queue> queues;
+
+		bool take(const unsigned int& worker, int& index) {
+			{
+				Queue& own = queues[worker];
+				std::lock_guard<std::mutex> lock(own.mutex);
+				if (!own.tasks.empty()) {
+					index = own.tasks.back();
+					own.tasks.pop_back();
+					return true;
+				}
+			}
+
+			for (size_t i = 1; i < queues.size(); i++) {
+				Queue& victim = queues[(worker + i) % queues.size()];
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				if (!victim.tasks.empty()) {
+					index = victim.tasks.front();
+					victim.tasks.pop_front();
+					return true;
+				}
+			}
+
+			return false;
+		}
+	};
+
+	bool isDirectory(const char* const& path) {
+#ifdef _WIN32
+		const DWORD attributes = GetFileAttributesA(path);
+		return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+		struct stat pathStat;
+		return stat(path, &pathStat) == 0 && S_ISDIR(pathStat.st_mode);
+#endif
+	}
+
+	// Names of the regular files in a directory, sorted
+	std::vector<std::string> listDirectory(const std::string& path) {
+		std::vector<std::string> names;
+#ifdef _WIN32
+		WIN32_FIND_DATAA found;
+		HANDLE find = FindFirstFileA((path + "\\*").c_str(), &found);
+		if (find != INVALID_HANDLE_VALUE) {
+			do {
+				if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) names.push_back(found.cFileName);
+			} while (FindNextFileA(find, &found));
+			FindClose(find);
+		}
+#else
+		DIR* dir = opendir(path.c_str());
+		if (dir != nullptr) {
+			while (dirent* entry = readdir(dir)) {
+				struct stat entryStat;
+				if (stat((path + "/" + entry->d_name).c_str(), &entryStat) == 0 && S_ISREG(entryStat.st_mode)) names.push_back(entry->d_name);
+			}
+			closedir(dir);
+		}
+#endif
+		std::sort(names.begin(), names.end());
+		return names;
+	}
+
+	// One run per file in a directory (the whole file is its input), or per line of a file
+	std::vector<Run> readInputs(const char* const& inputsPath) {
+		std::vector<Run> runs;
+
+		if (isDirectory(inputsPath)) {
+			for (const std::string& name : listDirectory(inputsPath)) {
+				std::fstream file;
+				file.open(std::string(inputsPath) + "/" + name, std::ios::in | std::ios::binary);
+				std::ostringstream contents;
+				contents << file.rdbuf();
+				runs.push_back(Run(name, contents.str()));
+			}
+		} else {
+			std::fstream file;
+			file.open(inputsPath, std::ios::in);
+			std::string line;
+			for (int lineNum = 1; std::getline(file, line); lineNum++) {
+				runs.push_back(Run("line " + std::to_string(lineNum), line + "\n"));
+			}
+		}
+
+		return runs;
+	}
+}
+
+int vm::executor::execBatch(const char* const& path, const char* const& inputsPath, ExecutorSettings& execSettings) {
+	cout << "Attempting to execute file \"" << path << "\" over the inputs in \"" << inputsPath << "\"\n";
+
+	std::vector<Run> runs = readInputs(inputsPath);
+	if (runs.empty()) {
+		cout << IO_WARN "No inputs found in \"" << inputsPath << "\"" IO_NORM IO_END;
+		return 0;
+	}
+
+	unsigned int threads = execSettings.threads != 0 ? execSettings.threads : std::thread::hardware_concurrency();
+	threads = std::max(1u, std::min(threads, static_cast<unsigned int>(runs.size())));
+
+	// Every run writes the same profile and samples files otherwise
+	ExecutorSettings runSettings = execSettings;
+	runSettings.profilePath = nullptr;
+	runSettings.samplePath = nullptr;
+
+	const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	std::unique_ptr<const Module> module;
+	try {
+		module.reset(new Module(path, runSettings.flags.hasFlags(FLAG_FUSE)));
+	} catch (ExecutorException& e) {
+		cout << IO_ERR "Error during execution at BYTE" << e.loc << " : " << e.what() << IO_NORM IO_END;
+		return 1;
+	} catch (std::exception& e) {
+		cout << IO_ERR "An unknown error ocurred during execution. The provided error message is as follows:\n" << e.what() << IO_NORM IO_END;
+		return 1;
+	}
+
+	std::mutex doneMutex;
+	std::condition_variable doneCondition;
+	std::vector<std::unique_ptr<Context>> contexts(threads);
+
+	std::thread pool([&]() {
+		WorkStealingPool(threads, static_cast<int>(runs.size())).run([&](const unsigned int& worker, const int& index) {
+			Run& run = runs[index];
+			std::istringstream in(run.input);
+			std::ostringstream out;
+			try {
+				// Each worker makes its Context the first time it gets a run, and resets it for the rest. Making it can
+				// fail too (a stack that doesn't fit, say), which fails the run rather than leaving the thread.
+				if (contexts[worker] == nullptr) {
+					contexts[worker].reset(new Context(*module, runSettings.stackSize));
+				} else {
+					contexts[worker]->reset();
+				}
+
+				// Each input gets the whole budget, and one that uses it up fails like any other error
+				if (contexts[worker]->exec(runSettings, out, in) == RUN_PREEMPTED) {
+					out << IO_ERR "Error during execution at BYTE" << contexts[worker]->decoded->offsets[contexts[worker]->entry] << " : Used up its budget of " << runSettings.budget << " jumps" IO_NORM IO_END;
+					run.failed = true;
+				}
+			} catch (ExecutorException& e) {
+				out << IO_ERR "Error during execution at BYTE" << e.loc << " : " << e.what() << IO_NORM IO_END;
+				run.failed = true;
+			} catch (std::exception& e) {
+				out << IO_ERR "An unknown error ocurred during execution. The provided error message is as follows:\n" << e.what() << IO_NORM IO_END;
+				run.failed = true;
+			}
+
+			std::lock_guard<std::mutex> lock(doneMutex);
+			run.output = out.str();
+			run.done = true;
+			doneCondition.notify_all();
+		});
+	});
+
+	// Print the runs in order, as soon as each one is done
+	int failed = 0;
+	for (Run& run : runs) {
+		std::unique_lock<std::mutex> lock(doneMutex);
+		doneCondition.wait(lock, [&run]() { return run.done; });
+		cout << IO_BATCH << run.name << IO_NORM "\n" << run.output;
+		if (run.failed) failed++;
+		std::string().swap(run.output);
+	}
+
+	pool.join();
+	contexts.clear();
+
+	const long long micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+	cout << IO_BATCH "Ran " << runs.size() << " inputs on " << threads << " threads in " << micros << " micros (1,000,000 micros = 1 sec), " << failed << " failed" IO_NORM IO_END;
+
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+using std::cout;
+
+namespace {
+	// Untimed runs of each engine first, so the timed ones all start with warm caches (and a compiled JIT)
+	constexpr unsigned int WARMUP_RUNS = 3;
+
+	struct Engine {
+		const char* name;
+		vm::executor::Dispatch dispatch;
+		bool fuse;
+		bool jit;
+	};
+
+	constexpr Engine engines[] = {
+		{ "switch", vm::executor::Dispatch::SWITCH, false, false },
+		{ "threaded", vm::executor::Dispatch::THREADED, false, false },
+		{ "fused", vm::executor::Dispatch::THREADED, true, false },
+#ifdef VM_JIT
+		{ "jit", vm::executor::Dispatch::THREADED, true, true },
+#endif
+	};
+
+	struct Timing {
+		unsigned long long dispatches;
+		long long medianNanos;
+		long long p99Nanos;
+		long long minNanos;
+	};
+
+	// The most memory the process has used so far (never goes down, so it covers every workload up to now)
+	unsigned long long peakRssKB() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize >> 10 : 0;
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+		return static_cast<unsigned long long>(usage.ru_maxrss) >> 10;// Bytes, not KB
+#else
+		return static_cast<unsigned long long>(usage.ru_maxrss);
+#endif
+#endif
+	}
+
+	std::string jsonString(const std::string& str) {
+		std::string out = "\"";
+		for (const char& c : str) {
+			if (c == '"' || c == '\\') out += '\\';
+			out += c;
+		}
+		return out + "\"";
+	}
+
+	// Runs the module once in profile mode (on the switch interpreter) to count what it dispatches
+	unsigned long long countDispatches(const vm::Module& module, vm::executor::ExecutorSettings runSettings, std::ostream& discard) {
+		runSettings.flags.setFlags(vm::FLAG_PROFILE);
+		runSettings.flags.unsetFlags(vm::FLAG_JIT);
+		runSettings.dispatch = vm::executor::Dispatch::SWITCH;
+		runSettings.profilePath = nullptr;
+
+		vm::Context context(module, runSettings.stackSize);
+		std::istringstream in;
+		context.exec(runSettings, discard, in);
+		return context.dispatches;
+	}
+
+	Timing timeEngine(const vm::Module& module, const Engine& engine, vm::executor::ExecutorSettings runSettings, const unsigned long long& dispatches, std::ostream& discard) {
+		using namespace std::chrono;
+
+		runSettings.dispatch = engine.dispatch;
+		runSettings.flags.unsetFlags(vm::FLAG_PROFILE);
+		if (engine.jit) {
+			runSettings.flags.setFlags(vm::FLAG_JIT);
+		} else {
+			runSettings.flags.unsetFlags(vm::FLAG_JIT);
+		}
+
+		vm::Context context(module, runSettings.stackSize);
+		std::vector<long long> nanos;
+		for (unsigned int run = 0; run < WARMUP_RUNS + runSettings.benchRuns; run++) {
+			std::istringstream in;
+			const steady_clock::time_point start = steady_clock::now();
+			context.exec(runSettings, discard, in);
+			const long long elapsed = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+			context.reset();
+			if (run >= WARMUP_RUNS) nanos.push_back(elapsed);
+		}
+
+		std::sort(nanos.begin(), nanos.end());
+		// The smallest run that at least 99% of runs are no slower than
+		const size_t p99 = std::min(nanos.size() - 1, (nanos.size() * 99 + 99) / 100 - 1);
+		return Timing{ dispatches, nanos[nanos.size() / 2], nanos[p99], nanos.front() };
+	}
+}
+
+int vm::executor::benchmark(const std::vector<const char*>& assemblyPaths, const char* const& outputPath, assembler::AssemblerSettings& assemblerSettings, ExecutorSettings& execSettings) {
+	cout << "Attempting to benchmark " << assemblyPaths.size() << " files into \"" << outputPath << "\"\n";
+
+	ExecutorSettings runSettings = execSettings;
+	runSettings.benchRuns = std::max(1u, execSettings.benchRuns);
+	runSettings.snapshotPath = nullptr;
+	runSettings.samplePath = nullptr;
+	// Every timed run has to go all the way to the end
+	runSettings.budget = 0;
+	std::ostream discard(nullptr);
+
+	std::ostringstream json;
+	json << "{\n\t\"runs\": " << runSettings.benchRuns << ",\n\t\"warmupRuns\": " << WARMUP_RUNS << ",\n\t\"workloads\": [";
+	int failed = 0;
+	bool firstWorkload = true;
+
+	for (const char* const& path : assemblyPaths) {
+		json << (firstWorkload ? "\n" : ",\n") << "\t\t{ \"name\": " << jsonString(path);
+		firstWorkload = false;
+
+		std::fstream file;
+		file.open(path, std::ios::in | std::ios::binary);
+		std::ostringstream source;
+		source << file.rdbuf();
+		const std::string sourceStr = source.str();
+
+		std::vector<char> program;
+		std::ostringstream assemblerOutput;
+		if (!file.is_open() || assembler::assemble_(sourceStr.data(), sourceStr.length(), program, assemblerSettings, assemblerOutput)) {
+			cout << IO_ERR "Could not assemble \"" << path << "\"" IO_NORM "\n" << assemblerOutput.str();
+			json << ", \"error\": \"Could not assemble\" }";
+			failed++;
+			continue;
+		}
+
+		try {
+			const Module fusedModule(program, true), unfusedModule(program, false);
+			// Instructions are counted as they are in the file, and dispatches as each engine runs them
+			const unsigned long long instructions = countDispatches(unfusedModule, runSettings, discard);
+			const unsigned long long fusedDispatches = countDispatches(fusedModule, runSettings, discard);
+
+			std::ostringstream results;
+			cout << IO_BENCH << path << IO_NORM "\n";
+			for (const Engine& engine : engines) {
+				const Timing timing = timeEngine(engine.fuse ? fusedModule : unfusedModule, engine, runSettings, engine.fuse ? fusedDispatches : instructions, discard);
+				const double seconds = timing.medianNanos / 1e9;
+				const double nanosPerDispatch = timing.dispatches == 0 ? 0 : static_cast<double>(timing.medianNanos) / timing.dispatches;
+				const double instructionsPerSecond = seconds == 0 ? 0 : instructions / seconds;
+
+				results << (&engine == engines ? "\n" : ",\n") << "\t\t\t{ \"engine\": \"" << engine.name << "\", \"dispatches\": " << timing.dispatches
+					<< ", \"medianNanos\": " << timing.medianNanos << ", \"p99Nanos\": " << timing.p99Nanos << ", \"minNanos\": " << timing.minNanos
+					<< ", \"instructionsPerSecond\": " << static_cast<unsigned long long>(instructionsPerSecond) << ", \"nanosPerDispatch\": " << nanosPerDispatch << " }";
+				cout << IO_BENCH "    " << engine.name << ": " << timing.medianNanos / 1000 << " micros median, " << timing.p99Nanos / 1000 << " p99, "
+					<< nanosPerDispatch << " ns per dispatch" IO_NORM "\n";
+			}
+
+			json << ", \"instructions\": " << instructions << ", \"peakRssKB\": " << peakRssKB() << ", \"engines\": [" << results.str() << "\n\t\t] }";
+		} catch (std::exception& e) {
+			// ExecutorExceptions included: a benchmark that fails to run isn't worth timing
+			cout << IO_ERR "Error while benchmarking \"" << path << "\" : " << e.what() << IO_NORM "\n";
+			json << ", \"error\": " << jsonString(e.what()) << " }";
+			failed++;
+		}
+	}
+	json << "\n\t]\n}\n";
+
+	std::fstream output;
+	output.open(outputPath, std::ios::out | std::ios::trunc);
+	if (!output.is_open()) {
+		cout << IO_ERR "Could not open \"" << outputPath << "\" for the results" IO_NORM IO_END;
+		return 1;
+	}
+	output << json.str();
+
+	cout << IO_BENCH "Benchmarked " << assemblyPaths.size() - failed << " of " << assemblyPaths.size() << " files" IO_NORM IO_END;
+	return failed == 0 ? 0 : 1;
+}
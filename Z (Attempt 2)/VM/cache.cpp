@@ -0,0 +1,190 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+namespace {
+	// Bump this whenever the assembler's output changes for the same source, so old entries stop matching
+	constexpr uint64_t CACHE_VERSION = 5;
+
+	constexpr const char* const EXTENSION = ".eze";
+	constexpr size_t EXTENSION_LENGTH = 4;
+	constexpr size_t KEY_LENGTH = 16;// Hex digits
+
+	struct Entry {
+		std::string path;
+		unsigned long long size;
+		long long modified;
+	};
+
+	uint64_t mix(uint64_t hash, const uint64_t& value) {
+		hash = (hash ^ value) * 0x9E3779B97F4A7C15ull;
+		return hash ^ (hash >> 29);
+	}
+
+	std::string entryPath(const char* const& dir, const uint64_t& key) {
+		char name[KEY_LENGTH + 1];
+		std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+		return std::string(dir) + "/" + name + EXTENSION;
+	}
+
+	bool isEntryName(const std::string& name) {
+		return name.length() == KEY_LENGTH + EXTENSION_LENGTH &&
+			name.compare(KEY_LENGTH, EXTENSION_LENGTH, EXTENSION) == 0 &&
+			std::all_of(name.begin(), name.begin() + KEY_LENGTH, [](const char& c) { return ('0' <= c && c <= '9') || ('a' <= c && c <= 'f'); });
+	}
+
+	// Every entry in the cache, oldest (least recently used) first
+	std::vector<Entry> listEntries(const char* const& dir) {
+		std::vector<Entry> entries;
+#ifdef _WIN32
+		WIN32_FIND_DATAA found;
+		HANDLE find = FindFirstFileA((std::string(dir) + "\\*").c_str(), &found);
+		if (find != INVALID_HANDLE_VALUE) {
+			do {
+				if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && isEntryName(found.cFileName)) {
+					entries.push_back(Entry{
+						std::string(dir) + "/" + found.cFileName,
+						(static_cast<unsigned long long>(found.nFileSizeHigh) << 32) | found.nFileSizeLow,
+						static_cast<long long>((static_cast<unsigned long long>(found.ftLastWriteTime.dwHighDateTime) << 32) | found.ftLastWriteTime.dwLowDateTime)
+					});
+				}
+			} while (FindNextFileA(find, &found));
+			FindClose(find);
+		}
+#else
+		DIR* directory = opendir(dir);
+		if (directory != nullptr) {
+			while (dirent* entry = readdir(directory)) {
+				const std::string path = std::string(dir) + "/" + entry->d_name;
+				struct stat entryStat;
+				if (isEntryName(entry->d_name) && stat(path.c_str(), &entryStat) == 0 && S_ISREG(entryStat.st_mode)) {
+					entries.push_back(Entry{ path, static_cast<unsigned long long>(entryStat.st_size), static_cast<long long>(entryStat.st_mtime) });
+				}
+			}
+			closedir(directory);
+		}
+#endif
+		std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.modified < b.modified; });
+		return entries;
+	}
+
+	void makeDirectory(const char* const& dir) {
+#ifdef _WIN32
+		CreateDirectoryA(dir, nullptr);
+#else
+		mkdir(dir, 0755);
+#endif
+	}
+
+	// Replaces to with from, in one step, so other runs never see half an entry
+	bool replaceFile(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+		return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+	}
+
+	// Marks an entry as just used, so it's the last to be evicted
+	void touch(const std::string& path) {
+#ifdef _WIN32
+		_utime(path.c_str(), nullptr);
+#else
+		utime(path.c_str(), nullptr);
+#endif
+	}
+
+	unsigned long processId() {
+#ifdef _WIN32
+		return GetCurrentProcessId();
+#else
+		return static_cast<unsigned long>(getpid());
+#endif
+	}
+}
+
+uint64_t vm::assembler::cacheKey(const std::vector<StringView>& sources, const AssemblerSettings& assemblerSettings) {
+	uint64_t hash = mix(CACHE_VERSION, opcode::count);
+	hash = mix(hash, static_cast<uint64_t>(assemblerSettings.flags.bits));
+
+	for (const StringView& source : sources) {
+		hash = mix(hash, source.length);
+
+		const char* p = source.data;
+		size_t length = source.length;
+		for (; length >= sizeof(uint64_t); p += sizeof(uint64_t), length -= sizeof(uint64_t)) {
+			uint64_t word;
+			std::memcpy(&word, p, sizeof(word));
+			hash = mix(hash, word);
+		}
+		for (; length > 0; p++, length--) hash = mix(hash, static_cast<unsigned char>(*p));
+	}
+
+	return hash;
+}
+
+bool vm::assembler::loadCached(const char* const& dir, const uint64_t& key, std::vector<char>& output) {
+	const std::string path = entryPath(dir, key);
+
+	std::fstream file;
+	file.open(path, std::ios::in | std::ios::binary);
+	if (!file.is_open()) return false;
+
+	file.seekg(0, std::ios::end);
+	const std::streamoff size = file.tellg();
+	if (size < static_cast<std::streamoff>(sizeof(types::word_t))) return false;
+	file.seekg(0, std::ios::beg);
+
+	output.resize(static_cast<size_t>(size));
+	if (file.rdbuf()->sgetn(output.data(), size) != size) return false;
+
+	file.close();
+	touch(path);
+	return true;
+}
+
+bool vm::assembler::storeCached(const char* const& dir, const uint64_t& key, const std::vector<char>& output, const unsigned long long& limit) {
+	makeDirectory(dir);
+
+	const std::string path = entryPath(dir, key);
+	const std::string temporaryPath = path + "." + std::to_string(processId()) + ".tmp";
+	{
+		std::fstream file;
+		file.open(temporaryPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) return false;
+		file.write(output.data(), output.size());
+		if (!file.good()) {
+			file.close();
+			std::remove(temporaryPath.c_str());
+			return false;
+		}
+	}
+	if (!replaceFile(temporaryPath, path)) {
+		std::remove(temporaryPath.c_str());
+		return false;
+	}
+
+	if (limit != 0) {
+		const std::vector<Entry> entries = listEntries(dir);
+		unsigned long long total = 0;
+		for (const Entry& entry : entries) total += entry.size;
+		for (const Entry& entry : entries) {
+			if (total <= limit) break;
+			if (std::remove(entry.path.c_str()) == 0) total -= entry.size;
+		}
+	}
+
+	return true;
+}
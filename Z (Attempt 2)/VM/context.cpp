@@ -0,0 +1,82 @@
+#include "vm.h"
+
+#include <algorithm>
+
+#define AS_WORD(x) \
+	reinterpret_cast<vm::types::word_t*>(x)
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Module
+
+vm::Module::Module(const char* const& path, const bool& fuse) : program(path), decoded(program, fuse) {
+	decode();
+}
+
+vm::Module::Module(std::istream& stream, const bool& fuse) : program(stream), decoded(program, fuse) {
+	decode();
+}
+
+vm::Module::Module(const std::vector<char>& bytes, const bool& fuse) : program(bytes), decoded(program, fuse) {
+	decode();
+}
+
+void vm::Module::decode() {
+	const std::chrono::steady_clock::time_point decodeStart = std::chrono::steady_clock::now();
+	const types::word_t entryLoc = *AS_WORD(program.start + format::FIRST_INSTR_ADDR_LOCATION);
+	// A pre-decoded section only saves the decode pass if it was made with the same settings
+	if (program.decodedSection != nullptr && decoded.load(program.decodedSection, program.decodedSize)) {
+		entry = decoded.resolve(entryLoc);
+	} else {
+		entry = decoded.decode(entryLoc);
+	}
+	decodeMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - decodeStart).count();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Context
+
+vm::Context::Context(const Module& moduleIn, const unsigned int& stackSize, const bool& isSnapshottable) :
+	module(moduleIn),
+	reg(reinterpret_cast<executor::Value*>((reinterpret_cast<uintptr_t>(registerStorage) + executor::CACHE_LINE - 1) & ~(executor::CACHE_LINE - 1))),
+	vreg(reinterpret_cast<executor::Vector*>(reg + executor::NUM_REGISTERS)),
+	memory(new executor::Memory(isSnapshottable)),
+	imageSize(moduleIn.program.end - moduleIn.program.start + moduleIn.program.bssSize + executor::Program::FILLER_SIZE),
+	image(memory->take(imageSize)),
+	stack(stackSize, memory.get()),
+	calls(stackSize / sizeof(types::word_t), memory.get()),
+	arena(memory.get()),
+	isAsync(false),
+	decoded(&moduleIn.decoded),
+	snapshotPath(nullptr),
+	budget(0),
+	sampleInterval(0),
+	dispatches(0) {
+	const executor::Program& program = moduleIn.program;
+	std::fill(image + (program.end - program.start) + program.bssSize, image + imageSize, charFiller);
+	reset();
+}
+
+void vm::Context::reset() {
+	using namespace types;
+
+	const executor::Program& program = module.program;
+	// Version 1 files don't say where the code starts, so all of the image is copied
+	char* const dataEnd = program.codeStart != 0 ? program.start + program.codeStart : program.end;
+	std::copy(program.start, dataEnd, image);
+	std::fill(image + (program.end - program.start), image + (program.end - program.start) + program.bssSize, 0);
+	arena.release();
+	calls.top = calls.start;
+	input.clear();
+	pausedProfiler.reset();
+	sampler.clear();
+	hotness.clear();
+#ifdef VM_JIT
+	isInJit = false;
+#endif
+	entry = module.entry;
+
+	std::fill(reg, reg + executor::NUM_REGISTERS, executor::Value());
+	std::fill(vreg, vreg + executor::NUM_VECTOR_REGISTERS, executor::Vector());
+	reg[register_::PP].word = executor::addressOf(memory->base, image);
+	reg[register_::BP].word = executor::addressOf(memory->base, stack.start);
+}
@@ -0,0 +1,450 @@
+#include "vm.h"
+
+#include <cstring>
+
+using vm::executor::DecodedProgram;
+using vm::executor::ExecutorException;
+using vm::executor::Instr;
+
+namespace {
+	// Start of a saved decoded section, followed by every Instr, then every offset, then each (offset, index) pair
+	// that is in the index
+	struct SavedHeader {
+		uint32_t version;
+		uint32_t opcodes;
+		uint32_t instrSize;
+		uint32_t fuse;
+		uint32_t length;
+		int32_t haltIndex;
+		uint32_t instrCount;
+		uint32_t indexCount;
+	};
+
+	struct SavedIndex {
+		vm::types::word_t loc;
+		int32_t instr;
+	};
+
+	// Bytes taken up by each opcode's arguments
+	struct ArgsSizes {
+		vm::types::word_t sizes[256];
+
+		ArgsSizes() {
+			for (int opcode = 0; opcode < 256; opcode++) {
+				sizes[opcode] = 0;
+				for (int i = 0; opcode < vm::opcode::count && i < vm::opcode::MAX_ARGS; i++) {
+					switch (vm::opcode::args[opcode][i]) {
+						case 1: // ARG_REG
+							sizes[opcode] += sizeof(vm::types::reg_t);
+							break;
+
+						case 2: // ARG_WORD
+							sizes[opcode] += sizeof(vm::types::word_t);
+							break;
+
+						case 3: // ARG_BYTE
+							sizes[opcode] += sizeof(vm::types::byte_t);
+							break;
+
+						case 4: // ARG_SHORT
+							sizes[opcode] += sizeof(vm::types::short_t);
+							break;
+
+						case 7: // ARG_VREG
+							sizes[opcode] += sizeof(vm::types::reg_t);
+							break;
+					}
+				}
+			}
+		}
+	};
+
+	const ArgsSizes argsSizes;
+
+	// Which of each opcode's decoded r1, r2 and r3 hold a register (one bit each), and which hold a vector register.
+	// CALL's frame size goes in r2 and r3, so it's in neither.
+	struct RegisterSlots {
+		int scalar[256];
+		int vector[256];
+
+		RegisterSlots() {
+			for (int opcode = 0; opcode < 256; opcode++) {
+				scalar[opcode] = vector[opcode] = 0;
+				int slot = 0;
+				for (int i = 0; opcode < vm::opcode::count && i < vm::opcode::MAX_ARGS; i++) {
+					if (vm::opcode::args[opcode][i] == 1) scalar[opcode] |= 1 << slot++;// ARG_REG
+					if (vm::opcode::args[opcode][i] == 7) vector[opcode] |= 1 << slot++;// ARG_VREG
+				}
+			}
+		}
+
+		// Whether any of the registers instr names is r
+		bool names(const vm::executor::Instr& instr, const int& r) const {
+			const int slots = scalar[instr.opcode];
+			return ((slots & 1) && instr.r1 == r) || ((slots & 2) && instr.r2 == r) || ((slots & 4) && instr.r3 == r);
+		}
+	};
+
+	const RegisterSlots registerSlots;
+
+	// Opcodes that overwrite FZ (a fused compare and jump sets it before jumping)
+	bool setsFlag(const int& opcode) {
+		using namespace vm::opcode;
+		return (I_FLAG <= opcode && opcode <= I_CMP_LE) || (C_FLAG <= opcode && opcode <= C_CMP_LE) ||
+			(I_CMP_EQ_JZ <= opcode && opcode <= C_FLAG_JNZ) || withoutFlag(opcode) >= 0;
+	}
+
+	template<typename T>
+	void append(std::vector<char>& out, const T* const& data, const size_t& count) {
+		const char* const bytes = reinterpret_cast<const char*>(data);
+		out.insert(out.end(), bytes, bytes + sizeof(T) * count);
+	}
+}
+
+vm::executor::DecodedProgram::DecodedProgram(const Program& program, const bool& fuseIn) :
+	start(program.start),
+	length(static_cast<types::word_t>(program.end - program.start)),
+	fuse(fuseIn),
+	index(program.end - program.start, -1),
+	haltIndex(-1) {}
+
+// Only used for bytes inside the program, since decodeRun checks that each instruction fits before reading it
+template<typename T>
+T vm::executor::DecodedProgram::readAt(types::word_t loc) const {
+	T out;
+	std::memcpy(&out, start + loc, sizeof(T));
+	return out;
+}
+
+int vm::executor::DecodedProgram::getHaltIndex() {
+	if (haltIndex < 0) {
+		haltIndex = static_cast<int>(instrs.size());
+		instrs.push_back(Instr(opcode::HALT, 0));
+		offsets.push_back(length);
+	}
+	return haltIndex;
+}
+
+int vm::executor::DecodedProgram::decode(types::word_t loc) {
+	using namespace opcode;
+
+	if (loc < 0 || loc >= length) return getHaltIndex();
+
+	pending.push_back(loc);
+	while (!pending.empty()) {
+		while (!pending.empty()) {
+			types::word_t next = pending.back();
+			pending.pop_back();
+			if (next >= 0 && next < length && index[next] < 0) decodeRun(next);
+		}
+
+		// Resolve static jumps once everything they could point at has been decoded
+		for (const int& i : fixups) {
+			types::word_t target = instrs[i].imm;
+			instrs[i].imm = (target >= 0 && target < length && index[target] >= 0) ? index[target] : getHaltIndex();
+		}
+		fixups.clear();
+	}
+
+	return index[loc];
+}
+
+void vm::executor::DecodedProgram::decodeRun(types::word_t loc) {
+	using namespace opcode;
+	using namespace types;
+
+	const int runStart = static_cast<int>(instrs.size());
+
+	while (true) {
+		if (loc >= length) {
+			// Fell off of the end of the program
+			instrs.push_back(Instr(JMP, getHaltIndex()));
+			offsets.push_back(loc);
+			break;
+		}
+
+		if (index[loc] >= 0) {
+			// Fell through into code that has already been decoded
+			instrs.push_back(Instr(JMP, index[loc]));
+			offsets.push_back(loc);
+			break;
+		}
+
+		Instr instr;
+		const word_t instrLoc = loc;
+		instr.opcode = readAt<opcode_t>(loc);
+		loc += sizeof(opcode_t);
+
+		if (instr.opcode >= GLOBAL_BREAK) {
+			// Not an executable opcode: keep it so that executing it reports the error at the right place
+			instr = Instr(INVALID, ExecutorException::UNKNOWN_OPCODE);
+		} else if (loc + argsSizes.sizes[instr.opcode] > length) {
+			instr = Instr(INVALID, ExecutorException::TRUNCATED_INSTRUCTION);
+		} else {
+			reg_t* regs[] = { &instr.r1, &instr.r2, &instr.r3 };
+			int nextReg = 0;
+			for (int i = 0; i < MAX_ARGS; i++) {
+				switch (args[instr.opcode][i]) {
+					case 1: // ARG_REG
+					case 7: // ARG_VREG
+						*regs[nextReg++] = readAt<reg_t>(loc);
+						loc += sizeof(reg_t);
+						break;
+
+					case 2: // ARG_WORD
+						instr.imm = readAt<word_t>(loc);
+						loc += sizeof(word_t);
+						break;
+
+					case 3: // ARG_BYTE
+						instr.imm = readAt<byte_t>(loc);
+						loc += sizeof(byte_t);
+						break;
+
+					case 4: // ARG_SHORT
+						if (instr.opcode == CALL) {
+							instr.setFrameSize(readAt<short_t>(loc));
+						} else {
+							instr.imm = readAt<short_t>(loc);
+						}
+						loc += sizeof(short_t);
+						break;
+				}
+			}
+
+			if (!isVerified(instr, 0)) instr = Instr(INVALID, ExecutorException::BAD_REGISTER);
+		}
+
+		// Queue up anything this instruction could jump to
+		const bool isJump = isStaticJump(instr.opcode);
+		if (isJump) {
+			pending.push_back(instr.imm);
+		} else if (instr.opcode == MOV_W && instr.imm >= format::GLOBAL_TABLE_LOCATION && instr.imm < length) {
+			// Possibly a label address, which will be jumped to with R_JMP
+			pending.push_back(instr.imm);
+		}
+
+		if (fuse) specialise(instr);
+		const bool namesFlag = registerSlots.names(instr, register_::FZ);
+		if (namesFlag) {
+			// The interpreter only keeps FZ in the register file around the instructions that use it as one
+			index[instrLoc] = static_cast<int>(instrs.size());
+			instrs.push_back(Instr(FZ_SPILL, 0));
+			offsets.push_back(instrLoc);
+			instrs.push_back(instr);
+			offsets.push_back(instrLoc);
+			if (isJump) fixups.push_back(static_cast<int>(instrs.size()) - 1);
+			if (isTerminator(instr.opcode)) break;
+			// The flag is written after the result, so where there is one it's what FZ ends up holding
+			instrs.push_back(Instr(setsFlag(instr.opcode) ? FZ_SPILL : FZ_FILL, 0));
+			offsets.push_back(instrLoc);
+			continue;
+		}
+		if (!(fuse && static_cast<int>(instrs.size()) > runStart && fuseInto(instrs.back(), instr))) {
+			index[instrLoc] = static_cast<int>(instrs.size());
+			instrs.push_back(instr);
+			offsets.push_back(instrLoc);
+		}
+
+		if (isJump) fixups.push_back(static_cast<int>(instrs.size()) - 1);
+		if (isTerminator(instrs.back().opcode)) break;
+	}
+
+	if (fuse) dropFlags(runStart);
+}
+
+bool vm::executor::DecodedProgram::isVerified(const Instr& instr, const size_t& count) {
+	using namespace opcode;
+
+	const types::reg_t regs[] = { instr.r1, instr.r2, instr.r3 };
+	for (int i = 0; i < 3; i++) {
+		if ((registerSlots.scalar[instr.opcode] >> i & 1) && regs[i] >= NUM_REGISTERS) return false;
+		if ((registerSlots.vector[instr.opcode] >> i & 1) && regs[i] >= NUM_VECTOR_REGISTERS) return false;
+	}
+
+	// Static jump targets are checked once they are indices (count is 0 while they're still byte offsets)
+	if (count != 0 && isStaticJump(instr.opcode) && (instr.imm < 0 || static_cast<size_t>(instr.imm) >= count)) return false;
+
+	if (instr.opcode == INVALID) {
+		return instr.imm == ExecutorException::UNKNOWN_OPCODE || instr.imm == ExecutorException::BAD_REGISTER || instr.imm == ExecutorException::TRUNCATED_INSTRUCTION;
+	}
+	return true;
+}
+
+// Single-instruction rewrites that don't change the meaning of the instruction
+void vm::executor::DecodedProgram::specialise(Instr& instr) {
+	using namespace opcode;
+
+	switch (instr.opcode) {
+		case LOAD_W:
+			if (instr.r2 == register_::BP) {
+				instr.opcode = LOAD_W_BP;
+				instr.r2 = 0;
+			}
+			break;
+
+		case STORE_W:
+			if (instr.r1 == register_::BP) {
+				instr.opcode = STORE_W_BP;
+				instr.r1 = instr.r2;
+				instr.r2 = 0;
+			}
+			break;
+	}
+}
+
+// Swaps in the flagless form of each instruction in the run (from first) whose FZ is always set again before anything
+// reads it. Working backwards, FZ is read by flag jumps and anything with FZ as an argument, and also wherever the run
+// could be left, since the code there is unknown.
+void vm::executor::DecodedProgram::dropFlags(const int& first) {
+	using namespace opcode;
+
+	bool isRead = true;
+	for (int i = static_cast<int>(instrs.size()); i-- > first;) {
+		Instr& instr = instrs[i];
+		const int flagless = withoutFlag(instr.opcode);
+		if (!isRead && flagless >= 0) instr.opcode = static_cast<types::opcode_t>(flagless);
+
+		const bool isArg = instr.opcode == FZ_SPILL || registerSlots.names(instr, register_::FZ);
+		const bool isFlagJump = instr.opcode == JMP_Z || instr.opcode == JMP_NZ || instr.opcode == R_JMP_Z || instr.opcode == R_JMP_NZ;
+		const bool isLeaving = isFlagJump || isStaticJump(instr.opcode) || isTerminator(instr.opcode);
+		isRead = isArg || isFlagJump || (setsFlag(instr.opcode) ? false : isRead || isLeaving);
+	}
+}
+
+// Replaces first with a superinstruction doing the work of both first and second, if there is one
+bool vm::executor::DecodedProgram::fuseInto(Instr& first, const Instr& second) {
+	using namespace opcode;
+
+	switch (first.opcode) {
+		case I_CMP_EQ:
+		case I_CMP_NE:
+		case I_CMP_GT:
+		case I_CMP_LT:
+		case I_CMP_GE:
+		case I_CMP_LE:
+			if (second.opcode != JMP_Z && second.opcode != JMP_NZ) return false;
+			first.opcode = I_CMP_EQ_JZ + 2 * (first.opcode - I_CMP_EQ) + (second.opcode == JMP_NZ ? 1 : 0);
+			first.imm = second.imm;
+			return true;
+
+		case I_DEC:
+			if (second.opcode != JMP_NZ) return false;
+			first.opcode = I_DEC_JNZ;
+			first.imm = second.imm;
+			return true;
+
+		case C_FLAG:
+			if (second.opcode != JMP_Z && second.opcode != JMP_NZ) return false;
+			first.opcode = second.opcode == JMP_Z ? C_FLAG_JZ : C_FLAG_JNZ;
+			first.imm = second.imm;
+			return true;
+
+		case MOV_W:
+			// movw t, k + iadd d, x, y (with t as either argument), or isub d, x, t
+			if (second.opcode == I_ADD && (second.r2 == first.r1 || second.r3 == first.r1)) {
+				first.opcode = I_ADD_IMM;
+				first.r3 = first.r1;
+				first.r2 = second.r3 == first.r3 ? second.r2 : second.r3;
+				first.r1 = second.r1;
+				return true;
+			}
+			if (second.opcode == I_SUB && second.r3 == first.r1) {
+				first.opcode = I_SUB_IMM;
+				first.r3 = first.r1;
+				first.r2 = second.r2;
+				first.r1 = second.r1;
+				return true;
+			}
+			return false;
+
+		case LOAD_W_BP:
+			if (second.opcode != R_JMP || second.r1 != first.r1) return false;
+			first.opcode = LOAD_W_BP_R_JMP;
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Saving
+
+void vm::executor::DecodedProgram::save(std::vector<char>& out) const {
+	std::vector<SavedIndex> saved;
+	for (types::word_t loc = 0; loc < length; loc++) {
+		if (index[loc] >= 0) saved.push_back(SavedIndex{ loc, index[loc] });
+	}
+
+	const SavedHeader header = {
+		SAVE_VERSION,
+		static_cast<uint32_t>(opcode::count),
+		static_cast<uint32_t>(sizeof(Instr)),
+		fuse ? 1u : 0u,
+		static_cast<uint32_t>(length),
+		haltIndex,
+		static_cast<uint32_t>(instrs.size()),
+		static_cast<uint32_t>(saved.size())
+	};
+	append(out, &header, 1);
+	append(out, instrs.data(), instrs.size());
+	append(out, offsets.data(), offsets.size());
+	append(out, saved.data(), saved.size());
+}
+
+bool vm::executor::DecodedProgram::load(const char* const& data, const size_t& size) {
+	using namespace opcode;
+
+	SavedHeader header;
+	if (size < sizeof(header)) return false;
+	std::memcpy(&header, data, sizeof(header));
+	if (header.version != SAVE_VERSION || header.opcodes != static_cast<uint32_t>(opcode::count) || header.instrSize != sizeof(Instr) ||
+		header.fuse != (fuse ? 1u : 0u) || header.length != static_cast<uint32_t>(length)) return false;
+
+	const size_t count = header.instrCount;
+	if (count == 0 || size != sizeof(header) + count * (sizeof(Instr) + sizeof(types::word_t)) + header.indexCount * sizeof(SavedIndex)) return false;
+	const char* const savedInstrs = data + sizeof(header);
+	const char* const savedOffsets = savedInstrs + count * sizeof(Instr);
+	const char* const savedIndex = savedOffsets + count * sizeof(types::word_t);
+
+	// The section could have been written by anything, so it's verified just like decoded code before it's used
+	Instr instr;
+	for (size_t i = 0; i < count; i++) {
+		std::memcpy(&instr, savedInstrs + i * sizeof(Instr), sizeof(Instr));
+		if (!isVerified(instr, count)) return false;
+	}
+	if (!isTerminator(instr.opcode)) return false;
+	if (header.haltIndex < -1 || header.haltIndex >= static_cast<int32_t>(count)) return false;
+
+	// The size check above leaves exactly one offset for each instruction, and each has to be somewhere in the
+	// code (the HALT's is length itself) since errors and the profiler use it
+	types::word_t offset;
+	for (size_t i = 0; i < count; i++) {
+		std::memcpy(&offset, savedOffsets + i * sizeof(types::word_t), sizeof(offset));
+		if (offset < 0 || offset > length) return false;
+	}
+
+	SavedIndex saved;
+	for (uint32_t i = 0; i < header.indexCount; i++) {
+		std::memcpy(&saved, savedIndex + i * sizeof(SavedIndex), sizeof(saved));
+		if (saved.loc < 0 || saved.loc >= length || saved.instr < 0 || static_cast<size_t>(saved.instr) >= count) return false;
+	}
+
+	// Usually nothing has been decoded yet, so the index is still all -1
+	if (!instrs.empty()) std::fill(index.begin(), index.end(), -1);
+	instrs.resize(count);
+	std::memcpy(instrs.data(), savedInstrs, count * sizeof(Instr));
+	offsets.resize(count);
+	std::memcpy(offsets.data(), savedOffsets, count * sizeof(types::word_t));
+
+	for (uint32_t i = 0; i < header.indexCount; i++) {
+		std::memcpy(&saved, savedIndex + i * sizeof(SavedIndex), sizeof(saved));
+		index[saved.loc] = saved.instr;
+	}
+
+	pending.clear();
+	fixups.clear();
+	haltIndex = header.haltIndex;
+	return true;
+}
@@ -3,430 +3,979 @@
 
 using std::cout;
 
-#define AS_WORD(x) \
-	reinterpret_cast<vm::types::word_t*>(x)
+namespace {
+	// Loads a Module from source (a path or the bytes themselves) and runs it on the console
+	template<typename Source>
+	int execConsole(const Source& source, const char* const& name, vm::executor::ExecutorSettings& execSettings) {
+		using vm::executor::ExecutorException;
+
+		cout << "Attempting to execute file \"" << name << "\"\n";
+
+		try {
+			vm::Module module(source, execSettings.flags.hasFlags(vm::FLAG_FUSE));
+			vm::Context context(module, execSettings.stackSize, execSettings.snapshotPath != nullptr);
+			if (execSettings.snapshotPath != nullptr && context.restore(execSettings.snapshotPath)) {
+				cout << "Resuming from snapshot \"" << execSettings.snapshotPath << "\"\n";
+			}
+			// Nothing else is waiting for a turn here, so a run that uses up its budget is stopped for good
+			const int result = context.exec(execSettings, std::cout, std::cin);
+			if (result == vm::executor::RUN_PREEMPTED) {
+				cout << IO_ERR "Error during execution at BYTE" << context.decoded->offsets[context.entry] << " : Used up its budget of " << execSettings.budget << " jumps" IO_NORM IO_END;
+			}
+			return result;
+		} catch (ExecutorException& e) {
+			cout << IO_ERR "Error during execution at BYTE" << e.loc << " : " << e.what() << IO_NORM IO_END;
+		} catch (std::exception& e) {
+			cout << IO_ERR "An unknown error ocurred during execution. This error is most likely an issue with the c++ executor code, not your code. Sorry. The provided error message is as follows:\n" << e.what() << IO_NORM IO_END;
+		}
+
+		return 1;
+	}
+}
 
 int vm::executor::exec(const char* const& path, ExecutorSettings& execSettings) {
-	cout << "Attempting to execute file \"" << path << "\"\n";
+	return execConsole(path, path, execSettings);
+}
 
-	std::fstream file;
-	file.open(path, std::ios::in | std::ios::binary);
+int vm::executor::exec(const std::vector<char>& program, const char* const& name, ExecutorSettings& execSettings) {
+	return execConsole(program, name, execSettings);
+}
 
-	try {
-		return vm::executor::exec_(file, execSettings, std::cout, std::cin);
-	} catch (ExecutorException& e) {
-		cout << IO_ERR "Error during execution at BYTE" << e.loc << " : " << e.what() << IO_NORM IO_END;
-	} catch (std::exception& e) {
-		cout << IO_ERR "An unknown error ocurred during execution. This error is most likely an issue with the c++ executor code, not your code. Sorry. The provided error message is as follows:\n" << e.what() << IO_NORM IO_END;
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Dispatch
+
+// Both engines share the handler bodies below. The switch engine goes back to the top of the loop after each
+// instruction, so every instruction goes through the same indirect branch. The threaded engine jumps straight from
+// the end of one handler to the next through a table of label addresses, giving each opcode its own (much more
+// predictable) branch. Either way, the decoded stream always ends in a HALT or a jump, so there are no bounds checks.
+#ifdef VM_THREADED_DISPATCH
+#define VM_TARGET(op) case op: TARGET_##op
+#define VM_DISPATCH() \
+	{ \
+		if (Profile) profiler.step(ip->opcode); \
+		if (Threaded) goto *targets[ip->opcode]; \
+		continue; \
+	}
+#define VM_LABEL(op) targets[op] = &&TARGET_##op
+#else
+#define VM_TARGET(op) case op
+#define VM_DISPATCH() \
+	{ \
+		if (Profile) profiler.step(ip->opcode); \
+		continue; \
 	}
+#endif
 
-	return 1;
-}
+// Move on to the next instruction
+#define VM_NEXT() \
+	{ \
+		ip++; \
+		VM_DISPATCH(); \
+	}
 
-int vm::executor::exec_(std::iostream& file, ExecutorSettings& execSettings, std::ostream& streamOut, std::istream& streamIn) {
+// Stops before this instruction, a read with no whole line to take yet, so that resume() carries on from it
+#define VM_WAIT() \
+	{ \
+		context.entry = static_cast<int>(ip - code); \
+		result = RUN_WAITING; \
+		goto end; \
+	}
+
+// Backward and dynamic jumps are the only safepoints: every loop goes through one, so counting them bounds how long
+// a run goes without a check, and the straight-line code between them has none. Once the budget is used up, the run
+// stops before the jump's target, for the next run to carry on from. Samples are taken here too, at the end of the
+// loop, which keeps all of that out of every jump. RET has its own, before it pops its frame.
+#define VM_SAFEPOINT(i) \
+	{ \
+		if (--left == 0) { \
+			stopAt = (i); \
+			goto safepoint; \
+		} \
+	}
+
+#ifdef VM_JIT
+// Counts how many times a loop head or R_JMP target is reached. Once one gets hot, the rest of the run is handed to
+// the JIT from there, so short runs never pay for compiling anything.
+#define VM_HOT(i) \
+	{ \
+		if (Tiered && ++hotness[i] == execSettings.jitThreshold) { \
+			if (Profile) profiler.tierUp(i); \
+			reg[register_::FZ].bool_ = fz; \
+			countdown.left = left; \
+			context.isInJit = true; \
+			result = Jit::of(context).run(i, countdown, streamIn); \
+			fz = reg[register_::FZ].bool_; \
+			goto end; \
+		} \
+	}
+#else
+#define VM_HOT(i) {}
+#endif
+
+// Jump to a decoded instruction index (static jump targets are resolved when decoding)
+#define VM_JUMP(i) \
+	{ \
+		const int target = (i); \
+		if (Profile) profiler.jump(target); \
+		if (target <= ip - code) { \
+			VM_SAFEPOINT(target); \
+			VM_HOT(target); \
+		} \
+		ip = code + target; \
+		VM_DISPATCH(); \
+	}
+
+// Jump to a byte offset held in a register. This may need to decode more of the program, which can move the stream.
+// Only RET doesn't count here, since it already has before popping its frame.
+#define VM_JUMP_DYNAMIC(loc, isCounted) \
+	{ \
+		const int i = context.resolve(loc); \
+		if (Profile) profiler.jump(i); \
+		if (Tiered && hotness.size() < context.decoded->instrs.size()) hotness.resize(context.decoded->instrs.size(), 0); \
+		if (isCounted) VM_SAFEPOINT(i); \
+		VM_HOT(i); \
+		code = context.decoded->instrs.data(); \
+		offsets = context.decoded->offsets.data(); \
+		ip = code + i; \
+		VM_DISPATCH(); \
+	}
+
+template<bool Threaded, bool Profile, bool Tiered>
+int vm::executor::run(Context& context, ExecutorSettings& execSettings, std::ostream& streamOut, std::istream& streamIn) {
 	using namespace types;
 	using namespace opcode;
 
-	Program program(file);
-	Stack stack(execSettings.stackSize);
-	Value reg[register_::R0 + register_::NUM_GEN_REGISTERS];
-	reg[register_::PP].word = reinterpret_cast<word_t>(program.start);
-	reg[register_::BP].word = reinterpret_cast<word_t>(stack.start);
-
-	program.goto_(format::FIRST_INSTR_ADDR_LOCATION);
-	program.goto_(*AS_WORD(program.ip));
-
-	// Dummy values
-	opcode_t opcode = 0;
-	reg_t rid1 = 0;
-	reg_t rid2 = 0;
-	reg_t rid3 = 0;
-	word_t word = 0;
-	byte_t byte = 0;
-	short_t short_ = 0;
-	int_t int_ = 0;
-	char_t char_ = 0;
-
-	while (program.ip < program.end) {
-		program.read<opcode_t>(&opcode);
-		switch (opcode) {
-			case NOP:
-				break;
-
-			case HALT:
+	Value* const reg = context.reg;
+	Vector* const vreg = context.vreg;
+	char* const base = context.memory->base;
+	Arena& arena = context.arena;
+	CallStack& calls = context.calls;
+	OutputBuffer& output = context.output;
+	// Both of these move if resolving a dynamic jump has to decode something new
+	const Instr* code = context.decoded->instrs.data();
+	const word_t* offsets = context.decoded->offsets.data();
+	const int entry = context.entry;
+	Profiler profiler;
+
+	const Instr* ip = code + entry;
+	// FZ lives here rather than in reg, and is only put back where something else could look at it: instructions
+	// that name it (between the FZ_SPILL and FZ_FILL the decoder puts around them), the JIT, snapshots and the end
+	bool_t fz = reg[register_::FZ].bool_;
+	RunResult result = RUN_HALTED;
+	// Without a budget or samples this still counts down, but never gets anywhere near 0
+	Countdown countdown(context);
+	unsigned long long left = countdown.left;// Kept out of countdown between stops, so it can stay in a register
+	int stopAt;// The target of the jump that left ran out at (or the RET)
+	// Carries on counting from where a run that stopped early left it
+	std::vector<unsigned int>& hotness = context.hotness;
+	if (Tiered) hotness.resize(context.decoded->instrs.size(), 0);
+
+#ifdef VM_THREADED_DISPATCH
+	const void* targets[256];
+	if (Threaded) {
+		for (const void*& target : targets) target = &&TARGET_INVALID;
+		VM_LABEL(NOP);
+		VM_LABEL(HALT);
+		VM_LABEL(BREAK);
+		VM_LABEL(ALLOC);
+		VM_LABEL(FREE);
+		VM_LABEL(R_PRNT_W);
+		VM_LABEL(PRNT_LN);
+		VM_LABEL(PRNT_C);
+		VM_LABEL(PRNT_STR);
+		VM_LABEL(READ_STR);
+		VM_LABEL(MOV);
+		VM_LABEL(MOV_W);
+		VM_LABEL(MOV_B);
+		VM_LABEL(MOV_S);
+		VM_LABEL(LOAD_W);
+		VM_LABEL(STORE_W);
+		VM_LABEL(LOAD_B);
+		VM_LABEL(STORE_B);
+		VM_LABEL(LOAD_S);
+		VM_LABEL(STORE_S);
+		VM_LABEL(JMP);
+		VM_LABEL(JMP_Z);
+		VM_LABEL(JMP_NZ);
+		VM_LABEL(R_JMP);
+		VM_LABEL(R_JMP_Z);
+		VM_LABEL(R_JMP_NZ);
+		VM_LABEL(I_FLAG);
+		VM_LABEL(I_CMP_EQ);
+		VM_LABEL(I_CMP_NE);
+		VM_LABEL(I_CMP_GT);
+		VM_LABEL(I_CMP_LT);
+		VM_LABEL(I_CMP_GE);
+		VM_LABEL(I_CMP_LE);
+		VM_LABEL(I_INC);
+		VM_LABEL(I_DEC);
+		VM_LABEL(I_ADD);
+		VM_LABEL(I_SUB);
+		VM_LABEL(I_MUL);
+		VM_LABEL(I_DIV);
+		VM_LABEL(I_MOD);
+		VM_LABEL(I_TO_C);
+		VM_LABEL(C_FLAG);
+		VM_LABEL(C_CMP_EQ);
+		VM_LABEL(C_CMP_NE);
+		VM_LABEL(C_CMP_GT);
+		VM_LABEL(C_CMP_LT);
+		VM_LABEL(C_CMP_GE);
+		VM_LABEL(C_CMP_LE);
+		VM_LABEL(C_INC);
+		VM_LABEL(C_DEC);
+		VM_LABEL(C_ADD);
+		VM_LABEL(C_SUB);
+		VM_LABEL(C_MUL);
+		VM_LABEL(C_DIV);
+		VM_LABEL(C_MOD);
+		VM_LABEL(C_TO_I);
+		VM_LABEL(PUSH_SCOPE);
+		VM_LABEL(POP_SCOPE);
+		VM_LABEL(SNAPSHOT);
+		VM_LABEL(CALL);
+		VM_LABEL(RET);
+		VM_LABEL(MEMCPY);
+		VM_LABEL(MEMSET);
+		VM_LABEL(MEMCMP);
+		VM_LABEL(MEMCHR);
+		VM_LABEL(STRLEN);
+		VM_LABEL(V_LOAD);
+		VM_LABEL(V_STORE);
+		VM_LABEL(V_SPLAT);
+		VM_LABEL(V_ADD);
+		VM_LABEL(V_SUB);
+		VM_LABEL(V_MUL);
+		VM_LABEL(V_CMP_EQ);
+		VM_LABEL(V_CMP_GT);
+		VM_LABEL(V_SUM);
+		VM_LABEL(I_CMP_EQ_JZ);
+		VM_LABEL(I_CMP_EQ_JNZ);
+		VM_LABEL(I_CMP_NE_JZ);
+		VM_LABEL(I_CMP_NE_JNZ);
+		VM_LABEL(I_CMP_GT_JZ);
+		VM_LABEL(I_CMP_GT_JNZ);
+		VM_LABEL(I_CMP_LT_JZ);
+		VM_LABEL(I_CMP_LT_JNZ);
+		VM_LABEL(I_CMP_GE_JZ);
+		VM_LABEL(I_CMP_GE_JNZ);
+		VM_LABEL(I_CMP_LE_JZ);
+		VM_LABEL(I_CMP_LE_JNZ);
+		VM_LABEL(I_DEC_JNZ);
+		VM_LABEL(C_FLAG_JZ);
+		VM_LABEL(C_FLAG_JNZ);
+		VM_LABEL(I_ADD_IMM);
+		VM_LABEL(I_SUB_IMM);
+		VM_LABEL(LOAD_W_BP);
+		VM_LABEL(STORE_W_BP);
+		VM_LABEL(LOAD_W_BP_R_JMP);
+		VM_LABEL(I_INC_NF);
+		VM_LABEL(I_DEC_NF);
+		VM_LABEL(I_ADD_NF);
+		VM_LABEL(I_SUB_NF);
+		VM_LABEL(I_MUL_NF);
+		VM_LABEL(I_DIV_NF);
+		VM_LABEL(I_MOD_NF);
+		VM_LABEL(C_INC_NF);
+		VM_LABEL(C_DEC_NF);
+		VM_LABEL(C_ADD_NF);
+		VM_LABEL(C_SUB_NF);
+		VM_LABEL(C_MUL_NF);
+		VM_LABEL(C_DIV_NF);
+		VM_LABEL(C_MOD_NF);
+		VM_LABEL(I_ADD_IMM_NF);
+		VM_LABEL(I_SUB_IMM_NF);
+		VM_LABEL(READ_STR_N);
+		VM_LABEL(FZ_SPILL);
+		VM_LABEL(FZ_FILL);
+	}
+#endif
+
+	if (Profile) {
+		if (context.pausedProfiler) {
+			// Carrying on from a preempted run, so its counts carry on too
+			profiler = std::move(*context.pausedProfiler);
+			context.pausedProfiler.reset();
+			profiler.resume(entry);
+		} else {
+			profiler.decodeMicros = context.module.decodeMicros;
+			profiler.jitThreshold = Tiered ? execSettings.jitThreshold : 0;
+			profiler.budget = context.budget;
+			profiler.start(entry);
+		}
+	}
+
+#ifdef VM_JIT
+	// The last run got as far as the JIT before it stopped, so this one carries on there
+	if (Tiered && context.isInJit) {
+		result = context.jit->run(entry, countdown, streamIn);
+		fz = reg[register_::FZ].bool_;
+		goto end;
+	}
+#endif
+	if (Profile) profiler.step(ip->opcode);
+
+	while (true) {
+		switch (ip->opcode) {
+			VM_TARGET(NOP):
+				VM_NEXT();
+
+			VM_TARGET(HALT):
 				goto end;
 				return 0;
 
-			case BREAK:
-				while (streamIn.get() != '\n');
-				break;
+			VM_TARGET(BREAK):
+				output.flush();
+				if (context.isAsync) {
+					if (!context.input.skipLine()) VM_WAIT();
+				} else {
+					while (streamIn.get() != '\n');
+				}
+				VM_NEXT();
 
-			case ALLOC: // TODO : Careful with the memory!
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
+			VM_TARGET(ALLOC):
 				try {
-					reg[rid1].word = reinterpret_cast<word_t>(new char[reg[rid2].word]);
+					reg[ip->r1].word = addressOf(base, arena.alloc(reg[ip->r2].word));
 				} catch (std::bad_alloc& e) {
-					throw ExecutorException(ExecutorException::BAD_ALLOC, program.ip - program.start, e.what());
+					throw ExecutorException(ExecutorException::BAD_ALLOC, offsets[ip - code], e.what());
 				}
-				break;
-
-			case FREE:
-				program.read<reg_t>(&rid1);
-				delete[] reinterpret_cast<char*>(reg[rid1].word);
-				break;
-
-			case R_PRNT_W:
-				program.read<reg_t>(&rid1);
-				streamOut << reg[rid1].word;
-				break;
-
-			case PRNT_LN:
-				streamOut << '\n';
-				break;
-
-			case PRNT_C:
-				program.read<reg_t>(&rid1);
-				streamOut << reg[rid1].char_;
-				break;
-
-			case PRNT_STR:
-				program.read<reg_t>(&rid1);
-				program.read<word_t>(&word);
-				streamOut << reinterpret_cast<char*>(reg[rid1].word + word);
-				break;
-
-			case READ_STR:
-				program.read<reg_t>(&rid1);
-				program.read<word_t>(&word);
-				streamIn.getline(reinterpret_cast<char*>(reg[rid1].word + word), std::numeric_limits<std::streamsize>::max(), '\n');
-				break;
-
-			case MOV:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[rid1] = reg[rid2];
-				break;
-
-			case MOV_W:
-				program.read<reg_t>(&rid1);
-				program.read<word_t>(&word);
-				reg[rid1].word = word;
-				break;
-
-			case MOV_B:
-				program.read<reg_t>(&rid1);
-				program.read<byte_t>(&byte);
-				reg[rid1].byte = byte;
-				break;
-
-			case MOV_S:
-				program.read<reg_t>(&rid1);
-				program.read<short_t>(&short_);
-				reg[rid1].short_ = short_;
-				break;
-
-			case LOAD_W:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<word_t>(&word);
-				reg[rid1].word = *reinterpret_cast<word_t*>(reg[rid2].word + word);
-				break;
-
-			case STORE_W:
-				program.read<reg_t>(&rid1);
-				program.read<word_t>(&word);
-				program.read<reg_t>(&rid2);
-				*reinterpret_cast<word_t*>(reg[rid1].word + word) = reg[rid2].word;
-				break;
-
-			case LOAD_B:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<word_t>(&word);
-				reg[rid1].byte = *reinterpret_cast<byte_t*>(reg[rid2].word + word);
-				break;
-
-			case STORE_B:
-				program.read<reg_t>(&rid1);
-				program.read<word_t>(&word);
-				program.read<reg_t>(&rid2);
-				*reinterpret_cast<byte_t*>(reg[rid1].word + word) = reg[rid2].byte;
-				break;
-
-			case LOAD_S:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<word_t>(&word);
-				reg[rid1].short_ = *reinterpret_cast<short_t*>(reg[rid2].word + word);
-				break;
-
-			case STORE_S:
-				program.read<reg_t>(&rid1);
-				program.read<word_t>(&word);
-				program.read<reg_t>(&rid2);
-				*reinterpret_cast<short_t*>(reg[rid1].word + word) = reg[rid2].short_;
-				break;
-
-			case JMP:
-				program.read<word_t>(&word);
-				program.goto_(word);
-				break;
-
-			case JMP_Z:
-				if (reg[register_::FZ].bool_) {
-					program.ip += sizeof(word_t);
-				} else {
-					program.read<word_t>(&word);
-					program.goto_(word);
-				}
-				break;
+				VM_NEXT();
 
-			case JMP_NZ:
-				if (reg[register_::FZ].bool_) {
-					program.read<word_t>(&word);
-					program.goto_(word);
-				} else {
-					program.ip += sizeof(word_t);
-				}
-				break;
+			VM_TARGET(FREE):
+				if (reg[ip->r1].word != 0) arena.free(at<char>(base, reg[ip->r1].word));
+				VM_NEXT();
+
+			VM_TARGET(R_PRNT_W):
+				output.writeWord(reg[ip->r1].word);
+				VM_NEXT();
 
-			case R_JMP:
-				program.read<reg_t>(&rid1);
-				program.goto_(reg[rid1].word);
-				break;
+			VM_TARGET(PRNT_LN):
+				output.put('\n');
+				VM_NEXT();
 
-			case R_JMP_Z:
-				if (reg[register_::FZ].bool_ == 0) {
-					program.ip += sizeof(reg_t);
+			VM_TARGET(PRNT_C):
+				output.put(static_cast<char>(reg[ip->r1].char_));
+				VM_NEXT();
+
+			VM_TARGET(PRNT_STR):
+				output.writeString(at<char>(base, reg[ip->r1].word + ip->imm));
+				VM_NEXT();
+
+			VM_TARGET(READ_STR):
+				output.flush();
+				if (context.isAsync) {
+					if (!context.input.readLine(at<char>(base, reg[ip->r1].word + ip->imm))) VM_WAIT();
 				} else {
-					program.read<reg_t>(&rid1);
-					program.goto_(reg[rid1].word);
+					streamIn.getline(at<char>(base, reg[ip->r1].word + ip->imm), std::numeric_limits<std::streamsize>::max(), '\n');
 				}
-				break;
+				VM_NEXT();
 
-			case R_JMP_NZ:
-				if (reg[register_::FZ].bool_ == 0) {
-					program.read<reg_t>(&rid1);
-					program.goto_(reg[rid1].word);
+			VM_TARGET(READ_STR_N):
+				output.flush();
+				if (context.isAsync) {
+					if (!context.input.readLine(at<char>(base, reg[ip->r1].word + ip->imm), reg[ip->r2].word, offsets[ip - code])) VM_WAIT();
 				} else {
-					program.ip += sizeof(reg_t);
+					readLine(streamIn, at<char>(base, reg[ip->r1].word + ip->imm), reg[ip->r2].word, offsets[ip - code]);
 				}
-				break;
+				VM_NEXT();
+
+			VM_TARGET(MOV):
+				reg[ip->r1] = reg[ip->r2];
+				VM_NEXT();
+
+			VM_TARGET(MOV_W):
+				reg[ip->r1].word = ip->imm;
+				VM_NEXT();
 
-			case I_FLAG:
-				program.read<reg_t>(&rid1);
-				reg[register_::FZ].bool_ = reg[rid1].int_ == 0 ? 0 : 1;
+			VM_TARGET(MOV_B):
+				reg[ip->r1].word = static_cast<byte_t>(ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(MOV_S):
+				reg[ip->r1].word = static_cast<short_t>(ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(LOAD_W):
+				reg[ip->r1].word = *at<word_t>(base, reg[ip->r2].word + ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(STORE_W):
+				*at<word_t>(base, reg[ip->r1].word + ip->imm) = reg[ip->r2].word;
+				VM_NEXT();
+
+			VM_TARGET(LOAD_B):
+				reg[ip->r1].word = *at<byte_t>(base, reg[ip->r2].word + ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(STORE_B):
+				*at<byte_t>(base, reg[ip->r1].word + ip->imm) = reg[ip->r2].byte;
+				VM_NEXT();
+
+			VM_TARGET(LOAD_S):
+				reg[ip->r1].word = *at<short_t>(base, reg[ip->r2].word + ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(STORE_S):
+				*at<short_t>(base, reg[ip->r1].word + ip->imm) = reg[ip->r2].short_;
+				VM_NEXT();
+
+			VM_TARGET(JMP):
+				VM_JUMP(ip->imm);
+
+			VM_TARGET(JMP_Z):
+				if (fz) VM_NEXT();
+				VM_JUMP(ip->imm);
+
+			VM_TARGET(JMP_NZ):
+				if (fz) VM_JUMP(ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(R_JMP):
+				VM_JUMP_DYNAMIC(reg[ip->r1].word, true);
+
+			VM_TARGET(R_JMP_Z):
+				if (fz == 0) VM_NEXT();
+				VM_JUMP_DYNAMIC(reg[ip->r1].word, true);
+
+			VM_TARGET(R_JMP_NZ):
+				if (fz == 0) VM_JUMP_DYNAMIC(reg[ip->r1].word, true);
+				VM_NEXT();
+
+			VM_TARGET(I_FLAG):
+				fz = reg[ip->r1].int_ == 0 ? 0 : 1;
 				// TODO : Set other flags if they exist?
-				break;
-
-			case I_CMP_EQ:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[register_::FZ].bool_ = reg[rid1].int_ == reg[rid2].int_ ? 1 : 0;
-				break;
-
-			case I_CMP_NE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[register_::FZ].bool_ = reg[rid1].int_ != reg[rid2].int_ ? 1 : 0;
-				break;
-
-			case I_CMP_GT:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[register_::FZ].bool_ = reg[rid1].int_ > reg[rid2].int_ ? 1 : 0;
-				break;
-
-			case I_CMP_LT:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[register_::FZ].bool_ = reg[rid1].int_ < reg[rid2].int_ ? 1 : 0;
-				break;
-
-			case I_CMP_GE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[register_::FZ].bool_ = reg[rid1].int_ >= reg[rid2].int_ ? 1 : 0;
-				break;
-
-			case I_CMP_LE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[register_::FZ].bool_ = reg[rid1].int_ <= reg[rid2].int_ ? 1 : 0;
-				break;
-
-			case I_INC:
-				program.read<reg_t>(&rid1);
-				reg[rid1].int_++;
-				reg[register_::FZ].bool_ = reg[rid1].int_ == 0 ? 0 : 1;
-				break;
-
-			case I_DEC:
-				program.read<reg_t>(&rid1);
-				reg[rid1].int_--;
-				reg[register_::FZ].bool_ = reg[rid1].int_ == 0 ? 0 : 1;
-				break;
-
-			case I_ADD:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				reg[rid1].int_ = reg[rid2].int_ + reg[rid3].int_;
-				reg[register_::FZ].bool_ = reg[rid1].int_ == 0 ? 0 : 1;
-				break;
-
-			case I_SUB:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				reg[rid1].int_ = reg[rid2].int_ - reg[rid3].int_;
-				reg[register_::FZ].bool_ = reg[rid1].int_ == 0 ? 0 : 1;
-				break;
-
-			case I_MUL:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				reg[rid1].int_ = reg[rid2].int_ * reg[rid3].int_;
-				reg[register_::FZ].bool_ = reg[rid1].int_ == 0 ? 0 : 1;
-				break;
-
-			case I_DIV:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				if (reg[rid3].int_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, program.ip - program.start);
-				reg[rid1].int_ = reg[rid2].int_ / reg[rid3].int_;
-				reg[register_::FZ].bool_ = reg[rid1].int_ == 0 ? 0 : 1;
-				break;
-
-			case I_MOD:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				if (reg[rid3].int_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, program.ip - program.start);
-				reg[rid1].int_ = reg[rid2].int_ % reg[rid3].int_;
-				reg[register_::FZ].bool_ = reg[rid1].int_ == 0 ? 0 : 1;
-				break;
-
-			case I_TO_C:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[rid1].char_ = static_cast<char_t>(reg[rid2].int_);
-				break;
-
-			case C_FLAG:
-				program.read<reg_t>(&rid1);
-				reg[register_::FZ].bool_ = reg[rid1].char_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(I_CMP_EQ):
+				fz = reg[ip->r1].int_ == reg[ip->r2].int_ ? 1 : 0;
+				VM_NEXT();
+
+			VM_TARGET(I_CMP_NE):
+				fz = reg[ip->r1].int_ != reg[ip->r2].int_ ? 1 : 0;
+				VM_NEXT();
+
+			VM_TARGET(I_CMP_GT):
+				fz = reg[ip->r1].int_ > reg[ip->r2].int_ ? 1 : 0;
+				VM_NEXT();
+
+			VM_TARGET(I_CMP_LT):
+				fz = reg[ip->r1].int_ < reg[ip->r2].int_ ? 1 : 0;
+				VM_NEXT();
+
+			VM_TARGET(I_CMP_GE):
+				fz = reg[ip->r1].int_ >= reg[ip->r2].int_ ? 1 : 0;
+				VM_NEXT();
+
+			VM_TARGET(I_CMP_LE):
+				fz = reg[ip->r1].int_ <= reg[ip->r2].int_ ? 1 : 0;
+				VM_NEXT();
+
+			VM_TARGET(I_INC):
+				reg[ip->r1].int_++;
+				fz = reg[ip->r1].int_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(I_DEC):
+				reg[ip->r1].int_--;
+				fz = reg[ip->r1].int_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(I_ADD):
+				reg[ip->r1].int_ = reg[ip->r2].int_ + reg[ip->r3].int_;
+				fz = reg[ip->r1].int_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(I_SUB):
+				reg[ip->r1].int_ = reg[ip->r2].int_ - reg[ip->r3].int_;
+				fz = reg[ip->r1].int_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(I_MUL):
+				reg[ip->r1].int_ = reg[ip->r2].int_ * reg[ip->r3].int_;
+				fz = reg[ip->r1].int_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(I_DIV):
+				if (reg[ip->r3].int_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, offsets[ip - code]);
+				reg[ip->r1].int_ = reg[ip->r2].int_ / reg[ip->r3].int_;
+				fz = reg[ip->r1].int_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(I_MOD):
+				if (reg[ip->r3].int_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, offsets[ip - code]);
+				reg[ip->r1].int_ = reg[ip->r2].int_ % reg[ip->r3].int_;
+				fz = reg[ip->r1].int_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(I_TO_C):
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r2].int_);
+				VM_NEXT();
+
+			VM_TARGET(C_FLAG):
+				fz = reg[ip->r1].char_ == 0 ? 0 : 1;
 				// TODO : Set other flags if they exist?
-				break;
-
-			case C_CMP_EQ:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[register_::FZ].bool_ = reg[rid1].char_ == reg[rid2].char_ ? 1 : 0;
-				break;
-
-			case C_CMP_NE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[register_::FZ].bool_ = reg[rid1].char_ != reg[rid2].char_ ? 1 : 0;
-				break;
-
-			case C_CMP_GT:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[register_::FZ].bool_ = reg[rid1].char_ > reg[rid2].char_ ? 1 : 0;
-				break;
-
-			case C_CMP_LT:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[register_::FZ].bool_ = reg[rid1].char_ < reg[rid2].char_ ? 1 : 0;
-				break;
-
-			case C_CMP_GE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[register_::FZ].bool_ = reg[rid1].char_ >= reg[rid2].char_ ? 1 : 0;
-				break;
-
-			case C_CMP_LE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[register_::FZ].bool_ = reg[rid1].char_ <= reg[rid2].char_ ? 1 : 0;
-				break;
-
-			case C_INC:
-				program.read<reg_t>(&rid1);
-				reg[rid1].char_++;
-				reg[register_::FZ].bool_ = reg[rid1].char_ == 0 ? 0 : 1;
-				break;
-
-			case C_DEC:
-				program.read<reg_t>(&rid1);
-				reg[rid1].char_--;
-				reg[register_::FZ].bool_ = reg[rid1].char_ == 0 ? 0 : 1;
-				break;
-
-			case C_ADD:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				reg[rid1].char_ = reg[rid2].char_ + reg[rid3].char_;
-				reg[register_::FZ].bool_ = reg[rid1].char_ == 0 ? 0 : 1;
-				break;
-
-			case C_SUB:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				reg[rid1].char_ = reg[rid2].char_ - reg[rid3].char_;
-				reg[register_::FZ].bool_ = reg[rid1].char_ == 0 ? 0 : 1;
-				break;
-
-			case C_MUL:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				reg[rid1].char_ = reg[rid2].char_ * reg[rid3].char_;
-				reg[register_::FZ].bool_ = reg[rid1].char_ == 0 ? 0 : 1;
-				break;
-
-			case C_DIV:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				if (reg[rid3].char_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, program.ip - program.start);
-				reg[rid1].char_ = reg[rid2].char_ / reg[rid3].char_;
-				reg[register_::FZ].bool_ = reg[rid1].char_ == 0 ? 0 : 1;
-				break;
-
-			case C_MOD:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				if (reg[rid3].char_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, program.ip - program.start);
-				reg[rid1].char_ = reg[rid2].char_ % reg[rid3].char_;
-				reg[register_::FZ].bool_ = reg[rid1].char_ == 0 ? 0 : 1;
-				break;
-
-			case C_TO_I:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				reg[rid1].int_ = static_cast<char_t>(reg[rid2].char_);
-				break;
+				VM_NEXT();
+
+			VM_TARGET(C_CMP_EQ):
+				fz = reg[ip->r1].char_ == reg[ip->r2].char_ ? 1 : 0;
+				VM_NEXT();
+
+			VM_TARGET(C_CMP_NE):
+				fz = reg[ip->r1].char_ != reg[ip->r2].char_ ? 1 : 0;
+				VM_NEXT();
+
+			VM_TARGET(C_CMP_GT):
+				fz = reg[ip->r1].char_ > reg[ip->r2].char_ ? 1 : 0;
+				VM_NEXT();
+
+			VM_TARGET(C_CMP_LT):
+				fz = reg[ip->r1].char_ < reg[ip->r2].char_ ? 1 : 0;
+				VM_NEXT();
+
+			VM_TARGET(C_CMP_GE):
+				fz = reg[ip->r1].char_ >= reg[ip->r2].char_ ? 1 : 0;
+				VM_NEXT();
+
+			VM_TARGET(C_CMP_LE):
+				fz = reg[ip->r1].char_ <= reg[ip->r2].char_ ? 1 : 0;
+				VM_NEXT();
+
+			VM_TARGET(C_INC):
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r1].char_ + 1);
+				fz = reg[ip->r1].char_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(C_DEC):
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r1].char_ - 1);
+				fz = reg[ip->r1].char_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(C_ADD):
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r2].char_ + reg[ip->r3].char_);
+				fz = reg[ip->r1].char_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(C_SUB):
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r2].char_ - reg[ip->r3].char_);
+				fz = reg[ip->r1].char_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(C_MUL):
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r2].char_ * reg[ip->r3].char_);
+				fz = reg[ip->r1].char_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(C_DIV):
+				if (reg[ip->r3].char_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, offsets[ip - code]);
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r2].char_ / reg[ip->r3].char_);
+				fz = reg[ip->r1].char_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(C_MOD):
+				if (reg[ip->r3].char_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, offsets[ip - code]);
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r2].char_ % reg[ip->r3].char_);
+				fz = reg[ip->r1].char_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(C_TO_I):
+				reg[ip->r1].int_ = static_cast<char_t>(reg[ip->r2].char_);
+				VM_NEXT();
+
+			VM_TARGET(PUSH_SCOPE):
+				arena.push();
+				VM_NEXT();
+
+			VM_TARGET(POP_SCOPE):
+				arena.pop();
+				VM_NEXT();
+
+			VM_TARGET(SNAPSHOT):
+				reg[register_::FZ].bool_ = fz;
+				if (context.snapshotPath != nullptr && !context.snapshot(context.snapshotPath, offsets[ip - code + 1])) {
+					output.writeString(IO_WARN "Could not write the snapshot" IO_NORM "\n");
+				}
+				VM_NEXT();
+
+			VM_TARGET(CALL): {
+				if (calls.top == calls.end) throw ExecutorException(ExecutorException::CALL_STACK_OVERFLOW, offsets[ip - code]);
+				*calls.top++ = offsets[ip - code + 1];
+				// The new frame starts with the BP that RET goes back to
+				const word_t frame = reg[register_::BP].word + ip->frameSize();
+				*at<word_t>(base, frame) = reg[register_::BP].word;
+				reg[register_::BP].word = frame;
+				VM_JUMP(ip->imm);
+			}
+
+			VM_TARGET(RET):
+				if (calls.top == calls.start) throw ExecutorException(ExecutorException::RETURN_WITHOUT_CALL, offsets[ip - code]);
+				// Counted while the frame is still there, so a sample here goes to the function returning (which is all
+				// a function without loops ever gets)
+				if (--left == 0) {
+					stopAt = static_cast<int>(ip - code);
+					goto returnSafepoint;
+				}
+			returning:
+				reg[register_::BP].word = *at<word_t>(base, reg[register_::BP].word);
+				VM_JUMP_DYNAMIC(*--calls.top, false);
+
+			VM_TARGET(MEMCPY):
+				bulk::copy(base, reg[ip->r1].word, reg[ip->r2].word, reg[ip->r3].word);
+				VM_NEXT();
+
+			VM_TARGET(MEMSET):
+				bulk::fill(base, reg[ip->r1].word, reg[ip->r2].char_, reg[ip->r3].word);
+				VM_NEXT();
+
+			VM_TARGET(MEMCMP):
+				reg[ip->r3].word = bulk::compare(base, reg[ip->r1].word, reg[ip->r2].word, reg[ip->r3].word);
+				VM_NEXT();
+
+			VM_TARGET(MEMCHR):
+				reg[ip->r1].word = bulk::find(base, reg[ip->r1].word, reg[ip->r2].char_, reg[ip->r3].word);
+				VM_NEXT();
+
+			VM_TARGET(STRLEN):
+				reg[ip->r1].word = bulk::length(base, reg[ip->r2].word);
+				VM_NEXT();
+
+			VM_TARGET(V_LOAD):
+				vector::load(vreg[ip->r1], base, reg[ip->r2].word + ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(V_STORE):
+				vector::store(base, reg[ip->r1].word + ip->imm, vreg[ip->r2]);
+				VM_NEXT();
+
+			VM_TARGET(V_SPLAT):
+				vector::splat(vreg[ip->r1], reg[ip->r2].word);
+				VM_NEXT();
+
+			VM_TARGET(V_ADD):
+				vector::add(vreg[ip->r1], vreg[ip->r2], vreg[ip->r3]);
+				VM_NEXT();
+
+			VM_TARGET(V_SUB):
+				vector::sub(vreg[ip->r1], vreg[ip->r2], vreg[ip->r3]);
+				VM_NEXT();
+
+			VM_TARGET(V_MUL):
+				vector::mul(vreg[ip->r1], vreg[ip->r2], vreg[ip->r3]);
+				VM_NEXT();
+
+			VM_TARGET(V_CMP_EQ):
+				vector::cmpEq(vreg[ip->r1], vreg[ip->r2], vreg[ip->r3]);
+				VM_NEXT();
+
+			VM_TARGET(V_CMP_GT):
+				vector::cmpGt(vreg[ip->r1], vreg[ip->r2], vreg[ip->r3]);
+				VM_NEXT();
+
+			VM_TARGET(V_SUM):
+				reg[ip->r1].word = vector::sum(vreg[ip->r2]);
+				VM_NEXT();
+
+			VM_TARGET(I_CMP_EQ_JZ):
+				fz = reg[ip->r1].int_ == reg[ip->r2].int_ ? 1 : 0;
+				if (fz) VM_NEXT();
+				VM_JUMP(ip->imm);
+
+			VM_TARGET(I_CMP_EQ_JNZ):
+				fz = reg[ip->r1].int_ == reg[ip->r2].int_ ? 1 : 0;
+				if (fz) VM_JUMP(ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(I_CMP_NE_JZ):
+				fz = reg[ip->r1].int_ != reg[ip->r2].int_ ? 1 : 0;
+				if (fz) VM_NEXT();
+				VM_JUMP(ip->imm);
+
+			VM_TARGET(I_CMP_NE_JNZ):
+				fz = reg[ip->r1].int_ != reg[ip->r2].int_ ? 1 : 0;
+				if (fz) VM_JUMP(ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(I_CMP_GT_JZ):
+				fz = reg[ip->r1].int_ > reg[ip->r2].int_ ? 1 : 0;
+				if (fz) VM_NEXT();
+				VM_JUMP(ip->imm);
+
+			VM_TARGET(I_CMP_GT_JNZ):
+				fz = reg[ip->r1].int_ > reg[ip->r2].int_ ? 1 : 0;
+				if (fz) VM_JUMP(ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(I_CMP_LT_JZ):
+				fz = reg[ip->r1].int_ < reg[ip->r2].int_ ? 1 : 0;
+				if (fz) VM_NEXT();
+				VM_JUMP(ip->imm);
+
+			VM_TARGET(I_CMP_LT_JNZ):
+				fz = reg[ip->r1].int_ < reg[ip->r2].int_ ? 1 : 0;
+				if (fz) VM_JUMP(ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(I_CMP_GE_JZ):
+				fz = reg[ip->r1].int_ >= reg[ip->r2].int_ ? 1 : 0;
+				if (fz) VM_NEXT();
+				VM_JUMP(ip->imm);
+
+			VM_TARGET(I_CMP_GE_JNZ):
+				fz = reg[ip->r1].int_ >= reg[ip->r2].int_ ? 1 : 0;
+				if (fz) VM_JUMP(ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(I_CMP_LE_JZ):
+				fz = reg[ip->r1].int_ <= reg[ip->r2].int_ ? 1 : 0;
+				if (fz) VM_NEXT();
+				VM_JUMP(ip->imm);
+
+			VM_TARGET(I_CMP_LE_JNZ):
+				fz = reg[ip->r1].int_ <= reg[ip->r2].int_ ? 1 : 0;
+				if (fz) VM_JUMP(ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(I_DEC_JNZ):
+				reg[ip->r1].int_--;
+				fz = reg[ip->r1].int_ == 0 ? 0 : 1;
+				if (fz) VM_JUMP(ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(C_FLAG_JZ):
+				fz = reg[ip->r1].char_ == 0 ? 0 : 1;
+				if (fz) VM_NEXT();
+				VM_JUMP(ip->imm);
+
+			VM_TARGET(C_FLAG_JNZ):
+				fz = reg[ip->r1].char_ == 0 ? 0 : 1;
+				if (fz) VM_JUMP(ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(I_ADD_IMM):
+				reg[ip->r3].word = ip->imm;
+				reg[ip->r1].int_ = reg[ip->r2].int_ + ip->imm;
+				fz = reg[ip->r1].int_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(I_SUB_IMM):
+				reg[ip->r3].word = ip->imm;
+				reg[ip->r1].int_ = reg[ip->r2].int_ - ip->imm;
+				fz = reg[ip->r1].int_ == 0 ? 0 : 1;
+				VM_NEXT();
+
+			VM_TARGET(LOAD_W_BP):
+				reg[ip->r1].word = *at<word_t>(base, reg[register_::BP].word + ip->imm);
+				VM_NEXT();
+
+			VM_TARGET(STORE_W_BP):
+				*at<word_t>(base, reg[register_::BP].word + ip->imm) = reg[ip->r1].word;
+				VM_NEXT();
+
+			VM_TARGET(LOAD_W_BP_R_JMP):
+				reg[ip->r1].word = *at<word_t>(base, reg[register_::BP].word + ip->imm);
+				VM_JUMP_DYNAMIC(reg[ip->r1].word, true);
+
+			VM_TARGET(I_INC_NF):
+				reg[ip->r1].int_++;
+				VM_NEXT();
+
+			VM_TARGET(I_DEC_NF):
+				reg[ip->r1].int_--;
+				VM_NEXT();
+
+			VM_TARGET(I_ADD_NF):
+				reg[ip->r1].int_ = reg[ip->r2].int_ + reg[ip->r3].int_;
+				VM_NEXT();
+
+			VM_TARGET(I_SUB_NF):
+				reg[ip->r1].int_ = reg[ip->r2].int_ - reg[ip->r3].int_;
+				VM_NEXT();
+
+			VM_TARGET(I_MUL_NF):
+				reg[ip->r1].int_ = reg[ip->r2].int_ * reg[ip->r3].int_;
+				VM_NEXT();
+
+			VM_TARGET(I_DIV_NF):
+				if (reg[ip->r3].int_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, offsets[ip - code]);
+				reg[ip->r1].int_ = reg[ip->r2].int_ / reg[ip->r3].int_;
+				VM_NEXT();
+
+			VM_TARGET(I_MOD_NF):
+				if (reg[ip->r3].int_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, offsets[ip - code]);
+				reg[ip->r1].int_ = reg[ip->r2].int_ % reg[ip->r3].int_;
+				VM_NEXT();
+
+			VM_TARGET(C_INC_NF):
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r1].char_ + 1);
+				VM_NEXT();
+
+			VM_TARGET(C_DEC_NF):
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r1].char_ - 1);
+				VM_NEXT();
+
+			VM_TARGET(C_ADD_NF):
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r2].char_ + reg[ip->r3].char_);
+				VM_NEXT();
+
+			VM_TARGET(C_SUB_NF):
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r2].char_ - reg[ip->r3].char_);
+				VM_NEXT();
+
+			VM_TARGET(C_MUL_NF):
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r2].char_ * reg[ip->r3].char_);
+				VM_NEXT();
+
+			VM_TARGET(C_DIV_NF):
+				if (reg[ip->r3].char_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, offsets[ip - code]);
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r2].char_ / reg[ip->r3].char_);
+				VM_NEXT();
+
+			VM_TARGET(C_MOD_NF):
+				if (reg[ip->r3].char_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, offsets[ip - code]);
+				reg[ip->r1].word = static_cast<char_t>(reg[ip->r2].char_ % reg[ip->r3].char_);
+				VM_NEXT();
+
+			VM_TARGET(I_ADD_IMM_NF):
+				reg[ip->r3].word = ip->imm;
+				reg[ip->r1].int_ = reg[ip->r2].int_ + ip->imm;
+				VM_NEXT();
+
+			VM_TARGET(I_SUB_IMM_NF):
+				reg[ip->r3].word = ip->imm;
+				reg[ip->r1].int_ = reg[ip->r2].int_ - ip->imm;
+				VM_NEXT();
+
+			VM_TARGET(FZ_SPILL):
+				reg[register_::FZ].bool_ = fz;
+				VM_NEXT();
+
+			VM_TARGET(FZ_FILL):
+				fz = reg[register_::FZ].bool_;
+				VM_NEXT();
 
 			default:
-				throw ExecutorException(ExecutorException::UNKNOWN_OPCODE, program.ip - program.start);
-				break;
+#ifdef VM_THREADED_DISPATCH
+			TARGET_INVALID:
+#endif
+				// INVALID holds what the decoder found wrong with it
+				throw ExecutorException(ip->opcode == INVALID ? static_cast<ExecutorException::ErrorType>(ip->imm) : ExecutorException::UNKNOWN_OPCODE, offsets[ip - code]);
+		}
+
+		// Only ever reached from VM_SAFEPOINT, since every handler ends in a dispatch
+	safepoint:
+		if (countdown.reached(context, stopAt)) {
+			context.entry = stopAt;
+			result = RUN_PREEMPTED;
+			goto end;
+		}
+		left = countdown.left;
+		VM_HOT(stopAt);
+		code = context.decoded->instrs.data();
+		offsets = context.decoded->offsets.data();
+		ip = code + stopAt;
+		VM_DISPATCH();
+
+		// Likewise from RET, which has already been counted by the time it carries on. A preempted run still returns
+		// first, and stops where it returns to, so that it gets somewhere even with a budget of 1.
+	returnSafepoint:
+		if (countdown.reached(context, stopAt)) {
+			reg[register_::BP].word = *at<word_t>(base, reg[register_::BP].word);
+			context.entry = context.resolve(*--calls.top);
+			if (Profile) profiler.jump(context.entry);
+			result = RUN_PREEMPTED;
+			goto end;
 		}
+		left = countdown.left;
+		goto returning;
 	}
 
 end:;
-	// TODO: automatic memory cleanup
+	reg[register_::FZ].bool_ = fz;
+	output.flush();
+	if (result != RUN_HALTED) {
+		// Everything the program has is still needed when it carries on, and so is the profile
+		if (Profile) {
+			profiler.preempt();
+			context.pausedProfiler.reset(new Profiler(std::move(profiler)));
+		}
+		return result;
+	}
+	hotness.clear();
+#ifdef VM_JIT
+	context.isInJit = false;
+#endif
+	arena.release();
+	if (Profile) {
+		profiler.stop();
+		context.dispatches = profiler.dispatches();
+		streamOut << IO_END;
+		profiler.report(streamOut, *context.decoded);
+		if (execSettings.profilePath != nullptr && !profiler.write(execSettings.profilePath, *context.decoded)) {
+			streamOut << IO_WARN "Could not write the profile to \"" << execSettings.profilePath << "\"" IO_NORM "\n";
+		}
+	}
+	writeSamples(context, execSettings, streamOut);
 	streamOut << IO_END;
 
 	return 0;
-}
\ No newline at end of file
+}
+
+int vm::executor::exec_(std::iostream& file, ExecutorSettings& execSettings, std::ostream& streamOut, std::istream& streamIn) {
+	Module module(file, execSettings.flags.hasFlags(FLAG_FUSE));
+	Context context(module, execSettings.stackSize);
+	return context.exec(execSettings, streamOut, streamIn);
+}
+
+int vm::Context::exec(executor::ExecutorSettings& execSettings, std::ostream& streamOut, std::istream& streamIn) {
+	isAsync = false;
+	return launch(execSettings, streamOut, streamIn);
+}
+
+int vm::Context::resume(executor::ExecutorSettings& execSettings, std::ostream& streamOut) {
+	executor::ExecutorSettings runSettings = execSettings;
+	runSettings.flags.unsetFlags(FLAG_PROFILE);
+	// Never read from, since everything comes from input
+	std::istream noInput(nullptr);
+	isAsync = true;
+	return launch(runSettings, streamOut, noInput);
+}
+
+int vm::Context::launch(executor::ExecutorSettings& execSettings, std::ostream& streamOut, std::istream& streamIn) {
+	using namespace executor;
+
+	typedef int (*Runner)(Context&, ExecutorSettings&, std::ostream&, std::istream&);
+#ifdef VM_THREADED_DISPATCH
+#define VM_THREADED true
+#else
+#define VM_THREADED false
+#endif
+	// [threaded][profile][tiered]
+	static constexpr Runner runners[2][2][2] = {
+		{ { run<false, false, false>, run<false, false, true> }, { run<false, true, false>, run<false, true, true> } },
+		{ { run<VM_THREADED, false, false>, run<VM_THREADED, false, true> }, { run<VM_THREADED, true, false>, run<VM_THREADED, true, true> } }
+	};
+#undef VM_THREADED
+
+	const bool profile = execSettings.flags.hasFlags(FLAG_PROFILE);
+	bool tiered = false;
+	Runner runner = nullptr;
+#ifdef VM_JIT
+	if (execSettings.flags.hasFlags(FLAG_JIT)) {
+		// Profiling needs a hook at every dispatch, so it never compiles everything up front
+		if (execSettings.jitThreshold == 0 && !profile) runner = runJit;
+		tiered = execSettings.jitThreshold != 0;
+	}
+#endif
+	if (runner == nullptr) runner = runners[execSettings.dispatch == Dispatch::THREADED][profile][tiered];
+
+	snapshotPath = execSettings.snapshotPath;
+	budget = execSettings.budget;
+	sampleInterval = execSettings.samplePath != nullptr ? execSettings.sampleInterval : 0;
+	output.attach(streamOut, execSettings.flushSize);
+	try {
+		return runner(*this, execSettings, streamOut, streamIn);
+	} catch (...) {
+		// Whatever was printed before the error still needs to come out before it is reported
+		output.flush();
+		throw;
+	}
+}
@@ -0,0 +1,912 @@
+#include "vm.h"
+
+#ifdef VM_JIT
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#ifndef _MSC_VER
+#include <cpuid.h>
+#endif
+
+using vm::executor::Jit;
+using vm::executor::ExecutorException;
+
+namespace {
+	// x86 register numbers, as used in ModRM fields
+	constexpr int EAX = 0;
+	constexpr int ECX = 1;
+	constexpr int EDX = 2;
+	constexpr int EBX = 3;
+
+	// Condition codes (the low nibble of SETcc and Jcc)
+	constexpr unsigned char CC_E = 0x4;
+	constexpr unsigned char CC_NE = 0x5;
+	constexpr unsigned char CC_L = 0xc;
+	constexpr unsigned char CC_GE = 0xd;
+	constexpr unsigned char CC_LE = 0xe;
+	constexpr unsigned char CC_G = 0xf;
+
+	// Indexed by opcode - I_CMP_EQ (and the same order for C_CMP_* and the fused compare-and-branches)
+	constexpr unsigned char compareCodes[] = { CC_E, CC_NE, CC_G, CC_L, CC_GE, CC_LE };
+
+	// Upper bound on the native code for any one decoded instruction
+	constexpr size_t MAX_INSTR_SIZE = 128;
+
+	constexpr vm::types::word_t regDisp(const int& r) {
+		return static_cast<vm::types::word_t>(r * sizeof(vm::executor::Value));
+	}
+
+	// The vector registers are straight after the others, so rbx reaches them too
+	constexpr vm::types::word_t vectorDisp(const int& v) {
+		return regDisp(vm::executor::NUM_REGISTERS) + static_cast<vm::types::word_t>(v * sizeof(vm::executor::Vector));
+	}
+
+	// pmulld only came with SSE4.1, so V_MUL goes through callback() on anything older
+	bool hasSse41() {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 19)) != 0;
+#else
+		unsigned int eax, ebx, ecx, edx;
+		return __get_cpuid(1, &eax, &ebx, &ecx, &edx) != 0 && (ecx & (1u << 19)) != 0;
+#endif
+	}
+
+	const bool HAS_SSE41 = hasSse41();
+}
+
+vm::executor::Jit::Jit(Context& contextIn) :
+	context(contextIn),
+	base(contextIn.memory->base),
+	reg(context.reg),
+	arena(context.arena),
+	output(context.output),
+	streamIn(nullptr),
+	size(0),
+	table(context.decoded->programLength(), nullptr),
+	hasSafepoints(context.budget != 0 || context.sampleInterval != 0),
+	countdownLeft(0) {
+	// Every byte offset starts at most one run and has at most one index, so this can't run out
+	capacity = (2 * table.size() + 8) * MAX_INSTR_SIZE + 0x1000;
+#ifdef _WIN32
+	code = static_cast<unsigned char*>(VirtualAlloc(nullptr, capacity, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE));
+#else
+	void* mem = mmap(nullptr, capacity, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	code = mem == MAP_FAILED ? nullptr : static_cast<unsigned char*>(mem);
+#endif
+	if (code == nullptr) throw ExecutorException(ExecutorException::BAD_ALLOC, 0, "Could not allocate memory for the JIT");
+
+	// Entry(jit, reg, table, target): save the registers we use, keep the arguments in them, and jump to target
+	emit(0x53);// push rbx
+	emit(0x41); emit(0x54);// push r12
+	emit(0x41); emit(0x55);// push r13
+	emit(0x41); emit(0x56);// push r14
+	emit(0x41); emit(0x57);// push r15
+	emit(0x48); emit(0x83); emit(0xec); emit(0x20);// sub rsp, 32 (shadow space for callbacks on Windows, and keeps rsp 16-byte aligned)
+	emit(0x48); emit(0xb8); emit64(reinterpret_cast<unsigned long long>(&countdownLeft));// mov rax, &countdownLeft
+	emit(0x4c); emit(0x8b); emit(0x30);// mov r14, [rax]
+	emit(0x49); emit(0xbf); emit64(reinterpret_cast<unsigned long long>(base));// mov r15, base
+#ifdef _WIN32
+	emit(0x49); emit(0x89); emit(0xcc);// mov r12, rcx
+	emit(0x48); emit(0x89); emit(0xd3);// mov rbx, rdx
+	emit(0x4d); emit(0x89); emit(0xc5);// mov r13, r8
+	emit(0x41); emit(0xff); emit(0xe1);// jmp r9
+#else
+	emit(0x49); emit(0x89); emit(0xfc);// mov r12, rdi
+	emit(0x48); emit(0x89); emit(0xf3);// mov rbx, rsi
+	emit(0x49); emit(0x89); emit(0xd5);// mov r13, rdx
+	emit(0xff); emit(0xe1);// jmp rcx
+#endif
+
+	// Return (edx << 32) | eax
+	exitCode = size;
+	emit(0x48); emit(0xb9); emit64(reinterpret_cast<unsigned long long>(&countdownLeft));// mov rcx, &countdownLeft
+	emit(0x4c); emit(0x89); emit(0x31);// mov [rcx], r14
+	emit(0x89); emit(0xc0);// mov eax, eax
+	emit(0x48); emit(0xc1); emit(0xe2); emit(0x20);// shl rdx, 32
+	emit(0x48); emit(0x09); emit(0xd0);// or rax, rdx
+	emit(0x48); emit(0x83); emit(0xc4); emit(0x20);// add rsp, 32
+	emit(0x41); emit(0x5f);// pop r15
+	emit(0x41); emit(0x5e);// pop r14
+	emit(0x41); emit(0x5d);// pop r13
+	emit(0x41); emit(0x5c);// pop r12
+	emit(0x5b);// pop rbx
+	emit(0xc3);// ret
+
+	resolveCode = size;
+	emit(0x89); emit(0xc2);// mov edx, eax
+	emit(0xb8); emit32(EXIT_RESOLVE);// mov eax, EXIT_RESOLVE
+	emitJumpTo({ 0xe9 }, exitCode);
+
+	preemptCode = size;
+	emit(0x89); emit(0xc2);// mov edx, eax
+	emit(0xb8); emit32(EXIT_PREEMPT);// mov eax, EXIT_PREEMPT
+	emitJumpTo({ 0xe9 }, exitCode);
+
+	for (const void*& target : table) target = code + resolveCode;
+}
+
+vm::executor::Jit::~Jit() {
+#ifdef _WIN32
+	VirtualFree(code, 0, MEM_RELEASE);
+#else
+	munmap(code, capacity);
+#endif
+}
+
+vm::executor::Jit& vm::executor::Jit::of(Context& context) {
+	// Whether there are safepoints is compiled in
+	const bool hasSafepoints = context.budget != 0 || context.sampleInterval != 0;
+	if (!context.jit || context.jit->hasSafepoints != hasSafepoints) context.jit.reset(new Jit(context));
+	return *context.jit;
+}
+
+vm::executor::RunResult vm::executor::Jit::run(const int& entry, Countdown& countdown, std::istream& streamInIn) {
+	streamIn = &streamInIn;
+	countdownLeft = countdown.left;
+	compile();
+	const void* target = code + native[entry];
+
+	while (true) {
+		const unsigned long long result = reinterpret_cast<Entry>(code)(this, reg, table.data(), target);
+		const types::word_t value = static_cast<types::word_t>(result >> 32);
+
+		switch (static_cast<Status>(result & 0xffffffff)) {
+			case EXIT_HALT:
+				return RUN_HALTED;
+
+			case EXIT_WAIT:
+				context.entry = value;
+				return RUN_WAITING;
+
+			case EXIT_PREEMPT:
+			case EXIT_PREEMPT_RETURN: {
+				// Either the budget ran out, or it's time for a sample and the native code carries on straight after
+				const bool isReturn = static_cast<Status>(result & 0xffffffff) == EXIT_PREEMPT_RETURN;
+				const int index = isReturn ? value : context.resolve(value);
+				if (countdown.reached(context, index)) {
+					if (isReturn) {
+						// Returns before stopping, like the interpreter
+						reg[register_::BP].word = *at<types::word_t>(base, reg[register_::BP].word);
+						context.entry = context.resolve(*--context.calls.top);
+					} else {
+						context.entry = index;
+					}
+					return RUN_PREEMPTED;
+				}
+				countdownLeft = countdown.left;
+				// Carrying on with the RET counts it down again, on top of the count that stopped there
+				if (isReturn) countdownLeft++;
+				compile();
+				target = code + native[index];
+				break;
+			}
+
+			case EXIT_RESOLVE: {
+				const int index = context.resolve(value);
+				compile();
+				target = code + native[index];
+				if (value >= 0 && value < static_cast<types::word_t>(table.size())) table[value] = target;
+				break;
+			}
+
+			case EXIT_DIVIDE_BY_ZERO:
+				throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, context.decoded->offsets[value]);
+
+			case EXIT_CALL_STACK:
+				throw ExecutorException(context.decoded->instrs[value].opcode == opcode::CALL ? ExecutorException::CALL_STACK_OVERFLOW : ExecutorException::RETURN_WITHOUT_CALL, context.decoded->offsets[value]);
+
+			case EXIT_UNKNOWN_OPCODE: {
+				const Instr& instr = context.decoded->instrs[value];
+				throw ExecutorException(instr.opcode == opcode::INVALID ? static_cast<ExecutorException::ErrorType>(instr.imm) : ExecutorException::UNKNOWN_OPCODE, context.decoded->offsets[value]);
+			}
+
+			case EXIT_EXCEPTION:
+				std::rethrow_exception(error);
+		}
+	}
+}
+
+// Compiles everything decoded since the last call
+void vm::executor::Jit::compile() {
+	for (int i = static_cast<int>(native.size()); i < static_cast<int>(context.decoded->instrs.size()); i++) {
+		if (size + MAX_INSTR_SIZE > capacity) throw ExecutorException(ExecutorException::BAD_ALLOC, context.decoded->offsets[i], "JIT code buffer is full");
+		native.push_back(size);
+		compileInstr(i, context.decoded->instrs[i]);
+	}
+
+	for (const Fixup& fixup : fixups) {
+		const types::word_t rel = static_cast<types::word_t>(native[fixup.target] - (fixup.at + 4));
+		std::memcpy(code + fixup.at, &rel, sizeof(rel));
+	}
+	fixups.clear();
+}
+
+void vm::executor::Jit::compileInstr(const int& index, const Instr& instr) {
+	using namespace opcode;
+
+	// Flagless forms compile just like the opcode they're named after, without setting FZ
+	const int opcode = withFlag(instr.opcode);
+	const bool setsFlag = opcode == instr.opcode;
+	switch (opcode) {
+		case NOP:
+		case FZ_SPILL:
+		case FZ_FILL:
+			// Compiled code always keeps FZ in the register file
+			break;
+
+		case HALT:
+			emitExit(EXIT_HALT, index);
+			break;
+
+		case BREAK:
+		case ALLOC:
+		case FREE:
+		case PUSH_SCOPE:
+		case POP_SCOPE:
+		case SNAPSHOT:
+		case R_PRNT_W:
+		case PRNT_LN:
+		case PRNT_C:
+		case PRNT_STR:
+		case READ_STR:
+		case READ_STR_N:
+		case MEMCPY:
+		case MEMSET:
+		case MEMCMP:
+		case MEMCHR:
+		case STRLEN:
+			emitCallback(index);
+			break;
+
+		// Vector registers go through xmm0 and xmm1, which native code doesn't keep anything in
+		case V_LOAD:
+			emitReg({ 0x8b }, EAX, instr.r2);
+			emitData({ 0xf3, 0x0f, 0x6f }, 0, EAX, instr.imm);// movdqu xmm0
+			emitVector({ 0x66, 0x0f, 0x7f }, 0, instr.r1);// movdqa
+			break;
+
+		case V_STORE:
+			emitVector({ 0x66, 0x0f, 0x6f }, 0, instr.r2);
+			emitReg({ 0x8b }, EAX, instr.r1);
+			emitData({ 0xf3, 0x0f, 0x7f }, 0, EAX, instr.imm);// movdqu [address], xmm0
+			break;
+
+		case V_SPLAT:
+			emitReg({ 0x66, 0x0f, 0x6e }, 0, instr.r2);// movd xmm0
+			emit(0x66); emit(0x0f); emit(0x70); emit(0xc0); emit(0x00);// pshufd xmm0, xmm0, 0
+			emitVector({ 0x66, 0x0f, 0x7f }, 0, instr.r1);
+			break;
+
+		case V_ADD:
+		case V_SUB:
+		case V_MUL:
+		case V_CMP_EQ:
+		case V_CMP_GT:
+			if (opcode == V_MUL && !HAS_SSE41) {
+				emitCallback(index);
+				break;
+			}
+			emitVector({ 0x66, 0x0f, 0x6f }, 0, instr.r2);
+			switch (opcode) {
+				case V_ADD: emitVector({ 0x66, 0x0f, 0xfe }, 0, instr.r3); break;// paddd
+				case V_SUB: emitVector({ 0x66, 0x0f, 0xfa }, 0, instr.r3); break;// psubd
+				case V_MUL: emitVector({ 0x66, 0x0f, 0x38, 0x40 }, 0, instr.r3); break;// pmulld
+				case V_CMP_EQ: emitVector({ 0x66, 0x0f, 0x76 }, 0, instr.r3); break;// pcmpeqd
+				case V_CMP_GT: emitVector({ 0x66, 0x0f, 0x66 }, 0, instr.r3); break;// pcmpgtd
+			}
+			emitVector({ 0x66, 0x0f, 0x7f }, 0, instr.r1);
+			break;
+
+		case V_SUM:
+			// Adds the top half onto the bottom, then the second lane onto the first
+			emitVector({ 0x66, 0x0f, 0x6f }, 0, instr.r2);
+			emit(0x66); emit(0x0f); emit(0x70); emit(0xc8); emit(0x4e);// pshufd xmm1, xmm0, 0x4e
+			emit(0x66); emit(0x0f); emit(0xfe); emit(0xc1);// paddd xmm0, xmm1
+			emit(0x66); emit(0x0f); emit(0x70); emit(0xc8); emit(0xb1);// pshufd xmm1, xmm0, 0xb1
+			emit(0x66); emit(0x0f); emit(0xfe); emit(0xc1);
+			emitReg({ 0x66, 0x0f, 0x7e }, 0, instr.r1);// movd [reg], xmm0
+			break;
+
+		case CALL: {
+			emitCallStackTop();
+			emit(0x48); emit(0xba); emit64(reinterpret_cast<unsigned long long>(context.calls.end));// mov rdx, end
+			emit(0x48); emit(0x39); emit(0xd1);// cmp rcx, rdx
+			const size_t ok = emitJump8(0x72);// jb
+			emitExit(EXIT_CALL_STACK, index);
+			patchJump8(ok);
+			emit(0xc7); emit(0x01); emit32(context.decoded->offsets[index + 1]);// mov dword [rcx], return location
+			emit(0x48); emit(0x83); emit(0xc1); emit(sizeof(types::word_t));// add rcx, 4
+			emit(0x48); emit(0x89); emit(0x08);// mov [rax], rcx
+
+			// The new frame starts with the BP that RET goes back to
+			emitReg({ 0x8b }, ECX, register_::BP);
+			emitReg({ 0x8b }, EAX, register_::BP);
+			emitData({ 0x89 }, ECX, EAX, instr.frameSize());
+			emitReg({ 0x81 }, 0, register_::BP);
+			emit32(instr.frameSize());
+			emitJump({ 0xe9 }, instr.imm);
+			break;
+		}
+
+		case RET: {
+			emitCallStackTop();
+			emit(0x48); emit(0xba); emit64(reinterpret_cast<unsigned long long>(context.calls.start));// mov rdx, start
+			emit(0x48); emit(0x39); emit(0xd1);// cmp rcx, rdx
+			const size_t ok = emitJump8(0x77);// ja
+			emitExit(EXIT_CALL_STACK, index);
+			patchJump8(ok);
+			if (hasSafepoints) {
+				// Counted before the pop, like the interpreter's RET
+				emit(0x49); emit(0xff); emit(0xce);// dec r14
+				const size_t counted = emitJump8(0x75);// jnz
+				emitExit(EXIT_PREEMPT_RETURN, index);
+				patchJump8(counted);
+			}
+			emit(0x48); emit(0x83); emit(0xe9); emit(sizeof(types::word_t));// sub rcx, 4
+			emit(0x48); emit(0x89); emit(0x08);// mov [rax], rcx
+
+			emitReg({ 0x8b }, EDX, register_::BP);
+			emitData({ 0x8b }, EDX, EDX, 0);
+			emitReg({ 0x89 }, EDX, register_::BP);
+			emit(0x8b); emit(0x01);// mov eax, [rcx]
+			emitDynamicJump(false);
+			break;
+		}
+
+		case MOV:
+			emitReg({ 0x8b }, EAX, instr.r2);
+			emitReg({ 0x89 }, EAX, instr.r1);
+			break;
+
+		case MOV_W:
+			emitReg({ 0xc7 }, 0, instr.r1);
+			emit32(instr.imm);
+			break;
+
+		case MOV_B:
+			emitReg({ 0xc7 }, 0, instr.r1);
+			emit32(static_cast<types::byte_t>(instr.imm));
+			break;
+
+		case MOV_S:
+			emitReg({ 0xc7 }, 0, instr.r1);
+			emit32(static_cast<types::short_t>(instr.imm));
+			break;
+
+		case LOAD_W:
+		case LOAD_W_BP:
+		case LOAD_W_BP_R_JMP:
+			emitReg({ 0x8b }, EAX, opcode == LOAD_W ? instr.r2 : static_cast<types::reg_t>(register_::BP));
+			emitData({ 0x8b }, EAX, EAX, instr.imm);
+			emitReg({ 0x89 }, EAX, instr.r1);
+			if (opcode == LOAD_W_BP_R_JMP) emitDynamicJump(true);
+			break;
+
+		case STORE_W:
+		case STORE_W_BP:
+			emitReg({ 0x8b }, EAX, opcode == STORE_W ? instr.r1 : static_cast<types::reg_t>(register_::BP));
+			emitReg({ 0x8b }, ECX, opcode == STORE_W ? instr.r2 : instr.r1);
+			emitData({ 0x89 }, ECX, EAX, instr.imm);
+			break;
+
+		case LOAD_B:
+			emitReg({ 0x8b }, EAX, instr.r2);
+			emitData({ 0x0f, 0xbe }, ECX, EAX, instr.imm);// movsx ecx, byte
+			emitReg({ 0x89 }, ECX, instr.r1);
+			break;
+
+		case STORE_B:
+			emitReg({ 0x8b }, EAX, instr.r1);
+			emitReg({ 0x8a }, ECX, instr.r2);
+			emitData({ 0x88 }, ECX, EAX, instr.imm);
+			break;
+
+		case LOAD_S:
+			emitReg({ 0x8b }, EAX, instr.r2);
+			emitData({ 0x0f, 0xbf }, ECX, EAX, instr.imm);// movsx ecx, word
+			emitReg({ 0x89 }, ECX, instr.r1);
+			break;
+
+		case STORE_S:
+			emitReg({ 0x8b }, EAX, instr.r1);
+			emitReg({ 0x66, 0x8b }, ECX, instr.r2);
+			emitData({ 0x66, 0x89 }, ECX, EAX, instr.imm);
+			break;
+
+		case JMP:
+			emitJump({ 0xe9 }, instr.imm);
+			break;
+
+		case JMP_Z:
+		case JMP_NZ:
+			// Same as the interpreter: JMP_Z jumps when FZ is zero
+			emitReg({ 0x80 }, 7, register_::FZ);
+			emit(0);
+			emitJump({ 0x0f, static_cast<unsigned char>(0x80 | (opcode == JMP_Z ? CC_E : CC_NE)) }, instr.imm);
+			break;
+
+		case R_JMP:
+			emitReg({ 0x8b }, EAX, instr.r1);
+			emitDynamicJump(true);
+			break;
+
+		case R_JMP_Z:
+		case R_JMP_NZ: {
+			// Same as the interpreter: R_JMP_Z jumps when FZ is non-zero
+			emitReg({ 0x80 }, 7, register_::FZ);
+			emit(0);
+			const size_t skip = emitJump8(opcode == R_JMP_Z ? 0x74 : 0x75);
+			emitReg({ 0x8b }, EAX, instr.r1);
+			emitDynamicJump(true);
+			patchJump8(skip);
+			break;
+		}
+
+		case I_FLAG:
+			emitReg({ 0x83 }, 7, instr.r1);
+			emit(0);
+			emitSetFlag(CC_NE);
+			break;
+
+		case I_CMP_EQ:
+		case I_CMP_NE:
+		case I_CMP_GT:
+		case I_CMP_LT:
+		case I_CMP_GE:
+		case I_CMP_LE:
+			emitReg({ 0x8b }, EAX, instr.r1);
+			emitReg({ 0x3b }, EAX, instr.r2);
+			emitSetFlag(compareCodes[opcode - I_CMP_EQ]);
+			break;
+
+		case I_INC:
+		case I_DEC:
+			emitReg({ 0xff }, opcode == I_INC ? 0 : 1, instr.r1);
+			if (setsFlag) emitSetFlag(CC_NE);
+			break;
+
+		case I_ADD:
+		case I_SUB:
+		case I_MUL:
+			emitReg({ 0x8b }, EAX, instr.r2);
+			if (opcode == I_ADD) emitReg({ 0x03 }, EAX, instr.r3);
+			if (opcode == I_SUB) emitReg({ 0x2b }, EAX, instr.r3);
+			if (opcode == I_MUL) emitReg({ 0x0f, 0xaf }, EAX, instr.r3);
+			emitReg({ 0x89 }, EAX, instr.r1);
+			if (setsFlag) {
+				emit(0x85); emit(0xc0);// test eax, eax
+				emitSetFlag(CC_NE);
+			}
+			break;
+
+		case I_DIV:
+		case I_MOD: {
+			emitReg({ 0x8b }, ECX, instr.r3);
+			emit(0x85); emit(0xc9);// test ecx, ecx
+			const size_t ok = emitJump8(0x75);
+			emitExit(EXIT_DIVIDE_BY_ZERO, index);
+			patchJump8(ok);
+			emitReg({ 0x8b }, EAX, instr.r2);
+			emit(0x99);// cdq
+			emit(0xf7); emit(0xf9);// idiv ecx
+			const int result = opcode == I_DIV ? EAX : EDX;
+			emitReg({ 0x89 }, result, instr.r1);
+			if (setsFlag) {
+				emit(0x85); emit(static_cast<unsigned char>(0xc0 | result << 3 | result));// test result, result
+				emitSetFlag(CC_NE);
+			}
+			break;
+		}
+
+		case I_TO_C:
+			emitReg({ 0x0f, 0xbe }, EAX, instr.r2);
+			emitReg({ 0x89 }, EAX, instr.r1);
+			break;
+
+		case C_FLAG:
+			emitReg({ 0x80 }, 7, instr.r1);
+			emit(0);
+			emitSetFlag(CC_NE);
+			break;
+
+		case C_CMP_EQ:
+		case C_CMP_NE:
+		case C_CMP_GT:
+		case C_CMP_LT:
+		case C_CMP_GE:
+		case C_CMP_LE:
+			emitReg({ 0x8a }, EAX, instr.r1);
+			emitReg({ 0x3a }, EAX, instr.r2);
+			emitSetFlag(compareCodes[opcode - C_CMP_EQ]);
+			break;
+
+		case C_INC:
+		case C_DEC:
+			emitReg({ 0xfe }, opcode == C_INC ? 0 : 1, instr.r1);
+			if (setsFlag) emitSetFlag(CC_NE);
+			// Then sign-extend the byte over the rest of the register
+			emitReg({ 0x0f, 0xbe }, EAX, instr.r1);
+			emitReg({ 0x89 }, EAX, instr.r1);
+			break;
+
+		case C_ADD:
+		case C_SUB:
+		case C_MUL:
+			emitReg({ 0x8a }, EAX, instr.r2);
+			if (opcode == C_ADD) emitReg({ 0x02 }, EAX, instr.r3);
+			if (opcode == C_SUB) emitReg({ 0x2a }, EAX, instr.r3);
+			if (opcode == C_MUL) emitReg({ 0xf6 }, 5, instr.r3);// imul byte (al *= r3)
+			emit(0x0f); emit(0xbe); emit(0xc0);// movsx eax, al
+			emitReg({ 0x89 }, EAX, instr.r1);
+			if (setsFlag) {
+				emit(0x85); emit(0xc0);// test eax, eax
+				emitSetFlag(CC_NE);
+			}
+			break;
+
+		case C_DIV:
+		case C_MOD: {
+			// Promoted to int like the interpreter, so -128 / -1 doesn't trap
+			emitReg({ 0x0f, 0xbe }, ECX, instr.r3);
+			emit(0x85); emit(0xc9);// test ecx, ecx
+			const size_t ok = emitJump8(0x75);
+			emitExit(EXIT_DIVIDE_BY_ZERO, index);
+			patchJump8(ok);
+			emitReg({ 0x0f, 0xbe }, EAX, instr.r2);
+			emit(0x99);// cdq
+			emit(0xf7); emit(0xf9);// idiv ecx
+			const int result = opcode == C_DIV ? EAX : EDX;
+			emit(0x0f); emit(0xbe); emit(static_cast<unsigned char>(0xc0 | result << 3 | result));// movsx result, result (low byte)
+			emitReg({ 0x89 }, result, instr.r1);
+			if (setsFlag) {
+				emit(0x85); emit(static_cast<unsigned char>(0xc0 | result << 3 | result));// test result, result
+				emitSetFlag(CC_NE);
+			}
+			break;
+		}
+
+		case C_TO_I:
+			emitReg({ 0x0f, 0xbe }, EAX, instr.r2);
+			emitReg({ 0x89 }, EAX, instr.r1);
+			break;
+
+		case I_CMP_EQ_JZ:
+		case I_CMP_EQ_JNZ:
+		case I_CMP_NE_JZ:
+		case I_CMP_NE_JNZ:
+		case I_CMP_GT_JZ:
+		case I_CMP_GT_JNZ:
+		case I_CMP_LT_JZ:
+		case I_CMP_LT_JNZ:
+		case I_CMP_GE_JZ:
+		case I_CMP_GE_JNZ:
+		case I_CMP_LE_JZ:
+		case I_CMP_LE_JNZ: {
+			const unsigned char cc = compareCodes[(opcode - I_CMP_EQ_JZ) / 2];
+			const bool jumpIfTrue = (opcode - I_CMP_EQ_JZ) % 2 == 1;
+			emitReg({ 0x8b }, EAX, instr.r1);
+			emitReg({ 0x3b }, EAX, instr.r2);
+			emitSetFlag(cc);
+			// Flipping the lowest bit of a condition code negates it
+			emitJump({ 0x0f, static_cast<unsigned char>(0x80 | (jumpIfTrue ? cc : cc ^ 1)) }, instr.imm);
+			break;
+		}
+
+		case I_DEC_JNZ:
+			emitReg({ 0xff }, 1, instr.r1);
+			emitSetFlag(CC_NE);
+			emitJump({ 0x0f, 0x80 | CC_NE }, instr.imm);
+			break;
+
+		case C_FLAG_JZ:
+		case C_FLAG_JNZ:
+			emitReg({ 0x80 }, 7, instr.r1);
+			emit(0);
+			emitSetFlag(CC_NE);
+			emitJump({ 0x0f, static_cast<unsigned char>(0x80 | (opcode == C_FLAG_JZ ? CC_E : CC_NE)) }, instr.imm);
+			break;
+
+		case I_ADD_IMM:
+		case I_SUB_IMM:
+			emitReg({ 0xc7 }, 0, instr.r3);
+			emit32(instr.imm);
+			emitReg({ 0x8b }, EAX, instr.r2);
+			emit(opcode == I_ADD_IMM ? 0x05 : 0x2d);// add/sub eax, imm32
+			emit32(instr.imm);
+			emitReg({ 0x89 }, EAX, instr.r1);
+			if (setsFlag) {
+				emit(0x85); emit(0xc0);// test eax, eax
+				emitSetFlag(CC_NE);
+			}
+			break;
+
+		default:
+			emitExit(EXIT_UNKNOWN_OPCODE, index);
+			break;
+	}
+}
+
+// Runs the instructions that aren't worth compiling, returning 0 to carry on or the Status to exit with
+int vm::executor::Jit::callback(Jit* jit, int index) {
+	using namespace opcode;
+	using namespace types;
+
+	const Instr& instr = jit->context.decoded->instrs[index];
+	Value* const reg = jit->reg;
+	char* const base = jit->base;
+
+	try {
+		switch (instr.opcode) {
+			case BREAK:
+				jit->output.flush();
+				if (jit->context.isAsync) {
+					if (!jit->context.input.skipLine()) return EXIT_WAIT;
+				} else {
+					while (jit->streamIn->get() != '\n');
+				}
+				break;
+
+			case ALLOC:
+				try {
+					reg[instr.r1].word = addressOf(base, jit->arena.alloc(reg[instr.r2].word));
+				} catch (std::bad_alloc& e) {
+					throw ExecutorException(ExecutorException::BAD_ALLOC, jit->context.decoded->offsets[index], e.what());
+				}
+				break;
+
+			case FREE:
+				if (reg[instr.r1].word != 0) jit->arena.free(at<char>(base, reg[instr.r1].word));
+				break;
+
+			case PUSH_SCOPE:
+				jit->arena.push();
+				break;
+
+			case POP_SCOPE:
+				jit->arena.pop();
+				break;
+
+			case SNAPSHOT:
+				if (jit->context.snapshotPath != nullptr && !jit->context.snapshot(jit->context.snapshotPath, jit->context.decoded->offsets[index + 1])) {
+					jit->output.writeString(IO_WARN "Could not write the snapshot" IO_NORM "\n");
+				}
+				break;
+
+			case R_PRNT_W:
+				jit->output.writeWord(reg[instr.r1].word);
+				break;
+
+			case PRNT_LN:
+				jit->output.put('\n');
+				break;
+
+			case PRNT_C:
+				jit->output.put(static_cast<char>(reg[instr.r1].char_));
+				break;
+
+			case PRNT_STR:
+				jit->output.writeString(at<char>(base, reg[instr.r1].word + instr.imm));
+				break;
+
+			case READ_STR:
+				jit->output.flush();
+				if (jit->context.isAsync) {
+					if (!jit->context.input.readLine(at<char>(base, reg[instr.r1].word + instr.imm))) return EXIT_WAIT;
+				} else {
+					jit->streamIn->getline(at<char>(base, reg[instr.r1].word + instr.imm), std::numeric_limits<std::streamsize>::max(), '\n');
+				}
+				break;
+
+			case READ_STR_N:
+				jit->output.flush();
+				if (jit->context.isAsync) {
+					if (!jit->context.input.readLine(at<char>(base, reg[instr.r1].word + instr.imm), reg[instr.r2].word, jit->context.decoded->offsets[index])) return EXIT_WAIT;
+				} else {
+					readLine(*jit->streamIn, at<char>(base, reg[instr.r1].word + instr.imm), reg[instr.r2].word, jit->context.decoded->offsets[index]);
+				}
+				break;
+
+			case MEMCPY:
+				bulk::copy(base, reg[instr.r1].word, reg[instr.r2].word, reg[instr.r3].word);
+				break;
+
+			case MEMSET:
+				bulk::fill(base, reg[instr.r1].word, reg[instr.r2].char_, reg[instr.r3].word);
+				break;
+
+			case MEMCMP:
+				reg[instr.r3].word = bulk::compare(base, reg[instr.r1].word, reg[instr.r2].word, reg[instr.r3].word);
+				break;
+
+			case MEMCHR:
+				reg[instr.r1].word = bulk::find(base, reg[instr.r1].word, reg[instr.r2].char_, reg[instr.r3].word);
+				break;
+
+			case STRLEN:
+				reg[instr.r1].word = bulk::length(base, reg[instr.r2].word);
+				break;
+
+			case V_MUL:
+				vector::mul(jit->context.vreg[instr.r1], jit->context.vreg[instr.r2], jit->context.vreg[instr.r3]);
+				break;
+		}
+	} catch (...) {
+		// Can't unwind through the native code, so hand the exception to run()
+		jit->error = std::current_exception();
+		return EXIT_EXCEPTION;
+	}
+
+	return 0;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Encoding
+
+void vm::executor::Jit::emit(const unsigned char& byte) {
+	code[size++] = byte;
+}
+
+void vm::executor::Jit::emit32(const types::word_t& value) {
+	std::memcpy(code + size, &value, sizeof(value));
+	size += sizeof(value);
+}
+
+void vm::executor::Jit::emit64(const unsigned long long& value) {
+	std::memcpy(code + size, &value, sizeof(value));
+	size += sizeof(value);
+}
+
+// op followed by a ModRM (and displacement) for [base + disp]. base must be EAX or EBX, which don't need a SIB byte
+void vm::executor::Jit::emitMem(const std::initializer_list<unsigned char>& op, const int& regField, const int& base, const types::word_t& disp) {
+	for (const unsigned char& byte : op) emit(byte);
+	if (disp >= -128 && disp <= 127) {
+		emit(static_cast<unsigned char>(0x40 | regField << 3 | base));
+		emit(static_cast<unsigned char>(disp));
+	} else {
+		emit(static_cast<unsigned char>(0x80 | regField << 3 | base));
+		emit32(disp);
+	}
+}
+
+// op on [r15 + address + disp], where address (EAX or EDX) holds an address in the program's Memory. Like the
+// interpreter, address + disp wraps around at 32 bits, which the add does (zero-extending it as well).
+void vm::executor::Jit::emitData(const std::initializer_list<unsigned char>& op, const int& regField, const int& address, const types::word_t& disp) {
+	if (disp != 0) {
+		emit(0x81); emit(static_cast<unsigned char>(0xc0 | address)); emit32(disp);// add address, disp
+	}
+	// REX.B (for r15) has to go after any legacy prefixes
+	const unsigned char* byte = op.begin();
+	for (; byte != op.end() && (*byte == 0x66 || *byte == 0xf2 || *byte == 0xf3); byte++) emit(*byte);
+	emit(0x41);
+	for (; byte != op.end(); byte++) emit(*byte);
+	emit(static_cast<unsigned char>(0x04 | regField << 3));// ModRM with a SIB byte
+	emit(static_cast<unsigned char>(address << 3 | 0x07));// SIB: [r15 + address]
+}
+
+// op on VM register r
+void vm::executor::Jit::emitReg(const std::initializer_list<unsigned char>& op, const int& regField, const types::reg_t& r) {
+	emitMem(op, regField, EBX, regDisp(r));
+}
+
+// op on vector register v (which is 16-byte aligned, for movdqa)
+void vm::executor::Jit::emitVector(const std::initializer_list<unsigned char>& op, const int& regField, const types::reg_t& v) {
+	emitMem(op, regField, EBX, vectorDisp(v));
+}
+
+// op followed by a rel32 to the native code of decoded instruction target
+void vm::executor::Jit::emitJump(const std::initializer_list<unsigned char>& op, const int& target) {
+	// Backward jumps are safepoints when there's a budget or samples (the instruction being compiled is the last in native)
+	if (hasSafepoints && target < static_cast<int>(native.size())) {
+		if (op.size() == 1) {
+			emitSafepoint(target);
+		} else {
+			// jcc rel32 becomes j!cc over the safepoint
+			const size_t skip = emitJump8(static_cast<unsigned char>(0x70 | ((op.begin()[1] & 0x0f) ^ 1)));
+			emitSafepoint(target);
+			patchJump8(skip);
+		}
+		return;
+	}
+
+	for (const unsigned char& byte : op) emit(byte);
+	fixups.push_back({ size, target });
+	emit32(0);
+}
+
+// Counts down, then jumps to target, or leaves the native code there once the countdown reaches 0
+void vm::executor::Jit::emitSafepoint(const int& target) {
+	emit(0x49); emit(0xff); emit(0xce);// dec r14
+	emit(0x0f); emit(0x85);// jnz target
+	fixups.push_back({ size, target });
+	emit32(0);
+	emit(0xb8); emit32(context.decoded->offsets[target]);// mov eax, offset
+	emitJumpTo({ 0xe9 }, preemptCode);
+}
+
+// op followed by a rel32 to a fixed position in the code
+void vm::executor::Jit::emitJumpTo(const std::initializer_list<unsigned char>& op, const size_t& to) {
+	for (const unsigned char& byte : op) emit(byte);
+	emit32(static_cast<types::word_t>(to - (size + 4)));
+}
+
+// Short forward jump, to be pointed at the current position later with patchJump8
+size_t vm::executor::Jit::emitJump8(const unsigned char& op) {
+	emit(op);
+	emit(0);
+	return size - 1;
+}
+
+void vm::executor::Jit::patchJump8(const size_t& at) {
+	code[at] = static_cast<unsigned char>(size - (at + 1));
+}
+
+// FZ = cc ? 1 : 0
+void vm::executor::Jit::emitSetFlag(const unsigned char& cc) {
+	emitReg({ 0x0f, static_cast<unsigned char>(0x90 | cc) }, 0, register_::FZ);
+}
+
+void vm::executor::Jit::emitExit(const Status& status, const int& index) {
+	emit(0xba); emit32(index);// mov edx, index
+	emit(0xb8); emit32(status);// mov eax, status
+	emitJumpTo({ 0xe9 }, exitCode);
+}
+
+void vm::executor::Jit::emitCallback(const int& index) {
+#ifdef _WIN32
+	emit(0x4c); emit(0x89); emit(0xe1);// mov rcx, r12
+	emit(0xba); emit32(index);// mov edx, index
+#else
+	emit(0x4c); emit(0x89); emit(0xe7);// mov rdi, r12
+	emit(0xbe); emit32(index);// mov esi, index
+#endif
+	emit(0x48); emit(0xb8); emit64(reinterpret_cast<unsigned long long>(&Jit::callback));// mov rax, callback
+	emit(0xff); emit(0xd0);// call rax
+
+	emit(0x85); emit(0xc0);// test eax, eax
+	const size_t ok = emitJump8(0x74);
+	emit(0xba); emit32(index);// mov edx, index
+	emitJumpTo({ 0xe9 }, exitCode);
+	patchJump8(ok);
+}
+
+// rax = &calls.top, rcx = calls.top (the CallStack stays put for as long as the Jit does)
+void vm::executor::Jit::emitCallStackTop() {
+	emit(0x48); emit(0xb8); emit64(reinterpret_cast<unsigned long long>(&context.calls.top));// mov rax, &top
+	emit(0x48); emit(0x8b); emit(0x08);// mov rcx, [rax]
+}
+
+// Jumps to the byte offset in eax, through the table in r13 (counting down first, unless a RET already has)
+void vm::executor::Jit::emitDynamicJump(const bool& isCounted) {
+	if (hasSafepoints && isCounted) {
+		emit(0x49); emit(0xff); emit(0xce);// dec r14
+		emitJumpTo({ 0x0f, 0x84 }, preemptCode);// jz preempt
+	}
+	emit(0x3d); emit32(static_cast<types::word_t>(table.size()));// cmp eax, length
+	emitJumpTo({ 0x0f, 0x83 }, resolveCode);// jae resolve (resolve() sends anything out of range to the HALT)
+	emit(0x41); emit(0xff); emit(0x64); emit(0xc5); emit(0x00);// jmp [r13 + rax * 8]
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int vm::executor::runJit(Context& context, ExecutorSettings& execSettings, std::ostream& streamOut, std::istream& streamIn) {
+	Countdown countdown(context);
+	const RunResult result = Jit::of(context).run(context.entry, countdown, streamIn);
+
+	context.output.flush();
+	if (result != RUN_HALTED) return result;
+	context.arena.release();
+	writeSamples(context, execSettings, streamOut);
+	streamOut << IO_END;
+
+	return 0;
+}
+
+#endif
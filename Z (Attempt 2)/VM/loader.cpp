@@ -0,0 +1,153 @@
+#include "vm.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+vm::executor::Program::Program(const char* const& path) : base(nullptr), size(0), mappedSize(0) {
+#ifdef _WIN32
+	HANDLE fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileHandle != INVALID_HANDLE_VALUE) {
+		LARGE_INTEGER fileSize;
+		if (GetFileSizeEx(fileHandle, &fileSize) && fileSize.QuadPart > 0) {
+			HANDLE mapping = CreateFileMappingA(fileHandle, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+			if (mapping != nullptr) {
+				// The view keeps the mapping (and the file) open by itself
+				base = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+				if (base != nullptr) mappedSize = static_cast<size_t>(fileSize.QuadPart);
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(fileHandle);
+	}
+#else
+	const int fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		struct stat fileStat;
+		if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) {
+			void* mem = mmap(nullptr, fileStat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if (mem != MAP_FAILED) {
+				base = static_cast<char*>(mem);
+				mappedSize = static_cast<size_t>(fileStat.st_size);
+			}
+		}
+		close(fd);
+	}
+#endif
+
+	if (mappedSize == 0) {
+		// Empty or unmappable: behave as if the file was read in
+		std::fstream file;
+		file.open(path, std::ios::in | std::ios::binary);
+		if (!file.is_open()) throw ExecutorException(ExecutorException::BAD_FORMAT, 0, "The file couldn't be opened");
+		load(file);
+	} else {
+		size = mappedSize;
+	}
+	findImage();
+}
+
+vm::executor::Program::~Program() {
+	release();
+}
+
+void vm::executor::Program::release() {
+	if (mappedSize == 0) {
+		delete[] base;
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(base);
+#else
+	munmap(base, mappedSize);
+#endif
+}
+
+void vm::executor::Program::findImage() {
+	version = 1;
+	bssSize = 0;
+	codeStart = 0;
+	symbols = nullptr;
+	symbolsSize = 0;
+	decodedSection = nullptr;
+	decodedSize = 0;
+
+	start = base;
+	end = start + size;
+
+	if (size < sizeof(format::Header) || std::memcmp(base, format::MAGIC, sizeof(format::MAGIC)) != 0) {
+		// A version 1 file still has to hold the address of its first instruction
+		if (size >= sizeof(types::word_t)) return;
+		release();
+		throw ExecutorException(ExecutorException::BAD_FORMAT, 0, "The file is too short to be a program");
+	}
+
+	const char* const error = parse();
+	if (error != nullptr) {
+		release();
+		throw ExecutorException(ExecutorException::BAD_FORMAT, 0, error);
+	}
+}
+
+const char* vm::executor::Program::parse() {
+	using namespace format;
+
+	Header header;
+	std::memcpy(&header, base, sizeof(header));
+	version = header.version;
+	if (header.version != VERSION) return "Unsupported version (this executor runs versions 1 and 2)";
+	if (header.sectionCount > (size - sizeof(header)) / sizeof(Section)) return "The section table is cut off";
+
+	const Section* data = nullptr;
+	const Section* code = nullptr;
+	std::vector<Section> sections(header.sectionCount);
+	std::memcpy(sections.data(), base + sizeof(header), sections.size() * sizeof(Section));
+	for (const Section& section : sections) {
+		if (section.type != SECTION_BSS && (section.offset > size || section.size > size - section.offset)) return "A section is cut off";
+
+		switch (section.type) {
+			case SECTION_DATA:
+				data = &section;
+				break;
+
+			case SECTION_CODE:
+				code = &section;
+				break;
+
+			case SECTION_BSS:
+				bssSize = static_cast<types::word_t>(section.size);
+				break;
+
+			case SECTION_SYMBOLS:
+				symbols = base + section.offset;
+				symbolsSize = section.size;
+				break;
+
+			case SECTION_DECODED:
+				decodedSection = base + section.offset;
+				decodedSize = section.size;
+				break;
+
+			default: // Sections from newer writers that this doesn't need
+				break;
+		}
+	}
+
+	if (data == nullptr || data->size < sizeof(types::word_t)) return "There is no data section";
+	if (code != nullptr && code->size != 0 && code->offset != data->offset + data->size) return "The code section doesn't follow the data section";
+	if (bssSize < 0) return "The bss section is too big";
+
+	start = base + data->offset;
+	end = start + data->size + (code != nullptr ? code->size : 0);
+	codeStart = static_cast<types::word_t>(data->size);
+	if (static_cast<uint64_t>(end - start) + static_cast<uint32_t>(bssSize) > static_cast<uint64_t>(std::numeric_limits<types::word_t>::max())) return "The image is too big";
+	return nullptr;
+}
@@ -72,6 +72,78 @@ namespace vm {
 			C_MOD,
 			C_TO_I,
 			//
+			PUSH_SCOPE,
+			POP_SCOPE,
+			//
+			SNAPSHOT,
+			//
+			CALL,
+			RET,
+			//
+			MEMCPY,
+			MEMSET,
+			MEMCMP,
+			MEMCHR,
+			STRLEN,
+			//
+			// Vector instructions work on all VECTOR_LANES words of a vector register at once
+			V_LOAD,
+			V_STORE,
+			V_SPLAT,
+			V_ADD,
+			V_SUB,
+			V_MUL,
+			V_CMP_EQ,
+			V_CMP_GT,
+			V_SUM,
+			//
+			// Superinstructions: the decoder fuses common pairs into these, but they can be written directly too.
+			// Each one has exactly the effect of the pair it replaces (including setting FZ and any temporary register).
+			I_CMP_EQ_JZ,	// icmpeq a, b + jmpz L
+			I_CMP_EQ_JNZ,	// icmpeq a, b + jmpnz L
+			I_CMP_NE_JZ,
+			I_CMP_NE_JNZ,
+			I_CMP_GT_JZ,
+			I_CMP_GT_JNZ,
+			I_CMP_LT_JZ,
+			I_CMP_LT_JNZ,
+			I_CMP_GE_JZ,
+			I_CMP_GE_JNZ,
+			I_CMP_LE_JZ,
+			I_CMP_LE_JNZ,
+			I_DEC_JNZ,		// idec a + jmpnz L
+			C_FLAG_JZ,		// cflag a + jmpz L
+			C_FLAG_JNZ,		// cflag a + jmpnz L
+			//
+			I_ADD_IMM,		// movw t, k + iadd d, a, t	(d, a, t, k)
+			I_SUB_IMM,		// movw t, k + isub d, a, t	(d, a, t, k)
+			//
+			LOAD_W_BP,		// loadw d, BP, off
+			STORE_W_BP,		// storew BP, off, s
+			LOAD_W_BP_R_JMP,// loadw t, BP, off + rjmp t
+			//
+			// Flagless forms: the same as the opcode they're named after, but FZ is left alone. The decoder swaps them
+			// in wherever nothing can read FZ before it's set again.
+			I_INC_NF,
+			I_DEC_NF,
+			I_ADD_NF,
+			I_SUB_NF,
+			I_MUL_NF,
+			I_DIV_NF,
+			I_MOD_NF,
+			C_INC_NF,
+			C_DEC_NF,
+			C_ADD_NF,
+			C_SUB_NF,
+			C_MUL_NF,
+			C_DIV_NF,
+			C_MOD_NF,
+			I_ADD_IMM_NF,
+			I_SUB_IMM_NF,
+			//
+			// After everything else, so that no opcode that was already in a .eze file changes its number
+			READ_STR_N,
+			//
 			//
 			//
 			GLOBAL_W,
@@ -79,6 +151,9 @@ namespace vm {
 			GLOBAL_S,
 			GLOBAL_STR,
 
+			// Only ever made by the decoder, around instructions that name FZ (which the interpreter keeps in a local)
+			FZ_SPILL = 253,
+			FZ_FILL = 254,
 			INVALID = 255
 		};
 
@@ -156,6 +231,72 @@ namespace vm {
 			"cmod",
 			"ctoi",
 			//
+			"pushscope",
+			"popscope",
+			//
+			"snapshot",
+			//
+			"call",
+			"ret",
+			//
+			"memcpy",
+			"memset",
+			"memcmp",
+			"memchr",
+			"strlen",
+			//
+			"vload",
+			"vstore",
+			"vsplat",
+			"vadd",
+			"vsub",
+			"vmul",
+			"vcmpeq",
+			"vcmpgt",
+			"vsum",
+			//
+			"icmpeqjz",
+			"icmpeqjnz",
+			"icmpnejz",
+			"icmpnejnz",
+			"icmpgtjz",
+			"icmpgtjnz",
+			"icmpltjz",
+			"icmpltjnz",
+			"icmpgejz",
+			"icmpgejnz",
+			"icmplejz",
+			"icmplejnz",
+			"idecjnz",
+			"cflagjz",
+			"cflagjnz",
+			//
+			"iaddimm",
+			"isubimm",
+			//
+			"loadwbp",
+			"storewbp",
+			"loadwbprjmp",
+			//
+			"iincnf",
+			"idecnf",
+			"iaddnf",
+			"isubnf",
+			"imulnf",
+			"idivnf",
+			"imodnf",
+			"cincnf",
+			"cdecnf",
+			"caddnf",
+			"csubnf",
+			"cmulnf",
+			"cdivnf",
+			"cmodnf",
+			"iaddimmnf",
+			"isubimmnf",
+			//
+			"readstrn",
+			//
 			//
 			//
 			"globalw",
@@ -166,7 +307,7 @@ namespace vm {
 
 		constexpr int count = sizeof(strings) / sizeof(strings[0]);
 
-		constexpr int MAX_ARGS = 3;
+		constexpr int MAX_ARGS = 4;
 		enum class ArgType {
 			ARG_NONE,	// 0
 			ARG_REG,	// 1
@@ -174,7 +315,8 @@ namespace vm {
 			ARG_BYTE,	// 3
 			ARG_SHORT,	// 4
 			ARG_VAR,	// 5 (Only for setting vars, use ARG_WORD for reading them)
-			ARG_STR		// 6
+			ARG_STR,	// 6
+			ARG_VREG	// 7 (A vector register, which goes where a register would in the decoded instruction)
 		};
 		constexpr int args[][MAX_ARGS] = {
 			{0, 0, 0},	// NOP
@@ -248,6 +390,72 @@ namespace vm {
 			{1, 1, 1},	// C_MOD
 			{1, 1, 0},	// C_TO_I
 			//
+			{0, 0, 0},	// PUSH_SCOPE
+			{0, 0, 0},	// POP_SCOPE
+			//
+			{0, 0, 0},	// SNAPSHOT
+			//
+			{2, 4, 0},	// CALL
+			{0, 0, 0},	// RET
+			//
+			{1, 1, 1},	// MEMCPY
+			{1, 1, 1},	// MEMSET
+			{1, 1, 1},	// MEMCMP
+			{1, 1, 1},	// MEMCHR
+			{1, 1, 0},	// STRLEN
+			//
+			{7, 1, 2},	// V_LOAD
+			{1, 2, 7},	// V_STORE
+			{7, 1, 0},	// V_SPLAT
+			{7, 7, 7},	// V_ADD
+			{7, 7, 7},	// V_SUB
+			{7, 7, 7},	// V_MUL
+			{7, 7, 7},	// V_CMP_EQ
+			{7, 7, 7},	// V_CMP_GT
+			{1, 7, 0},	// V_SUM
+			//
+			{1, 1, 2},	// I_CMP_EQ_JZ
+			{1, 1, 2},	// I_CMP_EQ_JNZ
+			{1, 1, 2},	// I_CMP_NE_JZ
+			{1, 1, 2},	// I_CMP_NE_JNZ
+			{1, 1, 2},	// I_CMP_GT_JZ
+			{1, 1, 2},	// I_CMP_GT_JNZ
+			{1, 1, 2},	// I_CMP_LT_JZ
+			{1, 1, 2},	// I_CMP_LT_JNZ
+			{1, 1, 2},	// I_CMP_GE_JZ
+			{1, 1, 2},	// I_CMP_GE_JNZ
+			{1, 1, 2},	// I_CMP_LE_JZ
+			{1, 1, 2},	// I_CMP_LE_JNZ
+			{1, 2, 0},	// I_DEC_JNZ
+			{1, 2, 0},	// C_FLAG_JZ
+			{1, 2, 0},	// C_FLAG_JNZ
+			//
+			{1, 1, 1, 2},	// I_ADD_IMM
+			{1, 1, 1, 2},	// I_SUB_IMM
+			//
+			{1, 2, 0},	// LOAD_W_BP
+			{2, 1, 0},	// STORE_W_BP
+			{1, 2, 0},	// LOAD_W_BP_R_JMP
+			//
+			{1, 0, 0},	// I_INC_NF
+			{1, 0, 0},	// I_DEC_NF
+			{1, 1, 1},	// I_ADD_NF
+			{1, 1, 1},	// I_SUB_NF
+			{1, 1, 1},	// I_MUL_NF
+			{1, 1, 1},	// I_DIV_NF
+			{1, 1, 1},	// I_MOD_NF
+			{1, 0, 0},	// C_INC_NF
+			{1, 0, 0},	// C_DEC_NF
+			{1, 1, 1},	// C_ADD_NF
+			{1, 1, 1},	// C_SUB_NF
+			{1, 1, 1},	// C_MUL_NF
+			{1, 1, 1},	// C_DIV_NF
+			{1, 1, 1},	// C_MOD_NF
+			{1, 1, 1, 2},	// I_ADD_IMM_NF
+			{1, 1, 1, 2},	// I_SUB_IMM_NF
+			//
+			{1, 2, 1},	// READ_STR_N
+			//
 			// 
 			//
 			{5, 2, 0},	// GLOBAL_W
@@ -255,5 +463,68 @@ namespace vm {
 			{5, 4, 0},	// GLOBAL_S
 			{5, 6, 0},	// GLOBAL_STR
 		};
+
+		static_assert(sizeof(args) / sizeof(args[0]) == count, "Every opcode needs an args entry");
+
+		// Opcodes whose word argument is a static jump target
+		inline bool isStaticJump(const int& opcode) {
+			switch (opcode) {
+				case JMP:
+				case CALL:
+				case JMP_Z:
+				case JMP_NZ:
+				case I_CMP_EQ_JZ:
+				case I_CMP_EQ_JNZ:
+				case I_CMP_NE_JZ:
+				case I_CMP_NE_JNZ:
+				case I_CMP_GT_JZ:
+				case I_CMP_GT_JNZ:
+				case I_CMP_LT_JZ:
+				case I_CMP_LT_JNZ:
+				case I_CMP_GE_JZ:
+				case I_CMP_GE_JNZ:
+				case I_CMP_LE_JZ:
+				case I_CMP_LE_JNZ:
+				case I_DEC_JNZ:
+				case C_FLAG_JZ:
+				case C_FLAG_JNZ:
+					return true;
+
+				default:
+					return false;
+			}
+		}
+
+		// The flagless form of an opcode that sets FZ from its result (or -1 if it doesn't have one)
+		inline int withoutFlag(const int& opcode) {
+			if (I_INC <= opcode && opcode <= I_MOD) return I_INC_NF + (opcode - I_INC);
+			if (C_INC <= opcode && opcode <= C_MOD) return C_INC_NF + (opcode - C_INC);
+			if (opcode == I_ADD_IMM || opcode == I_SUB_IMM) return I_ADD_IMM_NF + (opcode - I_ADD_IMM);
+			return -1;
+		}
+
+		// The opcode a flagless form is named after (anything else is returned as it is)
+		inline int withFlag(const int& opcode) {
+			if (I_INC_NF <= opcode && opcode <= I_MOD_NF) return I_INC + (opcode - I_INC_NF);
+			if (C_INC_NF <= opcode && opcode <= C_MOD_NF) return C_INC + (opcode - C_INC_NF);
+			if (opcode == I_ADD_IMM_NF || opcode == I_SUB_IMM_NF) return I_ADD_IMM + (opcode - I_ADD_IMM_NF);
+			return opcode;
+		}
+
+		// Opcodes that never continue on to the next instruction
+		inline bool isTerminator(const int& opcode) {
+			switch (opcode) {
+				case HALT:
+				case JMP:
+				case R_JMP:
+				case RET:
+				case LOAD_W_BP_R_JMP:
+				case INVALID:
+					return true;
+
+				default:
+					return false;
+			}
+		}
 	}
 }
\ No newline at end of file
@@ -0,0 +1,1062 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <bitset>
+
+// The optimizer works on the linked image, where the relocations say exactly which words are label addresses, so
+// instructions can be removed or changed and everything that points at code fixed up afterwards. That only works if
+// labels are the only way the program gets code addresses: a jump to a number, or arithmetic on a label's address,
+// would end up somewhere else once the code moves. Jumps to numbers are caught, and stop the program being optimized.
+
+using vm::assembler::Linked;
+
+namespace {
+	using namespace vm::opcode;
+	using vm::types::byte_t;
+	using vm::types::opcode_t;
+	using vm::types::reg_t;
+	using vm::types::short_t;
+	using vm::types::word_t;
+
+	namespace register_ = vm::register_;
+
+	constexpr int NUM_REGISTERS = register_::R0 + register_::NUM_GEN_REGISTERS;
+	constexpr int MAX_ROUNDS = 16;
+
+	// Liveness is tracked for each byte of each register, since byte and short instructions only read the low bytes
+	// of their arguments (and setting a flag leaves the rest of FZ alone). Their writes sign-extend over all of it.
+	typedef std::bitset<NUM_REGISTERS * 4> Lanes;
+
+	Lanes lanes(const int& reg, const int& width) {
+		Lanes out;
+		for (int i = 0; i < width; i++) out.set(reg * 4 + i);
+		return out;
+	}
+
+	const Lanes FLAG = lanes(register_::FZ, 1);
+
+	enum Flow {
+		FLOW_NEXT,		// Carries on to the next instruction
+		FLOW_JUMP,		// Static jump to imm
+		FLOW_DYNAMIC,	// Jump to an address in a register, which could be any label whose address is taken
+		FLOW_STOP
+	};
+
+	// What an instruction does to the registers. Each register argument is read ('u'), written ('d'), or both ('b').
+	// Vector registers ('-') aren't tracked, so nothing that writes one is ever pure.
+	struct Desc {
+		char role[3];
+		int width[3];// Bytes of the register read or written
+		bool readsFlag;
+		bool writesFlag;
+		bool isPure;// Writing the registers is all it does, so it can go once they're all dead
+		bool isOpaque;// Not modelled: counts as reading every register, and leaves nothing known about any of them
+		Flow flow;
+		bool isConditional;
+	};
+
+	struct Op {
+		opcode_t opcode;
+		reg_t regs[3];
+		word_t imm;
+		short_t frameSize;// CALL's other argument
+		bool isRelocated;// imm is a label's address
+		size_t pos;// Where it was in the image
+		int target;// For static jumps, the block jumped to (-1 for the end of the code)
+		bool isSafe;// Division by something known not to throw
+		bool isRemoved;
+	};
+
+	struct Block {
+		size_t begin;
+		size_t end;
+		bool isReachable;
+		Lanes gen;// Read before being written
+		Lanes kill;
+		Lanes liveIn;
+		Lanes liveOut;
+	};
+
+	// What's known about a register at one point in a block
+	struct RegState {
+		uint32_t value;
+		int known;// One bit for each byte of value that is known
+		int copyOf;// The register this holds an exact copy of (-1 if none)
+	};
+
+	int byteMask(const int& width) {
+		return (1 << width) - 1;
+	}
+
+	Desc describe(const Op& op) {
+		Desc desc = { { 0, 0, 0 }, { 0, 0, 0 }, false, false, false, false, FLOW_NEXT, false };
+		const auto set = [&desc](const char* const roles, const int& w0, const int& w1, const int& w2) {
+			for (int i = 0; i < 3 && roles[i] != '\0'; i++) desc.role[i] = roles[i];
+			desc.width[0] = w0;
+			desc.width[1] = w1;
+			desc.width[2] = w2;
+		};
+
+		// A flagless form is described like the opcode it's named after, apart from FZ
+		const int opcode = withFlag(op.opcode);
+		switch (opcode) {
+			case NOP:
+				desc.isPure = true;
+				break;
+
+			case HALT:
+				desc.flow = FLOW_STOP;
+				break;
+
+			case BREAK:
+			case PRNT_LN:
+			case PUSH_SCOPE:
+			case POP_SCOPE:
+			case SNAPSHOT:
+				break;
+
+			case ALLOC:
+				set("du", 4, 4, 0);
+				break;
+
+			case FREE:
+			case R_PRNT_W:
+			case PRNT_STR:
+			case READ_STR:
+				set("u", 4, 0, 0);
+				break;
+
+			case READ_STR_N:
+				set("uu", 4, 4, 0);
+				break;
+
+			case PRNT_C:
+				set("u", 1, 0, 0);
+				break;
+
+			case MEMCPY:
+				set("uuu", 4, 4, 4);
+				break;
+
+			case MEMSET:
+				set("uuu", 4, 1, 4);
+				break;
+
+			case MEMCMP:
+				set("uub", 4, 4, 4);
+				break;
+
+			case MEMCHR:
+				set("buu", 4, 1, 4);
+				break;
+
+			case STRLEN:
+				set("du", 4, 4, 0);
+				break;
+
+			case V_LOAD:
+			case V_SPLAT:
+				set("-u", 0, 4, 0);
+				break;
+
+			case V_STORE:
+				set("u-", 4, 0, 0);
+				break;
+
+			case V_ADD:
+			case V_SUB:
+			case V_MUL:
+			case V_CMP_EQ:
+			case V_CMP_GT:
+				set("---", 0, 0, 0);
+				break;
+
+			case V_SUM:
+				set("d-", 4, 0, 0);
+				break;
+
+			case MOV:
+				set("du", 4, 4, 0);
+				desc.isPure = true;
+				break;
+
+			case MOV_W:
+			case MOV_B:
+			case MOV_S:
+				set("d", opcode == MOV_W ? 4 : opcode == MOV_S ? 2 : 1, 0, 0);
+				desc.isPure = true;
+				break;
+
+			case LOAD_W:
+			case LOAD_B:
+			case LOAD_S:
+				set("du", opcode == LOAD_W ? 4 : opcode == LOAD_S ? 2 : 1, 4, 0);
+				break;
+
+			case STORE_W:
+			case STORE_B:
+			case STORE_S:
+				set("uu", 4, opcode == STORE_W ? 4 : opcode == STORE_S ? 2 : 1, 0);
+				break;
+
+			case JMP:
+				desc.flow = FLOW_JUMP;
+				break;
+
+			case JMP_Z:
+			case JMP_NZ:
+				desc.readsFlag = true;
+				desc.flow = FLOW_JUMP;
+				desc.isConditional = true;
+				break;
+
+			case R_JMP:
+				set("u", 4, 0, 0);
+				desc.flow = FLOW_DYNAMIC;
+				break;
+
+			case R_JMP_Z:
+			case R_JMP_NZ:
+				set("u", 4, 0, 0);
+				desc.readsFlag = true;
+				desc.flow = FLOW_DYNAMIC;
+				desc.isConditional = true;
+				break;
+
+			case I_FLAG:
+				set("u", 4, 0, 0);
+				desc.writesFlag = true;
+				desc.isPure = true;
+				break;
+
+			case I_CMP_EQ:
+			case I_CMP_NE:
+			case I_CMP_GT:
+			case I_CMP_LT:
+			case I_CMP_GE:
+			case I_CMP_LE:
+				set("uu", 4, 4, 0);
+				desc.writesFlag = true;
+				desc.isPure = true;
+				break;
+
+			case I_INC:
+			case I_DEC:
+				set("b", 4, 0, 0);
+				desc.writesFlag = true;
+				desc.isPure = true;
+				break;
+
+			case I_ADD:
+			case I_SUB:
+			case I_MUL:
+			case I_DIV:
+			case I_MOD:
+				set("duu", 4, 4, 4);
+				desc.writesFlag = true;
+				desc.isPure = (opcode != I_DIV && opcode != I_MOD) || op.isSafe;
+				break;
+
+			case I_TO_C:
+				set("du", 1, 4, 0);
+				desc.isPure = true;
+				break;
+
+			case C_FLAG:
+				set("u", 1, 0, 0);
+				desc.writesFlag = true;
+				desc.isPure = true;
+				break;
+
+			case C_CMP_EQ:
+			case C_CMP_NE:
+			case C_CMP_GT:
+			case C_CMP_LT:
+			case C_CMP_GE:
+			case C_CMP_LE:
+				set("uu", 1, 1, 0);
+				desc.writesFlag = true;
+				desc.isPure = true;
+				break;
+
+			case C_INC:
+			case C_DEC:
+				set("b", 1, 0, 0);
+				desc.writesFlag = true;
+				desc.isPure = true;
+				break;
+
+			case C_ADD:
+			case C_SUB:
+			case C_MUL:
+			case C_DIV:
+			case C_MOD:
+				set("duu", 1, 1, 1);
+				desc.writesFlag = true;
+				desc.isPure = (opcode != C_DIV && opcode != C_MOD) || op.isSafe;
+				break;
+
+			case C_TO_I:
+				set("du", 4, 1, 0);
+				desc.isPure = true;
+				break;
+
+			default:
+				// Superinstructions written by hand
+				desc.isOpaque = true;
+				if (isStaticJump(opcode)) {
+					desc.flow = FLOW_JUMP;
+					desc.isConditional = opcode != JMP;
+				} else if (isTerminator(opcode)) {
+					desc.flow = FLOW_DYNAMIC;
+				}
+				break;
+		}
+
+		if (opcode != op.opcode) desc.writesFlag = false;
+		return desc;
+	}
+
+	void effects(const Op& op, Lanes& uses, Lanes& defs) {
+		const Desc desc = describe(op);
+		uses.reset();
+		defs.reset();
+		if (desc.isOpaque) {
+			uses.set();
+			return;
+		}
+
+		for (int i = 0; i < 3; i++) {
+			if (desc.role[i] == 'u' || desc.role[i] == 'b') uses |= lanes(op.regs[i], desc.width[i]);
+			if (desc.role[i] == 'd' || desc.role[i] == 'b') defs |= lanes(op.regs[i], 4);
+		}
+		if (desc.readsFlag) uses |= FLAG;
+		if (desc.writesFlag) defs |= FLAG;
+	}
+
+	size_t argsSize(const int& opcode) {
+		size_t size = 0;
+		for (int i = 0; i < MAX_ARGS; i++) {
+			switch (args[opcode][i]) {
+				case 1: // ARG_REG
+				case 7: // ARG_VREG
+					size += sizeof(reg_t);
+					break;
+
+				case 2: // ARG_WORD
+					size += sizeof(word_t);
+					break;
+
+				case 3: // ARG_BYTE
+					size += sizeof(byte_t);
+					break;
+
+				case 4: // ARG_SHORT
+					size += sizeof(short_t);
+					break;
+			}
+		}
+		return size;
+	}
+
+	// Offset of the word argument within an instruction (0 if there isn't one)
+	size_t wordOffset(const int& opcode) {
+		size_t offset = sizeof(opcode_t);
+		for (int i = 0; i < MAX_ARGS; i++) {
+			switch (args[opcode][i]) {
+				case 1: // ARG_REG
+				case 7: // ARG_VREG
+					offset += sizeof(reg_t);
+					break;
+
+				case 2: // ARG_WORD
+					return offset;
+
+				case 3: // ARG_BYTE
+					offset += sizeof(byte_t);
+					break;
+
+				case 4: // ARG_SHORT
+					offset += sizeof(short_t);
+					break;
+			}
+		}
+		return 0;
+	}
+
+	class Optimizer {
+	public:
+		Optimizer(Linked& programIn) : program(programIn) {}
+
+		// Returns why the program can't be optimized, or nullptr once it has been
+		const char* run(size_t& opsBefore, size_t& opsAfter) {
+			const char* const error = parse();
+			if (error != nullptr) return error;
+			findBlocks();
+
+			opsBefore = ops.size();
+			for (int round = 0; round < MAX_ROUNDS; round++) {
+				bool changed = removeUnreachable();
+				findLiveness();
+				changed = propagate() || changed;
+				findLiveness();
+				changed = removeDead() || changed;
+				changed = removeJumpsToNext() || changed;
+				if (!changed) break;
+			}
+
+			opsAfter = 0;
+			for (const Op& op : ops) if (!op.isRemoved) opsAfter++;
+			emit();
+			return nullptr;
+		}
+
+	private:
+		Linked& program;
+		std::vector<Op> ops;
+		std::vector<Block> blocks;
+		std::vector<int> addressTaken;// Blocks a dynamic jump could go to
+		std::vector<bool> isWordRelocated;
+
+		// Index of the instruction at pos, ops.size() for the end of the code, or -1 if pos isn't on an instruction
+		long long opAt(const size_t& pos) const {
+			if (pos == program.image.size()) return static_cast<long long>(ops.size());
+			const auto found = std::lower_bound(ops.begin(), ops.end(), pos, [](const Op& op, const size_t& p) { return op.pos < p; });
+			if (found == ops.end() || found->pos != pos) return -1;
+			return found - ops.begin();
+		}
+
+		const char* parse() {
+			const std::vector<char>& image = program.image;
+			isWordRelocated.assign(image.size(), false);
+			for (const size_t& pos : program.relocations) isWordRelocated[pos] = true;
+
+			size_t pos = program.codeStart;
+			while (pos < image.size()) {
+				Op op;
+				op.opcode = static_cast<opcode_t>(image[pos]);
+				op.regs[0] = op.regs[1] = op.regs[2] = 0;
+				op.imm = 0;
+				op.frameSize = 0;
+				op.isRelocated = false;
+				op.pos = pos;
+				op.target = -1;
+				op.isSafe = false;
+				op.isRemoved = false;
+				if (op.opcode >= GLOBAL_BREAK || pos + sizeof(opcode_t) + argsSize(op.opcode) > image.size()) return "the code has something in it that isn't an instruction";
+
+				size_t at = pos + sizeof(opcode_t);
+				int nextReg = 0;
+				for (int i = 0; i < MAX_ARGS; i++) {
+					switch (args[op.opcode][i]) {
+						case 1: // ARG_REG
+							op.regs[nextReg++] = static_cast<reg_t>(image[at]);
+							at += sizeof(reg_t);
+							break;
+
+						case 7: // ARG_VREG
+							// Checked here, since the check below is for ordinary registers
+							if (static_cast<reg_t>(image[at]) >= register_::NUM_VEC_REGISTERS) return "an instruction uses a vector register that doesn't exist";
+							op.regs[nextReg++] = static_cast<reg_t>(image[at]);
+							at += sizeof(reg_t);
+							break;
+
+						case 2: // ARG_WORD
+							std::memcpy(&op.imm, image.data() + at, sizeof(word_t));
+							op.isRelocated = isWordRelocated[at];
+							at += sizeof(word_t);
+							break;
+
+						case 3: // ARG_BYTE
+							op.imm = static_cast<byte_t>(image[at]);
+							at += sizeof(byte_t);
+							break;
+
+						case 4: {// ARG_SHORT
+							short_t value;
+							std::memcpy(&value, image.data() + at, sizeof(value));
+							if (op.opcode == CALL) op.frameSize = value;
+							else op.imm = value;
+							at += sizeof(short_t);
+							break;
+						}
+					}
+				}
+				for (int i = 0; i < nextReg; i++) {
+					if (op.regs[i] >= NUM_REGISTERS) return "an instruction uses a register that doesn't exist";
+				}
+
+				ops.push_back(op);
+				pos = at;
+			}
+
+			// Every relocation in the code has to be an instruction's word argument, so it moves with the instruction
+			for (const size_t& reloc : program.relocations) {
+				if (reloc < program.codeStart) continue;
+				const auto found = std::upper_bound(ops.begin(), ops.end(), reloc, [](const size_t& p, const Op& op) { return p < op.pos; });
+				const Op& op = *(found - 1);
+				if (wordOffset(op.opcode) == 0 || op.pos + wordOffset(op.opcode) != reloc) return "a label's address is in the middle of an instruction";
+			}
+
+			for (const Op& op : ops) {
+				if (isStaticJump(op.opcode) && !op.isRelocated) return "a jump goes to a number instead of a label";
+			}
+
+			// And every address in the code has to be where an instruction starts, so it has somewhere to move to
+			const auto isOnInstr = [&](const word_t& value) {
+				return value < 0 || static_cast<size_t>(value) < program.codeStart || static_cast<size_t>(value) > image.size() || opAt(static_cast<size_t>(value)) >= 0;
+			};
+			word_t entry;
+			std::memcpy(&entry, image.data() + vm::format::FIRST_INSTR_ADDR_LOCATION, sizeof(entry));
+			if (!isOnInstr(entry)) return "the program starts in the middle of an instruction";
+			for (const size_t& reloc : program.relocations) {
+				word_t value;
+				std::memcpy(&value, image.data() + reloc, sizeof(value));
+				if (!isOnInstr(value)) return "a label is in the middle of an instruction";
+			}
+			for (const vm::assembler::Symbol& symbol : program.symbols) {
+				if (!isOnInstr(symbol.value)) return "a label is in the middle of an instruction";
+			}
+			return nullptr;
+		}
+
+		void findBlocks() {
+			const std::vector<char>& image = program.image;
+			std::vector<bool> isLeader(ops.size() + 1, false);
+			std::vector<bool> isTaken(ops.size() + 1, false);
+			isLeader[0] = true;
+
+			const auto codeIndex = [&](const word_t& value) -> long long {
+				if (value < 0 || static_cast<size_t>(value) < program.codeStart || static_cast<size_t>(value) > image.size()) return -1;
+				return opAt(static_cast<size_t>(value));
+			};
+
+			// Anywhere a label's address is used for anything but a static jump, it could be jumped to dynamically
+			word_t entry;
+			std::memcpy(&entry, image.data() + vm::format::FIRST_INSTR_ADDR_LOCATION, sizeof(entry));
+			const long long entryIndex = codeIndex(entry);
+			if (entryIndex >= 0) isTaken[static_cast<size_t>(entryIndex)] = isLeader[static_cast<size_t>(entryIndex)] = true;
+			for (const size_t& reloc : program.relocations) {
+				word_t value;
+				std::memcpy(&value, image.data() + reloc, sizeof(value));
+				const long long index = codeIndex(value);
+				if (index < 0) continue;
+				isLeader[static_cast<size_t>(index)] = true;
+
+				const bool isJump = reloc >= program.codeStart && isStaticJump((*(std::upper_bound(ops.begin(), ops.end(), reloc, [](const size_t& p, const Op& op) { return p < op.pos; }) - 1)).opcode);
+				if (!isJump) isTaken[static_cast<size_t>(index)] = true;
+			}
+			for (size_t i = 0; i < ops.size(); i++) {
+				if (describe(ops[i]).flow != FLOW_NEXT) isLeader[i + 1] = true;
+				// Where a RET comes back to
+				if (ops[i].opcode == CALL) isTaken[i + 1] = true;
+			}
+
+			std::vector<int> blockOf(ops.size() + 1, -1);
+			for (size_t i = 0; i < ops.size(); i++) {
+				if (isLeader[i]) blocks.push_back(Block{ i, i, false, Lanes(), Lanes(), Lanes(), Lanes() });
+				blocks.back().end = i + 1;
+				blockOf[i] = static_cast<int>(blocks.size()) - 1;
+			}
+
+			for (size_t i = 0; i < ops.size(); i++) {
+				if (isTaken[i]) addressTaken.push_back(blockOf[i]);
+				if (isStaticJump(ops[i].opcode)) {
+					// A label's address that's still in the code, so (from parse) it's on an instruction or the end
+					ops[i].target = blockOf[static_cast<size_t>(codeIndex(ops[i].imm))];
+				}
+			}
+		}
+
+		// The last instruction of the block that's still there (nullptr if they've all gone)
+		const Op* last(const Block& block) const {
+			for (size_t i = block.end; i-- > block.begin;) {
+				if (!ops[i].isRemoved) return &ops[i];
+			}
+			return nullptr;
+		}
+
+		template<typename Visit>
+		void forEachSuccessor(const size_t& b, const Visit& visit) const {
+			const Op* const op = last(blocks[b]);
+			const Desc desc = op == nullptr ? Desc() : describe(*op);
+			const Flow flow = op == nullptr ? FLOW_NEXT : desc.flow;
+
+			if (flow == FLOW_JUMP && op->target >= 0) visit(static_cast<size_t>(op->target));
+			if (flow == FLOW_DYNAMIC) {
+				for (const int& taken : addressTaken) visit(static_cast<size_t>(taken));
+			}
+			if ((flow == FLOW_NEXT || desc.isConditional) && b + 1 < blocks.size()) visit(b + 1);
+		}
+
+		bool removeUnreachable() {
+			for (Block& block : blocks) block.isReachable = false;
+
+			std::vector<size_t> stack;
+			if (!blocks.empty()) stack.push_back(0);
+			for (const int& taken : addressTaken) stack.push_back(static_cast<size_t>(taken));
+			while (!stack.empty()) {
+				const size_t b = stack.back();
+				stack.pop_back();
+				if (blocks[b].isReachable) continue;
+				blocks[b].isReachable = true;
+				forEachSuccessor(b, [&](const size_t& next) { if (!blocks[next].isReachable) stack.push_back(next); });
+			}
+
+			bool changed = false;
+			for (const Block& block : blocks) {
+				if (block.isReachable) continue;
+				for (size_t i = block.begin; i < block.end; i++) {
+					changed = changed || !ops[i].isRemoved;
+					ops[i].isRemoved = true;
+				}
+			}
+			return changed;
+		}
+
+		void findLiveness() {
+			Lanes uses, defs;
+			for (Block& block : blocks) {
+				block.gen.reset();
+				block.kill.reset();
+				for (size_t i = block.end; i-- > block.begin;) {
+					if (ops[i].isRemoved) continue;
+					effects(ops[i], uses, defs);
+					block.gen = (block.gen & ~defs) | uses;
+					block.kill |= defs;
+				}
+				block.liveIn.reset();
+				block.liveOut.reset();
+			}
+
+			bool changed = true;
+			while (changed) {
+				changed = false;
+				Lanes dynamicLive;
+				for (const int& taken : addressTaken) dynamicLive |= blocks[static_cast<size_t>(taken)].liveIn;
+
+				for (size_t b = blocks.size(); b-- > 0;) {
+					Block& block = blocks[b];
+					Lanes out;
+					const Op* const op = last(block);
+					const Desc desc = op == nullptr ? Desc() : describe(*op);
+					const Flow flow = op == nullptr ? FLOW_NEXT : desc.flow;
+					if (flow == FLOW_JUMP && op->target >= 0) out |= blocks[static_cast<size_t>(op->target)].liveIn;
+					if (flow == FLOW_DYNAMIC) out |= dynamicLive;
+					if ((flow == FLOW_NEXT || desc.isConditional) && b + 1 < blocks.size()) out |= blocks[b + 1].liveIn;
+
+					const Lanes in = block.gen | (out & ~block.kill);
+					if (in != block.liveIn || out != block.liveOut) changed = true;
+					block.liveIn = in;
+					block.liveOut = out;
+				}
+			}
+		}
+
+		// Follows constants and copies through each block, folding what it can. Nothing is known at the start of a
+		// block, since it could be reached from anywhere.
+		bool propagate() {
+			bool changed = false;
+			std::vector<Lanes> liveAfter;
+			RegState regs[NUM_REGISTERS];
+
+			for (const Block& block : blocks) {
+				if (!block.isReachable) continue;
+
+				liveAfter.resize(block.end - block.begin);
+				Lanes live = block.liveOut;
+				Lanes uses, defs;
+				for (size_t i = block.end; i-- > block.begin;) {
+					liveAfter[i - block.begin] = live;
+					if (ops[i].isRemoved) continue;
+					effects(ops[i], uses, defs);
+					live = (live & ~defs) | uses;
+				}
+
+				for (RegState& reg : regs) reg = RegState{ 0, 0, -1 };
+				for (size_t i = block.begin; i < block.end; i++) {
+					if (!ops[i].isRemoved) changed = step(ops[i], regs, liveAfter[i - block.begin]) || changed;
+				}
+			}
+			return changed;
+		}
+
+		static bool isKnown(const RegState* const& regs, const int& reg, const int& width) {
+			return (regs[reg].known & byteMask(width)) == byteMask(width);
+		}
+
+		static uint32_t extend(const int& width, const uint32_t& value) {
+			if (width == 1) return static_cast<uint32_t>(static_cast<int8_t>(value));
+			if (width == 2) return static_cast<uint32_t>(static_cast<int16_t>(value));
+			return value;
+		}
+
+		static void forget(RegState* const& regs, const int& reg) {
+			regs[reg].copyOf = -1;
+			for (int i = 0; i < NUM_REGISTERS; i++) {
+				if (regs[i].copyOf == reg) regs[i].copyOf = -1;
+			}
+		}
+
+		// A width byte value written to a register, sign-extended over the rest of it
+		static void write(RegState* const& regs, const int& reg, const int& width, const uint32_t& value, const bool& known) {
+			regs[reg].value = extend(width, value);
+			regs[reg].known = known ? byteMask(4) : 0;
+			forget(regs, reg);
+		}
+
+		static void writeFlag(RegState* const& regs, const bool& known, const bool& value) {
+			RegState& flag = regs[register_::FZ];
+			flag.value = (flag.value & ~0xffu) | (value ? 1u : 0u);
+			flag.known = known ? flag.known | byteMask(1) : flag.known & ~byteMask(1);
+			forget(regs, register_::FZ);
+		}
+
+		static void replace(Op& op, const opcode_t& opcode, const word_t& imm) {
+			op.opcode = opcode;
+			op.imm = imm;
+			op.isRelocated = false;
+			op.regs[1] = op.regs[2] = 0;
+		}
+
+		// Handles one instruction, returning whether it was changed
+		static bool step(Op& op, RegState* const& regs, const Lanes& liveAfter) {
+			const Desc desc = describe(op);
+			if (desc.isOpaque) {
+				for (int i = 0; i < NUM_REGISTERS; i++) regs[i] = RegState{ 0, 0, -1 };
+				return false;
+			}
+
+			bool changed = false;
+			for (int i = 0; i < 3; i++) {
+				if (desc.role[i] == 'u' && regs[op.regs[i]].copyOf >= 0) {
+					op.regs[i] = static_cast<reg_t>(regs[op.regs[i]].copyOf);
+					changed = true;
+				}
+			}
+
+			const int r1 = op.regs[0], r2 = op.regs[1], r3 = op.regs[2];
+			const bool isFlagDead = !(liveAfter & FLAG).any();
+			const int32_t a = static_cast<int32_t>(regs[r2].value), b = static_cast<int32_t>(regs[r3].value);
+			const int8_t ca = static_cast<int8_t>(regs[r2].value), cb = static_cast<int8_t>(regs[r3].value);
+			const int8_t flag = static_cast<int8_t>(regs[register_::FZ].value);
+			const bool isFlagKnown = isKnown(regs, register_::FZ, 1);
+
+			switch (op.opcode) {
+				case MOV_W:
+				case MOV_B:
+				case MOV_S: {
+					const int width = desc.width[0];
+					// A label's address changes when the code moves, so it isn't a known value, and can't match one either
+					if (!op.isRelocated && isKnown(regs, r1, 4) && regs[r1].value == extend(width, static_cast<uint32_t>(op.imm))) {
+						op.isRemoved = true;
+						return true;
+					}
+					write(regs, r1, width, static_cast<uint32_t>(op.imm), !op.isRelocated);
+					return changed;
+				}
+
+				case MOV: {
+					if (r1 == r2 || regs[r1].copyOf == r2 || regs[r2].copyOf == r1 || (regs[r1].copyOf >= 0 && regs[r1].copyOf == regs[r2].copyOf) ||
+						(isKnown(regs, r1, 4) && isKnown(regs, r2, 4) && regs[r1].value == regs[r2].value)) {
+						op.isRemoved = true;
+						return true;
+					}
+					const RegState source = regs[r2];
+					write(regs, r1, 4, source.value, false);
+					regs[r1].known = source.known;
+					regs[r1].copyOf = source.copyOf >= 0 ? source.copyOf : r2;
+					return changed;
+				}
+
+				case JMP_Z:
+				case JMP_NZ:
+					if (isFlagKnown) {
+						// JMP_Z jumps when FZ is 0, and JMP_NZ when it isn't
+						if ((flag == 0) == (op.opcode == JMP_Z)) op.opcode = JMP;
+						else op.isRemoved = true;
+						return true;
+					}
+					return changed;
+
+				case R_JMP_Z:
+				case R_JMP_NZ:
+					if (isFlagKnown) {
+						// The other way around: R_JMP_Z jumps when FZ isn't 0
+						if ((flag != 0) == (op.opcode == R_JMP_Z)) op.opcode = R_JMP;
+						else op.isRemoved = true;
+						return true;
+					}
+					return changed;
+
+				case I_FLAG:
+					writeFlag(regs, isKnown(regs, r1, 4), regs[r1].value != 0);
+					return changed;
+
+				case I_CMP_EQ:
+				case I_CMP_NE:
+				case I_CMP_GT:
+				case I_CMP_LT:
+				case I_CMP_GE:
+				case I_CMP_LE: {
+					const int32_t x = static_cast<int32_t>(regs[r1].value), y = static_cast<int32_t>(regs[r2].value);
+					const bool results[] = { x == y, x != y, x > y, x < y, x >= y, x <= y };
+					writeFlag(regs, isKnown(regs, r1, 4) && isKnown(regs, r2, 4), results[op.opcode - I_CMP_EQ]);
+					return changed;
+				}
+
+				case I_INC:
+				case I_DEC: {
+					const bool known = isKnown(regs, r1, 4);
+					const uint32_t result = regs[r1].value + (op.opcode == I_INC ? 1u : 0xffffffffu);
+					write(regs, r1, 4, result, known);
+					writeFlag(regs, known, result != 0);
+					return changed;
+				}
+
+				case I_ADD:
+				case I_SUB:
+				case I_MUL:
+				case I_DIV:
+				case I_MOD: {
+					const bool isDivide = op.opcode == I_DIV || op.opcode == I_MOD;
+					op.isSafe = isKnown(regs, r3, 4) && b != 0 && b != -1;
+					const bool known = isKnown(regs, r2, 4) && isKnown(regs, r3, 4) && (!isDivide || op.isSafe);
+
+					uint32_t result = 0;
+					if (known) {
+						const uint32_t ua = static_cast<uint32_t>(a), ub = static_cast<uint32_t>(b);
+						switch (op.opcode) {
+							case I_ADD: result = ua + ub; break;
+							case I_SUB: result = ua - ub; break;
+							case I_MUL: result = ua * ub; break;
+							case I_DIV: result = static_cast<uint32_t>(a / b); break;
+							case I_MOD: result = static_cast<uint32_t>(a % b); break;
+						}
+					}
+					write(regs, r1, 4, result, known);
+					if (known && isFlagDead) {
+						// The move leaves FZ as it was
+						replace(op, MOV_W, static_cast<word_t>(result));
+						return true;
+					}
+					writeFlag(regs, known, result != 0);
+					return changed;
+				}
+
+				case I_TO_C:
+					if (isKnown(regs, r2, 4)) {
+						const uint32_t value = regs[r2].value;
+						write(regs, r1, 1, value, true);
+						replace(op, MOV_B, static_cast<int8_t>(value));
+						return true;
+					}
+					write(regs, r1, 1, 0, false);
+					return changed;
+
+				case C_FLAG:
+					writeFlag(regs, isKnown(regs, r1, 1), static_cast<int8_t>(regs[r1].value) != 0);
+					return changed;
+
+				case C_CMP_EQ:
+				case C_CMP_NE:
+				case C_CMP_GT:
+				case C_CMP_LT:
+				case C_CMP_GE:
+				case C_CMP_LE: {
+					const int8_t x = static_cast<int8_t>(regs[r1].value), y = static_cast<int8_t>(regs[r2].value);
+					const bool results[] = { x == y, x != y, x > y, x < y, x >= y, x <= y };
+					writeFlag(regs, isKnown(regs, r1, 1) && isKnown(regs, r2, 1), results[op.opcode - C_CMP_EQ]);
+					return changed;
+				}
+
+				case C_INC:
+				case C_DEC: {
+					const bool known = isKnown(regs, r1, 1);
+					const int8_t result = static_cast<int8_t>(static_cast<int8_t>(regs[r1].value) + (op.opcode == C_INC ? 1 : -1));
+					write(regs, r1, 1, static_cast<uint32_t>(result), known);
+					writeFlag(regs, known, result != 0);
+					return changed;
+				}
+
+				case C_ADD:
+				case C_SUB:
+				case C_MUL:
+				case C_DIV:
+				case C_MOD: {
+					const bool isDivide = op.opcode == C_DIV || op.opcode == C_MOD;
+					op.isSafe = isKnown(regs, r3, 1) && cb != 0;
+					const bool known = isKnown(regs, r2, 1) && isKnown(regs, r3, 1) && (!isDivide || op.isSafe);
+
+					int8_t result = 0;
+					if (known) {
+						switch (op.opcode) {
+							case C_ADD: result = static_cast<int8_t>(ca + cb); break;
+							case C_SUB: result = static_cast<int8_t>(ca - cb); break;
+							case C_MUL: result = static_cast<int8_t>(ca * cb); break;
+							case C_DIV: result = static_cast<int8_t>(ca / cb); break;
+							case C_MOD: result = static_cast<int8_t>(ca % cb); break;
+						}
+					}
+					write(regs, r1, 1, static_cast<uint32_t>(result), known);
+					if (known && isFlagDead) {
+						// The move leaves FZ as it was
+						replace(op, MOV_B, result);
+						return true;
+					}
+					writeFlag(regs, known, result != 0);
+					return changed;
+				}
+
+				case C_TO_I:
+					if (isKnown(regs, r2, 1)) {
+						const int32_t value = static_cast<int8_t>(regs[r2].value);
+						write(regs, r1, 4, static_cast<uint32_t>(value), true);
+						replace(op, MOV_W, value);
+						return true;
+					}
+					write(regs, r1, 4, 0, false);
+					return changed;
+
+				default:
+					// Anything else only matters for what it writes, which isn't known
+					for (int i = 0; i < 3; i++) {
+						if (desc.role[i] == 'd' || desc.role[i] == 'b') write(regs, op.regs[i], desc.width[i], 0, false);
+					}
+					if (desc.writesFlag) writeFlag(regs, false, false);
+					return changed;
+			}
+		}
+
+		// Removes instructions that only write registers nothing reads again
+		bool removeDead() {
+			bool changed = false;
+			Lanes uses, defs;
+			for (const Block& block : blocks) {
+				if (!block.isReachable) continue;
+
+				Lanes live = block.liveOut;
+				for (size_t i = block.end; i-- > block.begin;) {
+					Op& op = ops[i];
+					if (op.isRemoved) continue;
+					effects(op, uses, defs);
+					if (describe(op).isPure && !(defs & live).any()) {
+						op.isRemoved = true;
+						changed = true;
+						continue;
+					}
+					live = (live & ~defs) | uses;
+				}
+			}
+			return changed;
+		}
+
+		// Removes jumps (conditional or not) to wherever the code would carry on to anyway
+		bool removeJumpsToNext() {
+			bool changed = false;
+			for (size_t i = 0; i < ops.size(); i++) {
+				Op& op = ops[i];
+				if (op.isRemoved || (op.opcode != JMP && op.opcode != JMP_Z && op.opcode != JMP_NZ)) continue;
+
+				const size_t target = op.target >= 0 ? blocks[static_cast<size_t>(op.target)].begin : ops.size();
+				if (target <= i) continue;
+				bool isNext = true;
+				for (size_t k = i + 1; k < target && isNext; k++) isNext = ops[k].isRemoved;
+				if (isNext) {
+					op.isRemoved = true;
+					changed = true;
+				}
+			}
+			return changed;
+		}
+
+		void emit() {
+			std::vector<char>& image = program.image;
+			const size_t codeStart = program.codeStart;
+
+			// Where each instruction ends up (a removed one maps to the next one that's still there)
+			std::vector<size_t> newPos(ops.size() + 1);
+			size_t pos = codeStart;
+			for (size_t i = 0; i < ops.size(); i++) {
+				newPos[i] = pos;
+				if (!ops[i].isRemoved) pos += sizeof(opcode_t) + argsSize(ops[i].opcode);
+			}
+			newPos[ops.size()] = pos;
+
+			const auto remap = [&](const word_t& value) -> word_t {
+				if (value < 0 || static_cast<size_t>(value) < codeStart || static_cast<size_t>(value) > image.size()) return value;
+				return static_cast<word_t>(newPos[static_cast<size_t>(opAt(static_cast<size_t>(value)))]);
+			};
+
+			std::vector<char> code;
+			std::vector<size_t> relocations;
+			for (const size_t& reloc : program.relocations) {
+				if (reloc >= codeStart) continue;
+				word_t value;
+				std::memcpy(&value, image.data() + reloc, sizeof(value));
+				value = remap(value);
+				std::memcpy(image.data() + reloc, &value, sizeof(value));
+				relocations.push_back(reloc);
+			}
+
+			for (const Op& op : ops) {
+				if (op.isRemoved) continue;
+				code.push_back(static_cast<char>(op.opcode));
+				int nextReg = 0;
+				for (int i = 0; i < MAX_ARGS; i++) {
+					switch (args[op.opcode][i]) {
+						case 1: // ARG_REG
+						case 7: // ARG_VREG
+							code.push_back(static_cast<char>(op.regs[nextReg++]));
+							break;
+
+						case 2: { // ARG_WORD
+							const word_t value = op.isRelocated ? remap(op.imm) : op.imm;
+							if (op.isRelocated) relocations.push_back(codeStart + code.size());
+							code.insert(code.end(), reinterpret_cast<const char*>(&value), reinterpret_cast<const char*>(&value) + sizeof(value));
+							break;
+						}
+
+						case 3: // ARG_BYTE
+							code.push_back(static_cast<char>(op.imm));
+							break;
+
+						case 4: { // ARG_SHORT
+							const short_t value = op.opcode == CALL ? op.frameSize : static_cast<short_t>(op.imm);
+							code.insert(code.end(), reinterpret_cast<const char*>(&value), reinterpret_cast<const char*>(&value) + sizeof(value));
+							break;
+						}
+					}
+				}
+			}
+
+			word_t entry;
+			std::memcpy(&entry, image.data() + vm::format::FIRST_INSTR_ADDR_LOCATION, sizeof(entry));
+			entry = remap(entry);
+			std::memcpy(image.data() + vm::format::FIRST_INSTR_ADDR_LOCATION, &entry, sizeof(entry));
+
+			for (vm::assembler::Symbol& symbol : program.symbols) symbol.value = remap(symbol.value);
+
+			image.resize(codeStart);
+			image.insert(image.end(), code.begin(), code.end());
+			std::sort(relocations.begin(), relocations.end());
+			program.relocations.swap(relocations);
+		}
+	};
+}
+
+bool vm::assembler::optimize(Linked& program, AssemblerSettings& assemblerSettings, std::ostream& stream) {
+	const size_t bytesBefore = program.image.size() - program.codeStart;
+	size_t opsBefore = 0, opsAfter = 0;
+
+	const char* const error = Optimizer(program).run(opsBefore, opsAfter);
+	if (error != nullptr) {
+		stream << IO_WARN "Not optimizing the program, since " << error << IO_NORM "\n";
+		return false;
+	}
+
+	if (assemblerSettings.flags.hasFlags(vm::FLAG_DEBUG)) {
+		stream << IO_DEBUG "Optimized " << opsBefore << " instructions (" << bytesBefore << " bytes) into " << opsAfter << " (" << (program.image.size() - program.codeStart) << " bytes)" IO_NORM "\n";
+	}
+	return true;
+}
@@ -0,0 +1,187 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <iomanip>
+
+using vm::executor::Profiler;
+
+vm::executor::Profiler::Profiler() : decodeMicros(0), runMicros(0), jitThreshold(0), budget(0), budgetHits(0), tierUpIndex(-1), tierUpInstructions(0), jitCycles(0), last(0), lastOpcode(opcode::INVALID), block(0), nextBlock(0) {
+	std::fill(opcodeCounts, opcodeCounts + 256, 0);
+	std::fill(opcodeCycles, opcodeCycles + 256, 0);
+}
+
+void vm::executor::Profiler::start(const int& entry) {
+	jump(entry);
+	block = entry;
+	lastOpcode = opcode::INVALID;
+	startTime = std::chrono::steady_clock::now();
+	last = now();
+}
+
+void vm::executor::Profiler::stop() {
+	// Charge the final instruction (the HALT), or everything the JIT ran
+	const counter_t time = now();
+	if (tierUpIndex >= 0) {
+		jitCycles += time - last;
+	} else {
+		opcodeCycles[lastOpcode] += time - last;
+		blockCycles[block] += time - last;
+	}
+	last = time;
+	runMicros += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void vm::executor::Profiler::preempt() {
+	stop();
+	budgetHits++;
+}
+
+void vm::executor::Profiler::resume(const int& entry) {
+	// The jump to entry was counted before the budget ran out
+	block = entry;
+	nextBlock = entry;
+	lastOpcode = opcode::INVALID;
+	startTime = std::chrono::steady_clock::now();
+	last = now();
+}
+
+void vm::executor::Profiler::tierUp(const int& target) {
+	// Charge the jump that got hot
+	const counter_t time = now();
+	opcodeCycles[lastOpcode] += time - last;
+	blockCycles[block] += time - last;
+	last = time;
+
+	tierUpInstructions = dispatches();
+	tierUpIndex = target;
+}
+
+Profiler::counter_t vm::executor::Profiler::dispatches() const {
+	if (tierUpIndex >= 0) return tierUpInstructions;
+	counter_t total = 0;
+	for (const counter_t& count : opcodeCounts) total += count;
+	return total;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Output
+
+namespace {
+	const char* opcodeName(const int& opcode) {
+		if (opcode < vm::opcode::count) return vm::opcode::strings[opcode];
+		if (opcode == vm::opcode::FZ_SPILL) return "(fz spill)";
+		if (opcode == vm::opcode::FZ_FILL) return "(fz fill)";
+		return "(invalid)";
+	}
+
+	std::vector<int> sortedBy(const Profiler::counter_t* const& values, const int& n) {
+		std::vector<int> order;
+		for (int i = 0; i < n; i++) {
+			if (values[i] != 0) order.push_back(i);
+		}
+		std::sort(order.begin(), order.end(), [&values](const int& a, const int& b) { return values[a] > values[b]; });
+		return order;
+	}
+}
+
+void vm::executor::Profiler::report(std::ostream& stream, const DecodedProgram& decoded) const {
+	constexpr int TOP_BLOCKS = 10;
+
+	counter_t instructions = 0;
+	counter_t cycles = 0;
+	for (int i = 0; i < 256; i++) {
+		instructions += opcodeCounts[i];
+		cycles += opcodeCycles[i];
+	}
+	cycles += jitCycles;
+	if (cycles == 0) cycles = 1;
+
+	stream << IO_PROFILE "Decode time (1,000,000 micros = 1 sec): " << decodeMicros << "\n";
+	stream << IO_PROFILE "Runtime (1,000,000 micros = 1 sec): " << runMicros << "\n";
+	if (jitThreshold == 0) {
+		stream << IO_PROFILE "Tier: interpreter only\n";
+	} else if (tierUpIndex < 0) {
+		stream << IO_PROFILE "Tier: interpreter (nothing reached the JIT threshold of " << jitThreshold << ")\n";
+	} else {
+		stream << IO_PROFILE "Tier: JIT, from BYTE" << decoded.offsets[tierUpIndex] << " after " << tierUpInstructions << " interpreted instructions (JIT threshold "
+			<< jitThreshold << ", " << std::fixed << std::setprecision(2) << 100.0 * jitCycles / cycles << "% of cycles in the JIT)\n" << std::defaultfloat;
+	}
+	if (budget != 0) stream << IO_PROFILE "Budget: " << budget << " backward or dynamic jumps, preempted " << budgetHits << " times\n";
+	if (tierUpIndex >= 0) {
+		// The JIT doesn't count what it runs, so there's no rate to give
+		stream << IO_PROFILE "Instructions dispatched: " << instructions << " (interpreted, before the JIT took over)\n";
+	} else {
+		stream << IO_PROFILE "Instructions dispatched: " << instructions;
+		if (runMicros != 0) stream << " (" << instructions * 1000000 / runMicros << " per sec)";
+		stream << "\n";
+	}
+
+	stream << IO_PROFILE "Opcodes, by total cycles:\n";
+	stream << IO_PROFILE << std::left << std::setw(14) << "opcode" << std::right << std::setw(14) << "count" << std::setw(16) << "cycles" << std::setw(10) << "cyc/op" << std::setw(8) << "%" << "\n";
+	for (const int& i : sortedBy(opcodeCycles, 256)) {
+		if (opcodeCounts[i] == 0) continue;
+		stream << IO_PROFILE << std::left << std::setw(14) << opcodeName(i) << std::right << std::setw(14) << opcodeCounts[i] << std::setw(16) << opcodeCycles[i]
+			<< std::setw(10) << opcodeCycles[i] / opcodeCounts[i] << std::setw(7) << std::fixed << std::setprecision(2) << 100.0 * opcodeCycles[i] / cycles << "%\n";
+	}
+
+	stream << IO_PROFILE "Hottest blocks, by total cycles:\n";
+	stream << IO_PROFILE << std::left << std::setw(14) << "block" << std::right << std::setw(14) << "entries" << std::setw(16) << "cycles" << std::setw(18) << "%" << "\n";
+	std::vector<int> blocks = sortedBy(blockCycles.data(), static_cast<int>(blockCycles.size()));
+	for (int n = 0; n < TOP_BLOCKS && n < static_cast<int>(blocks.size()); n++) {
+		const int& i = blocks[n];
+		stream << IO_PROFILE "BYTE" << std::left << std::setw(10) << decoded.offsets[i] << std::right << std::setw(14) << blockCounts[i] << std::setw(16) << blockCycles[i]
+			<< std::setw(17) << std::fixed << std::setprecision(2) << 100.0 * blockCycles[i] / cycles << "%\n";
+	}
+
+	stream << IO_PROFILE "Hottest jump targets, by times jumped to:\n";
+	blocks = sortedBy(blockCounts.data(), static_cast<int>(blockCounts.size()));
+	for (int n = 0; n < TOP_BLOCKS && n < static_cast<int>(blocks.size()); n++) {
+		const int& i = blocks[n];
+		stream << IO_PROFILE "BYTE" << std::left << std::setw(10) << decoded.offsets[i] << std::right << std::setw(14) << blockCounts[i] << "\n";
+	}
+
+	stream << IO_NORM << std::defaultfloat;
+}
+
+bool vm::executor::Profiler::write(const char* const& path, const DecodedProgram& decoded) const {
+	std::fstream file;
+	file.open(path, std::ios::out | std::ios::trunc);
+	if (!file.is_open()) return false;
+
+	std::string pathStr = path;
+	const bool csv = pathStr.length() >= 4 && pathStr.compare(pathStr.length() - 4, 4, ".csv") == 0;
+
+	if (csv) {
+		file << "kind,name,offset,count,cycles\n";
+		if (tierUpIndex >= 0) file << "jit,," << decoded.offsets[tierUpIndex] << "," << tierUpInstructions << "," << jitCycles << "\n";
+		if (budget != 0) file << "preempted,,," << budgetHits << ",\n";
+		for (const int& i : sortedBy(opcodeCycles, 256)) {
+			if (opcodeCounts[i] == 0) continue;
+			file << "opcode," << opcodeName(i) << ",," << opcodeCounts[i] << "," << opcodeCycles[i] << "\n";
+		}
+		for (const int& i : sortedBy(blockCycles.data(), static_cast<int>(blockCycles.size()))) {
+			file << "block,," << decoded.offsets[i] << "," << blockCounts[i] << "," << blockCycles[i] << "\n";
+		}
+	} else {
+		file << "{\n\t\"decodeMicros\": " << decodeMicros << ",\n\t\"runMicros\": " << runMicros << ",\n\t\"jitThreshold\": " << jitThreshold
+			<< ",\n\t\"budget\": " << budget << ",\n\t\"budgetHits\": " << budgetHits
+			<< ",\n\t\"tierUpOffset\": " << (tierUpIndex < 0 ? -1 : decoded.offsets[tierUpIndex]) << ",\n\t\"jitCycles\": " << jitCycles << ",\n\t\"opcodes\": [";
+		bool first = true;
+		for (const int& i : sortedBy(opcodeCycles, 256)) {
+			if (opcodeCounts[i] == 0) continue;
+			file << (first ? "\n" : ",\n") << "\t\t{ \"name\": \"" << opcodeName(i) << "\", \"count\": " << opcodeCounts[i] << ", \"cycles\": " << opcodeCycles[i] << " }";
+			first = false;
+		}
+		file << "\n\t],\n\t\"blocks\": [";
+		first = true;
+		for (const int& i : sortedBy(blockCycles.data(), static_cast<int>(blockCycles.size()))) {
+			file << (first ? "\n" : ",\n") << "\t\t{ \"offset\": " << decoded.offsets[i] << ", \"entries\": " << blockCounts[i] << ", \"cycles\": " << blockCycles[i] << " }";
+			first = false;
+		}
+		file << "\n\t]\n}\n";
+	}
+
+	// Anything still buffered is only written out here, and that can fail too (a full disk, say)
+	file.close();
+	return !file.fail();
+}
@@ -7,6 +7,7 @@ namespace vm {
 		// 1		| PP		| Program memory pointer (points to the base of the binary file loaded into memory)
 		// 2		| FZ		| Zero flag (set automatically by arithmetic operations, zero if the result is zero, one otherwise)
 		// 3 ... 31	| R0 .. 28	| General purpose
+		// 0 ... 7	| V0 .. 7	| Vector (4 words each, only for vector instructions)
 
 		enum {
 			PP,// 0
@@ -22,5 +23,24 @@ namespace vm {
 		};
 
 		constexpr int NUM_GEN_REGISTERS = 29;
+
+		// Every register's name in the assembler, by ID
+		constexpr const char* const names[] = {
+			"PP", "BP", "FZ",
+			"R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "R8", "R9",
+			"R10", "R11", "R12", "R13", "R14", "R15", "R16", "R17", "R18", "R19",
+			"R20", "R21", "R22", "R23", "R24", "R25", "R26", "R27", "R28"
+		};
+
+		static_assert(sizeof(names) / sizeof(names[0]) == R0 + NUM_GEN_REGISTERS, "Every register needs a name");
+
+		// The vector registers are a bank of their own, with their own IDs, and only vector arguments can name them
+		constexpr int NUM_VEC_REGISTERS = 8;
+
+		constexpr const char* const vectorNames[] = {
+			"V0", "V1", "V2", "V3", "V4", "V5", "V6", "V7"
+		};
+
+		static_assert(sizeof(vectorNames) / sizeof(vectorNames[0]) == NUM_VEC_REGISTERS, "Every vector register needs a name");
 	}
 }
\ No newline at end of file
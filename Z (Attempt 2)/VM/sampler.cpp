@@ -0,0 +1,114 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+void vm::executor::Sampler::sample(const Program& program, const CallStack& calls, const DecodedProgram& decoded, const int& at) {
+	if (!hasLabels) readLabels(program);
+
+	// A return location is just past its CALL, which might be the last thing before the next label
+	stack.clear();
+	for (const types::word_t* frame = calls.start; frame < calls.top; frame++) stack.push_back(labelOf(*frame - 1));
+	stack.push_back(labelOf(decoded.offsets[at]));
+
+	// Most samples land on a stack that's been seen before, so they don't allocate
+	const std::map<std::vector<types::word_t>, counter_t>::iterator found = stacks.find(stack);
+	if (found != stacks.end()) {
+		found->second++;
+	} else {
+		stacks.emplace(stack, 1);
+	}
+}
+
+bool vm::executor::Sampler::write(const char* const& path) const {
+	std::fstream file;
+	file.open(path, std::ios::out | std::ios::trunc);
+	if (!file.is_open()) return false;
+
+	for (const std::pair<const std::vector<types::word_t>, counter_t>& pair : stacks) {
+		for (size_t i = 0; i < pair.first.size(); i++) {
+			if (i != 0) file << ';';
+			const std::vector<Label>::const_iterator label = std::lower_bound(labels.begin(), labels.end(), pair.first[i], [](const Label& label, const types::word_t& loc) {
+				return label.loc < loc;
+			});
+			if (label != labels.end() && label->loc == pair.first[i]) {
+				file << label->name;
+			} else {
+				file << pair.first[i];
+			}
+		}
+		file << " " << pair.second << "\n";
+	}
+	return !file.fail();
+}
+
+// Only trusts the symbol section as far as it fits. Globals are left out, since nothing can be running in them.
+void vm::executor::Sampler::readLabels(const Program& program) {
+	hasLabels = true;
+	if (program.symbols == nullptr) return;
+
+	const char* at = program.symbols;
+	const char* const end = at + program.symbolsSize;
+	uint32_t count;
+	if (end - at < static_cast<ptrdiff_t>(sizeof(count))) return;
+	std::memcpy(&count, at, sizeof(count));
+	at += sizeof(count);
+
+	for (uint32_t i = 0; i < count; i++) {
+		types::word_t loc;
+		uint32_t length;
+		if (end - at < static_cast<ptrdiff_t>(sizeof(loc) + sizeof(length))) return;
+		std::memcpy(&loc, at, sizeof(loc));
+		std::memcpy(&length, at + sizeof(loc), sizeof(length));
+		at += sizeof(loc) + sizeof(length);
+		if (static_cast<size_t>(end - at) < length) return;
+
+		if (loc >= program.codeStart) labels.push_back(Label{ loc, std::string(at, length) });
+		at += length;
+	}
+}
+
+// Where the label loc comes after is, or loc itself if it doesn't come after one
+vm::types::word_t vm::executor::Sampler::labelOf(const types::word_t& loc) const {
+	const std::vector<Label>::const_iterator after = std::upper_bound(labels.begin(), labels.end(), loc, [](const types::word_t& loc, const Label& label) {
+		return loc < label.loc;
+	});
+	return after == labels.begin() ? loc : (after - 1)->loc;
+}
+
+void vm::executor::writeSamples(Context& context, const ExecutorSettings& execSettings, std::ostream& stream) {
+	if (context.sampleInterval == 0) return;
+	if (!context.sampler.write(execSettings.samplePath)) {
+		stream << IO_WARN "Could not write the samples to \"" << execSettings.samplePath << "\"" IO_NORM "\n";
+	}
+	context.sampler.clear();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+vm::executor::Countdown::Countdown(const Context& context) :
+	budgetLeft(context.budget != 0 ? context.budget : std::numeric_limits<unsigned long long>::max()),
+	sampleLeft(context.sampleInterval == 0 ? std::numeric_limits<unsigned long long>::max() : context.sampler.untilNext != 0 ? context.sampler.untilNext : context.sampleInterval),
+	sampleInterval(context.sampleInterval) {
+	left = std::min(budgetLeft, sampleLeft);
+}
+
+bool vm::executor::Countdown::reached(Context& context, const int& at) {
+	const unsigned long long taken = std::min(budgetLeft, sampleLeft);
+	budgetLeft -= taken;
+	sampleLeft -= taken;
+	if (sampleLeft == 0) {
+		context.sampler.sample(context.module.program, context.calls, *context.decoded, at);
+		sampleLeft = sampleInterval;
+	}
+	if (budgetLeft == 0) {
+		// So the samples are as far apart as they would have been without the budget
+		context.sampler.untilNext = sampleLeft;
+		return true;
+	}
+
+	left = std::min(budgetLeft, sampleLeft);
+	return false;
+}
@@ -0,0 +1,189 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef __linux__
+	// epoll data for the eventfd, which no (id, fd) pair can be since fds are never negative
+	constexpr uint64_t WAKEUP = ~0ull;
+	constexpr int MAX_EVENTS = 64;
+	constexpr size_t READ_SIZE = 0x10000;
+#endif
+}
+
+vm::Scheduler::Scheduler(const executor::ExecutorSettings& settingsIn, const unsigned int& threads) :
+	settings(settingsIn),
+	unfinished(0),
+	isStopping(false)
+#ifdef __linux__
+	, poller(-1),
+	wakeup(-1)
+#endif
+{
+	const unsigned int count = std::max(1u, threads != 0 ? threads : std::thread::hardware_concurrency());
+	for (unsigned int i = 0; i < count; i++) workers.emplace_back([this]() { work(); });
+}
+
+vm::Scheduler::~Scheduler() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		isStopping = true;
+	}
+	readyCondition.notify_all();
+	for (std::thread& worker : workers) worker.join();
+
+#ifdef __linux__
+	if (pollThread.joinable()) {
+		// The poll thread stops as soon as the eventfd is readable
+		const uint64_t one = 1;
+		while (write(wakeup, &one, sizeof(one)) != sizeof(one) && errno == EINTR);
+		pollThread.join();
+		::close(wakeup);
+		::close(poller);
+	}
+#endif
+}
+
+int vm::Scheduler::add(Context& context, std::ostream& streamOut, const Done& done) {
+	std::lock_guard<std::mutex> lock(mutex);
+	const int id = static_cast<int>(tasks.size());
+	tasks.emplace_back(new Task(context, streamOut, done));
+	unfinished++;
+	ready.push_back(id);
+	readyCondition.notify_one();
+	return id;
+}
+
+void vm::Scheduler::feed(const int& id, const char* const& data, const size_t& length) {
+	std::lock_guard<std::mutex> lock(mutex);
+	Task& task = *tasks[id];
+	if (task.state == State::DONE) return;
+	task.pending.append(data, length);
+	makeReady(id);
+}
+
+void vm::Scheduler::close(const int& id) {
+	std::lock_guard<std::mutex> lock(mutex);
+	Task& task = *tasks[id];
+	if (task.state == State::DONE) return;
+	task.isClosed = true;
+	makeReady(id);
+}
+
+void vm::Scheduler::wait() {
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCondition.wait(lock, [this]() { return unfinished == 0; });
+}
+
+// With the lock held
+void vm::Scheduler::makeReady(const int& id) {
+	Task& task = *tasks[id];
+	if (task.state != State::WAITING) return;
+	task.state = State::READY;
+	ready.push_back(id);
+	readyCondition.notify_one();
+}
+
+void vm::Scheduler::work() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		readyCondition.wait(lock, [this]() { return isStopping || !ready.empty(); });
+		if (isStopping) return;
+
+		const int id = ready.front();
+		ready.pop_front();
+		Task& task = *tasks[id];
+		task.state = State::RUNNING;
+		// Only this thread touches the Context until it stops again, so its input is handed over here
+		task.context.input.feed(task.pending.data(), task.pending.size());
+		task.pending.clear();
+		if (task.isClosed) task.context.input.close();
+		lock.unlock();
+
+		int result = executor::RUN_HALTED;
+		std::exception_ptr error;
+		try {
+			result = task.context.resume(settings, task.streamOut);
+		} catch (...) {
+			error = std::current_exception();
+		}
+		if (result == executor::RUN_HALTED && task.done) task.done(task.context, error);
+
+		lock.lock();
+		if (result == executor::RUN_PREEMPTED) {
+			// Behind everything that became ready while it ran
+			task.state = State::READY;
+			ready.push_back(id);
+			readyCondition.notify_one();
+		} else if (result == executor::RUN_WAITING) {
+			task.state = State::WAITING;
+			// Whatever came in while it was running may already be what it's waiting for
+			if (!task.pending.empty() || task.isClosed) makeReady(id);
+		} else {
+			task.state = State::DONE;
+			std::string().swap(task.pending);
+			unfinished--;
+			doneCondition.notify_all();
+		}
+	}
+}
+
+#ifdef __linux__
+void vm::Scheduler::watch(const int& id, const int& fd) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (poller < 0) {
+			poller = epoll_create1(EPOLL_CLOEXEC);
+			wakeup = eventfd(0, EFD_CLOEXEC);
+			if (poller < 0 || wakeup < 0) throw std::runtime_error("Could not start polling for input");
+
+			epoll_event event = {};
+			event.events = EPOLLIN;
+			event.data.u64 = WAKEUP;
+			epoll_ctl(poller, EPOLL_CTL_ADD, wakeup, &event);
+			pollThread = std::thread([this]() { pollInput(); });
+		}
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.u64 = (static_cast<uint64_t>(id) << 32) | static_cast<uint32_t>(fd);
+	if (epoll_ctl(poller, EPOLL_CTL_ADD, fd, &event) != 0) throw std::runtime_error("Could not watch the file descriptor for input");
+}
+
+void vm::Scheduler::pollInput() {
+	epoll_event events[MAX_EVENTS];
+	std::vector<char> buffer(READ_SIZE);
+
+	while (true) {
+		const int count = epoll_wait(poller, events, MAX_EVENTS, -1);
+		if (count < 0 && errno == EINTR) continue;
+		if (count < 0) return;
+
+		for (int i = 0; i < count; i++) {
+			if (events[i].data.u64 == WAKEUP) return;
+			const int id = static_cast<int>(events[i].data.u64 >> 32);
+			const int fd = static_cast<int>(events[i].data.u64 & 0xffffffff);
+
+			// Everything that's there now, so it isn't reported again for the same data
+			ssize_t got;
+			while ((got = read(fd, buffer.data(), buffer.size())) > 0) feed(id, buffer.data(), static_cast<size_t>(got));
+			if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+				epoll_ctl(poller, EPOLL_CTL_DEL, fd, nullptr);
+				::close(fd);
+				close(id);
+			}
+		}
+	}
+}
+#endif
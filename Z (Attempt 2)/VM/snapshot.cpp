@@ -0,0 +1,227 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <new>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	// The largest arena state restore() will read (it's normally a few hundred bytes)
+	constexpr uint32_t MAX_ARENA_SIZE = 0x1000000;
+	// How much of a Memory is committed at a time on Windows, so a run of small takes doesn't make a call each
+	constexpr size_t COMMIT_SIZE = 0x10000;
+	static_assert(vm::executor::Memory::CAPACITY % COMMIT_SIZE == 0, "Committing never goes past the reservation");
+	// The vector registers come straight after the others, so both are written in one go
+	constexpr size_t REGISTERS_SIZE = vm::executor::NUM_REGISTERS * sizeof(vm::executor::Value) + vm::executor::NUM_VECTOR_REGISTERS * sizeof(vm::executor::Vector);
+
+	uint64_t mix(uint64_t hash, const uint64_t& value) {
+		hash = (hash ^ value) * 0x9E3779B97F4A7C15ull;
+		return hash ^ (hash >> 29);
+	}
+
+	// Identifies the program (as loaded, before it ran) and the stack size, since both decide where everything is
+	uint64_t programHash(const vm::executor::Program& program, const size_t& stackSize) {
+		uint64_t hash = mix(vm::format::SNAPSHOT_VERSION, vm::opcode::count);
+		hash = mix(hash, static_cast<uint64_t>(program.bssSize));
+		hash = mix(hash, stackSize);
+
+		const char* p = program.start;
+		size_t length = program.end - program.start;
+		hash = mix(hash, length);
+		for (; length >= sizeof(uint64_t); p += sizeof(uint64_t), length -= sizeof(uint64_t)) {
+			uint64_t word;
+			std::memcpy(&word, p, sizeof(word));
+			hash = mix(hash, word);
+		}
+		for (; length > 0; p++, length--) hash = mix(hash, static_cast<unsigned char>(*p));
+
+		return hash;
+	}
+
+	// Replaces to with from, in one step. A snapshot that is mapped in keeps the old file until it is unmapped.
+	bool replaceFile(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+		return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Memory
+
+vm::executor::Memory::Memory(const bool& fixed) : used(NULL_SIZE), committed(0) {
+	void* const hint = fixed ? reinterpret_cast<void*>(FIXED_BASE) : nullptr;
+#ifdef _WIN32
+	// Only reserved, so a small program doesn't tie up CAPACITY bytes of the commit limit. Pages are committed as
+	// the memory is taken (the first ones straight away, since the NULL_SIZE bytes at the start can still be read).
+	base = static_cast<char*>(VirtualAlloc(hint, CAPACITY, MEM_RESERVE, PAGE_READWRITE));
+	if (base == nullptr && fixed) base = static_cast<char*>(VirtualAlloc(nullptr, CAPACITY, MEM_RESERVE, PAGE_READWRITE));
+	if (base != nullptr && !commit(used)) {
+		VirtualFree(base, 0, MEM_RELEASE);
+		base = nullptr;
+	}
+#else
+	// Only a hint, so anything already there is left alone (and the memory just can't be snapshotted)
+	void* mem = mmap(hint, CAPACITY, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	base = mem == MAP_FAILED ? nullptr : static_cast<char*>(mem);
+#endif
+	isFixed = fixed && reinterpret_cast<uintptr_t>(base) == FIXED_BASE;
+	if (base == nullptr) throw ExecutorException(ExecutorException::BAD_ALLOC, 0, "Could not reserve memory for the program");
+}
+
+vm::executor::Memory::~Memory() {
+#ifdef _WIN32
+	VirtualFree(base, 0, MEM_RELEASE);
+#else
+	munmap(base, CAPACITY);
+#endif
+}
+
+char* vm::executor::Memory::take(const size_t& size) {
+	const size_t start = (used + 15) & ~static_cast<size_t>(15);
+	if (start > CAPACITY || size > CAPACITY - start || !commit(start + size)) throw std::bad_alloc();
+	used = start + size;
+	return base + start;
+}
+
+bool vm::executor::Memory::commit(const size_t& size) {
+#ifdef _WIN32
+	if (size > CAPACITY) return false;
+	if (size <= committed) return true;
+	const size_t end = (size + COMMIT_SIZE - 1) / COMMIT_SIZE * COMMIT_SIZE;
+	if (VirtualAlloc(base + committed, end - committed, MEM_COMMIT, PAGE_READWRITE) == nullptr) return false;
+	committed = end;
+	return true;
+#else
+	return size <= CAPACITY;
+#endif
+}
+
+bool vm::executor::Memory::restore(std::istream& file, const char* const& path, const uint64_t& offset, const size_t& size) {
+	if (size > CAPACITY) return false;
+
+#ifndef _WIN32
+	// Mapping the file over the start of the memory means only the pages the program touches are ever read
+	const int fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		const size_t mappedSize = (size + pageSize - 1) / pageSize * pageSize;
+		void* mem = size == 0 ? MAP_FAILED : mmap(base, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, static_cast<off_t>(offset));
+		close(fd);
+		if (mem == base) {
+			used = size;
+			return true;
+		}
+		// MAP_FIXED may have already thrown the old pages away, so put fresh ones back before reading in
+		if (size != 0) mmap(base, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+	}
+#endif
+
+	if (!commit(size)) return false;
+	file.clear();
+	file.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+	if (!file.read(base, static_cast<std::streamsize>(size))) return false;
+	used = size;
+	return true;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Context
+
+bool vm::Context::snapshot(const char* const& path, const types::word_t& resumeLoc) {
+	if (!memory->isFixed) return false;
+	// Everything printed so far belongs to this run, not to the ones that resume from it
+	output.flush();
+
+	std::vector<char> arenaState;
+	arena.save(arenaState);
+
+	format::SnapshotHeader header;
+	std::copy(format::SNAPSHOT_MAGIC, format::SNAPSHOT_MAGIC + 4, header.magic);
+	header.version = format::SNAPSHOT_VERSION;
+	header.programHash = programHash(module.program, stack.end - stack.start);
+	header.base = reinterpret_cast<uint64_t>(memory->base);
+	const size_t stateEnd = sizeof(header) + REGISTERS_SIZE + arenaState.size();
+	header.memoryOffset = (stateEnd + format::SNAPSHOT_ALIGN - 1) / format::SNAPSHOT_ALIGN * format::SNAPSHOT_ALIGN;
+	header.memorySize = memory->used;
+	header.arenaSize = static_cast<uint32_t>(arenaState.size());
+	header.resumeLoc = resumeLoc;
+	header.callDepth = static_cast<uint32_t>(calls.top - calls.start);
+	header.unused = 0;
+
+	const std::string temporaryPath = std::string(path) + ".tmp";
+	{
+		std::fstream file;
+		file.open(temporaryPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) return false;
+
+		const std::vector<char> padding(static_cast<size_t>(header.memoryOffset - stateEnd), 0);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(reg), REGISTERS_SIZE);
+		file.write(arenaState.data(), arenaState.size());
+		file.write(padding.data(), padding.size());
+		file.write(memory->base, memory->used);
+		if (!file.good()) {
+			file.close();
+			std::remove(temporaryPath.c_str());
+			return false;
+		}
+	}
+	if (!replaceFile(temporaryPath, path)) {
+		std::remove(temporaryPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool vm::Context::restore(const char* const& path) {
+	if (!memory->isFixed) return false;
+
+	std::fstream file;
+	file.open(path, std::ios::in | std::ios::binary);
+	if (!file.is_open()) return false;
+
+	file.seekg(0, std::ios::end);
+	const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+	file.seekg(0, std::ios::beg);
+
+	format::SnapshotHeader header;
+	if (fileSize < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+	if (!std::equal(header.magic, header.magic + 4, format::SNAPSHOT_MAGIC) || header.version != format::SNAPSHOT_VERSION) return false;
+	if (header.programHash != programHash(module.program, stack.end - stack.start) || header.base != reinterpret_cast<uint64_t>(memory->base)) return false;
+	// Everything the Context took when it was created has to be there, in a file that has all of it
+	if (header.arenaSize > MAX_ARENA_SIZE || header.memoryOffset % format::SNAPSHOT_ALIGN != 0 ||
+		header.memoryOffset < sizeof(header) + REGISTERS_SIZE + header.arenaSize ||
+		header.memorySize < memory->used || header.memorySize > executor::Memory::CAPACITY || header.callDepth > static_cast<uint32_t>(calls.end - calls.start) ||
+		header.memoryOffset > fileSize || header.memorySize > fileSize - header.memoryOffset) return false;
+
+	char savedReg[REGISTERS_SIZE];
+	std::vector<char> arenaState(header.arenaSize);
+	if (!file.read(savedReg, sizeof(savedReg)) || !file.read(arenaState.data(), arenaState.size())) return false;
+
+	// From here on the Context's own memory is replaced, so any failure has to reset it
+	arena.release();
+	if (!memory->restore(file, path, header.memoryOffset, static_cast<size_t>(header.memorySize)) ||
+		!arena.load(arenaState.data(), arenaState.size())) {
+		// The image may have been overwritten past the globals too, so it starts again from scratch
+		std::fill(image, image + imageSize, charFiller);
+		reset();
+		return false;
+	}
+
+	std::memcpy(reg, savedReg, sizeof(savedReg));
+	calls.top = calls.start + header.callDepth;
+	entry = resolve(header.resumeLoc);
+	return true;
+}
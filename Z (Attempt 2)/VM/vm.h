@@ -4,16 +4,57 @@
 #include "opcode.h"
 #include "register.h"
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 namespace vm {
 	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
 	// Flags
 	constexpr int FLAG_DEBUG = 1;
 	constexpr int FLAG_PROFILE = 2;
+	constexpr int FLAG_FUSE = 4;
+	constexpr int FLAG_JIT = 8;
+	constexpr int FLAG_PREDECODE = 16;
+	constexpr int FLAG_OPTIMIZE = 32;
+
+	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+	// Compiler features
+	// Labels-as-values (computed goto) for the threaded executor; MSVC doesn't have them, so it always uses the switch
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_THREADED_DISPATCH
+#endif
+	// The JIT emits x86-64 machine code; everywhere else FLAG_JIT just uses the interpreter
+#if defined(__x86_64__) || defined(_M_X64)
+#define VM_JIT
+#endif
 
 	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
 	// Types
 	namespace types {
-		// 32-bit word: addresses, integers
+		// 32-bit word: addresses (offsets into the Context's Memory, so they fit whatever size the host's pointers are), integers
 		typedef int32_t word_t;
 		// 8-bit byte: register IDs, opcode IDs, chars
 		typedef int8_t byte_t;
@@ -31,8 +72,6 @@ namespace vm {
 		typedef int8_t char_t;
 		// Bool: byte
 		typedef int8_t bool_t;
-
-		static_assert(sizeof(std::intptr_t) == sizeof(word_t), "No workaround for non-word-size (32-bit) pointers");
 	}
 
 	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -44,6 +83,62 @@ namespace vm {
 	namespace format {
 		constexpr int FIRST_INSTR_ADDR_LOCATION = 0;
 		constexpr int GLOBAL_TABLE_LOCATION = 4;
+
+		// Version 2 files start with a Header and a table of Sections. Anything without the magic number is a version
+		// 1 file, which is nothing but the image (the entry word, then the globals, then the code).
+		constexpr char MAGIC[4] = { '\x7f', 'E', 'Z', 'E' };
+		constexpr uint32_t VERSION = 2;
+		// Sections that get mapped start on a page, and the data ends on one, so the code after it is page-aligned
+		// and the whole image can be used straight from the mapped file
+		constexpr uint32_t PAGE_SIZE = 0x1000;
+
+		enum SectionType : uint32_t {
+			SECTION_DATA = 1,	// The start of the image: the entry word and the globals
+			SECTION_CODE,		// The rest of the image, straight after the data in the file
+			SECTION_BSS,		// Zeroed bytes after the image (only the size is stored)
+			SECTION_SYMBOLS,	// Every label and global's name and offset in the image
+			SECTION_DECODED		// Optional: the program already decoded, for one set of decoder settings
+		};
+
+		constexpr uint32_t SECTION_READ_ONLY = 1;
+
+		struct Header {
+			char magic[4];
+			uint32_t version;
+			uint32_t sectionCount;// Sections straight after the header
+			uint32_t entry;// Same as the entry word
+		};
+
+		struct Section {
+			uint32_t type;
+			uint32_t flags;
+			uint32_t offset;// From the start of the file
+			uint32_t size;
+		};
+
+		static_assert(sizeof(Header) == 16 && sizeof(Section) == 16, "The header and section table are read straight from the file");
+
+		// A snapshot (written by SNAPSHOT) is a SnapshotHeader, the registers (then the vector registers), the arena's
+		// state, and then everything in the context's Memory, starting on a SNAPSHOT_ALIGN boundary so it can be mapped
+		// straight back in
+		constexpr char SNAPSHOT_MAGIC[4] = { '\x7f', 'E', 'Z', 'S' };
+		constexpr uint32_t SNAPSHOT_VERSION = 3;
+		constexpr uint32_t SNAPSHOT_ALIGN = 0x10000;
+
+		struct SnapshotHeader {
+			char magic[4];
+			uint32_t version;
+			uint64_t programHash;// Of the image and stack size it was made with
+			uint64_t base;// Where the memory was (and has to be again)
+			uint64_t memoryOffset;// From the start of the file
+			uint64_t memorySize;
+			uint32_t arenaSize;// Bytes of arena state after the registers
+			int32_t resumeLoc;// Byte offset of the instruction after the SNAPSHOT
+			uint32_t callDepth;// Return locations on the CallStack (which is in the memory)
+			uint32_t unused;// Always 0
+		};
+
+		static_assert(sizeof(SnapshotHeader) == 56, "The snapshot header is read straight from the file");
 	}
 
 	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -90,11 +185,12 @@ namespace vm {
 			const int line;
 			const int column;
 			std::string extra;
+			size_t file;// Which of the sources it was in, when assembling more than one
 
-			AssemblerException(const ErrorType& eTypeIn, const int& lineIn, const int& columnIn) : eType(eTypeIn), line(lineIn), column(columnIn), extra("") {}
-			AssemblerException(const ErrorType& eTypeIn, const int& lineIn, const int& columnIn, char* const& extraIn) : eType(eTypeIn), line(lineIn), column(columnIn), extra(extraIn) {}
-			AssemblerException(const ErrorType& eTypeIn, const int& lineIn, const int& columnIn, const char* const& extraIn) : eType(eTypeIn), line(lineIn), column(columnIn), extra(extraIn) {}
-			AssemblerException(const ErrorType& eTypeIn, const int& lineIn, const int& columnIn, const std::string& extraIn) : eType(eTypeIn), line(lineIn), column(columnIn), extra(extraIn) {}
+			AssemblerException(const ErrorType& eTypeIn, const int& lineIn, const int& columnIn) : eType(eTypeIn), line(lineIn), column(columnIn), extra(""), file(0) {}
+			AssemblerException(const ErrorType& eTypeIn, const int& lineIn, const int& columnIn, char* const& extraIn) : eType(eTypeIn), line(lineIn), column(columnIn), extra(extraIn), file(0) {}
+			AssemblerException(const ErrorType& eTypeIn, const int& lineIn, const int& columnIn, const char* const& extraIn) : eType(eTypeIn), line(lineIn), column(columnIn), extra(extraIn), file(0) {}
+			AssemblerException(const ErrorType& eTypeIn, const int& lineIn, const int& columnIn, const std::string& extraIn) : eType(eTypeIn), line(lineIn), column(columnIn), extra(extraIn), file(0) {}
 
 
 			virtual const char* what() {
@@ -110,17 +206,193 @@ namespace vm {
 
 		struct AssemblerSettings {
 			Flags flags;
+			unsigned int threads;// Threads for assembling big files in chunks (0 for one per core)
+			const char* cachePath;// Directory of previously assembled programs (nullptr to always assemble)
+			unsigned long long cacheLimit;// Bytes the cache can hold before the least recently used programs are removed (0 for no limit)
+
+			// With FLAG_PREDECODE, the program is also decoded into the output, with fusion if FLAG_FUSE is set
+			AssemblerSettings() : flags(FLAG_FUSE), threads(0), cachePath(nullptr), cacheLimit(0) {}
 		};
 
 		constexpr int MAX_STR_SIZE = 256;
 
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Lookup
+
+		// Characters that live somewhere else (normally the assembly source), so that tokens and labels are never copied
+		struct StringView {
+			const char* data;
+			size_t length;
+
+			constexpr StringView() : data(nullptr), length(0) {}
+			constexpr StringView(const char* const& dataIn, const size_t& lengthIn) : data(dataIn), length(lengthIn) {}
+
+			bool operator==(const StringView& other) const {
+				return length == other.length && std::memcmp(data, other.data, length) == 0;
+			}
+
+			// FNV-1a
+			struct Hash {
+				size_t operator()(const StringView& str) const {
+					uint32_t out = 2166136261u;
+					for (size_t i = 0; i < str.length; i++) out = (out ^ static_cast<unsigned char>(str.data[i])) * 16777619u;
+					return out;
+				}
+			};
+		};
+
+		inline std::ostream& operator<<(std::ostream& stream, const StringView& str) {
+			return stream.write(str.data, str.length);
+		}
+
+		// Maps each of a fixed list of names to its index in that list. The seed is searched for at compile time so that
+		// every name hashes to its own slot, which makes a lookup one hash and at most one comparison.
+		template<int N, int SIZE>
+		class PerfectHash {
+			static_assert((SIZE & (SIZE - 1)) == 0, "The table size must be a power of two");
+			static_assert(N < 0xFF, "Slots are bytes, and 0xFF marks an empty one");
+
+		public:
+			constexpr PerfectHash(const char* const (&namesIn)[N]) : names(namesIn), lengths(), seed(0), slots() {
+				for (int i = 0; i < N; i++) {
+					while (names[i][lengths[i]] != '\0') lengths[i]++;
+				}
+				while (!isCollisionFree(names, lengths, seed)) seed++;
+
+				for (int i = 0; i < SIZE; i++) slots[i] = EMPTY;
+				for (int i = 0; i < N; i++) slots[slot(seed, names[i], lengths[i])] = static_cast<unsigned char>(i);
+			}
+
+			// Returns the index of the name, or -1 if it isn't in the list
+			int find(const char* const& str, const size_t& length) const {
+				const unsigned char i = slots[slot(seed, str, length)];
+				if (i == EMPTY || lengths[i] != length || std::memcmp(names[i], str, length) != 0) return -1;
+				return i;
+			}
+
+		private:
+			static constexpr unsigned char EMPTY = 0xFF;
+
+			const char* const* names;
+			size_t lengths[N];
+			unsigned int seed;
+			unsigned char slots[SIZE];
+
+			static constexpr unsigned int slot(const unsigned int& seed, const char* const& str, const size_t& length) {
+				unsigned int out = 2166136261u ^ (seed * 0x9E3779B9u);
+				for (size_t i = 0; i < length; i++) out = (out ^ static_cast<unsigned char>(str[i])) * 16777619u;
+				out ^= out >> 15;
+				return out & (SIZE - 1);
+			}
+
+			static constexpr bool isCollisionFree(const char* const* const& names, const size_t* const& lengths, const unsigned int& seed) {
+				for (int i = 0; i < N; i++) {
+					for (int j = i + 1; j < N; j++) {
+						if (slot(seed, names[i], lengths[i]) == slot(seed, names[j], lengths[j])) return false;
+					}
+				}
+				return true;
+			}
+		};
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Assembling
+
+		// Part of a program that hasn't been placed yet: its globals, then its instructions, with every label it
+		// defines and every reference it makes. Positions are all relative to the start of bytes.
+		struct Fragment {
+			struct Ref {
+				size_t pos;
+				int line;
+				int column;
+
+				Ref(const size_t& posIn, const int& lineIn, const int& columnIn) : pos(posIn), line(lineIn), column(columnIn) {}
+			};
+
+			struct Label {
+				size_t pos;
+				bool isDef;
+				std::vector<Ref> refs;
+
+				Label() : pos(0), isDef(false) {}
+			};
+
+			std::vector<char> bytes;
+			size_t globalsSize;// Everything before this is globals, and everything after is instructions
+			bool hasCode;
+			std::unordered_map<StringView, Label, StringView::Hash> labels;// Names point into the source, or into names
+			std::deque<std::string> names;
+
+			size_t file;// Which source it came from
+			int lines;// Lines in the source
+			int firstLine;// Where the source starts in its file, for errors found while linking
+			int firstGlobalLine;// -1 if there are no globals
+			int firstGlobalColumn;
+			// The source ended between two instructions, outside any string, comment or parenthesis, so a source that
+			// carries on from it can be assembled on its own
+			bool isClean;
+
+			Fragment() : globalsSize(0), hasCode(false), file(0), lines(0), firstLine(0), firstGlobalLine(-1), firstGlobalColumn(-1), isClean(true) {}
+		};
+
+		struct Symbol {
+			StringView name;
+			types::word_t value;
+		};
+
+		// A program once its fragments have been linked, before it's written out
+		struct Linked {
+			std::vector<char> image;
+			size_t codeStart;// Where the instructions start in image
+			std::vector<Symbol> symbols;// Every label and global that is defined, in order of where they are in image
+			std::vector<size_t> relocations;// Everywhere in image that holds the address of a label or global
+		};
+
 		int assemble(const char* const& assemblyPath, const char* const& outputPath, AssemblerSettings& assemblerSettings);
+		// Also leaves the assembled program in output, so it can be run without reading the file back in
+		int assemble(const char* const& assemblyPath, const char* const& outputPath, AssemblerSettings& assemblerSettings, std::vector<char>& output);
+		// Assembles every file into a fragment of its own and links them, in order, into one program
+		int assemble(const std::vector<const char*>& assemblyPaths, const char* const& outputPath, AssemblerSettings& assemblerSettings);
+		// Reads the whole of assemblyFile in large blocks, then assembles it from memory
 		int assemble_(std::iostream& assemblyFile, std::iostream& outputFile, AssemblerSettings& assemblerSettings, std::ostream& stream);
+		// Assembles source into output (which is cleared first), filling in every label before returning
+		int assemble_(const char* const& source, const size_t& sourceLength, std::vector<char>& output, AssemblerSettings& assemblerSettings, std::ostream& stream);
+		// Big sources are split into chunks at labels, and all the chunks are assembled across a pool of threads
+		int assemble_(const std::vector<StringView>& sources, std::vector<char>& output, AssemblerSettings& assemblerSettings, std::ostream& stream);
+		void assembleFragment(const char* const& source, const size_t& sourceLength, Fragment& fragment, AssemblerSettings& assemblerSettings, std::ostream& stream);
+		// Lays the fragments out one after another (all of their globals first, then all of their instructions), and
+		// fills in every reference. The program starts at the first instruction of the first fragment that has any.
+		void link(const std::vector<Fragment>& fragments, Linked& program);
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Optimizing
+
+		// With FLAG_OPTIMIZE: folds constants, propagates copies, and removes dead instructions and unreachable code,
+		// then lays the instructions out again and fixes every relocation. Returns false (leaving the program as it
+		// was) if the program uses code addresses that don't come from labels, since they can't be moved.
+		bool optimize(Linked& program, AssemblerSettings& assemblerSettings, std::ostream& stream);
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Output
+
+		// Wraps a linked program in a version 2 .eze file (see format::Header), decoding it too with FLAG_PREDECODE
+		void writeContainer(const Linked& program, AssemblerSettings& assemblerSettings, std::vector<char>& output);
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Cache
+
+		// Assembled programs are stored under a hash of their sources and the settings they were assembled with
+		uint64_t cacheKey(const std::vector<StringView>& sources, const AssemblerSettings& assemblerSettings);
+		// Returns false if there's nothing stored under key
+		bool loadCached(const char* const& dir, const uint64_t& key, std::vector<char>& output);
+		// Stores output under key, then removes the least recently used programs until the cache fits in limit bytes
+		bool storeCached(const char* const& dir, const uint64_t& key, const std::vector<char>& output, const unsigned long long& limit);
 
 		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
 		// Parsing
 
-		types::reg_t parseRegister(char* const& str, const int& strlen, const int& line, const int& column);
+		types::reg_t parseRegister(const char* const& str, const int& strlen, const int& line, const int& column);
+		types::reg_t parseVectorRegister(const char* const& str, const int& strlen, const int& line, const int& column);
 		template<typename T, AssemblerException::ErrorType eType>
 		T parseNumber(const char* str, int strlen, const int& line, const int& column);
 		
@@ -133,19 +405,33 @@ namespace vm {
 
 	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
 	// Executor
+	class Context;
+
 	namespace executor {
 		class ExecutorException : public std::exception {
 		public:
 			enum ErrorType {
 				UNKNOWN_OPCODE,
 				DIVIDE_BY_ZERO, 
-				BAD_ALLOC
+				BAD_ALLOC,
+				BAD_FORMAT,
+				BAD_REGISTER,
+				TRUNCATED_INSTRUCTION,
+				CALL_STACK_OVERFLOW,
+				RETURN_WITHOUT_CALL,
+				INPUT_TOO_LONG
 			};
 
 			static constexpr const char* const errorStrings[] = {
 				"Unknown opcode",
 				"Division (or modulo) by zero",
-				"Dynamic memory allocation error"
+				"Dynamic memory allocation error",
+				"Invalid .eze file",
+				"Invalid register",
+				"Instruction runs past the end of the program",
+				"Too many nested calls",
+				"Return without a call",
+				"Input line doesn't fit in the buffer"
 			};
 
 			const ErrorType eType;
@@ -169,11 +455,39 @@ namespace vm {
 			}
 		};
 
+		enum class Dispatch {
+			SWITCH,		// One switch over the opcode per instruction
+			THREADED	// Computed goto from each handler to the next (falls back to SWITCH without VM_THREADED_DISPATCH)
+		};
+
+		constexpr const char* const dispatchStrings[] = {
+			"switch",
+			"threaded"
+		};
+
 		struct ExecutorSettings {
 			Flags flags;
 			unsigned int stackSize;
+			Dispatch dispatch;
+			const char* profilePath;// With FLAG_PROFILE, also write the profile here (.csv for CSV, JSON otherwise)
+			unsigned int jitThreshold;// With FLAG_JIT, how many times a loop has to run before it is compiled (0 compiles everything up front)
+			unsigned int threads;// Worker threads for execBatch (0 for one per core)
+			unsigned int flushSize;// Bytes of output buffered before it is written out (0 writes every print straight away)
+			const char* snapshotPath;// Restored from before running if it's there, and written by SNAPSHOT if not (nullptr for neither)
+			unsigned int benchRuns;// Timed runs of each program on each engine, for benchmark
+			unsigned int budget;// Backward and dynamic jumps a run can take before it is preempted (0 for no limit)
+			unsigned int sampleInterval;// Backward and dynamic jumps between samples of the call stack (0 to not sample)
+			const char* samplePath;// Where the samples are written once the program halts, as collapsed stacks
+
+			ExecutorSettings() : flags(FLAG_FUSE), stackSize(0x1000), dispatch(Dispatch::THREADED), profilePath(nullptr), jitThreshold(1000), threads(0), flushSize(0x10000), snapshotPath(nullptr), benchRuns(20), budget(0), sampleInterval(0), samplePath(nullptr) {}
+		};
 
-			ExecutorSettings() : stackSize(0x1000) {}
+		// What a run returns: it either halted, stopped to wait for more input (only in Context::resume), or used up
+		// its budget. The last two carry on from where they stopped the next time the Context is run.
+		enum RunResult {
+			RUN_HALTED,
+			RUN_WAITING,
+			RUN_PREEMPTED
 		};
 
 		union Value {
@@ -188,62 +502,1048 @@ namespace vm {
 			Value() : word(0) {}
 		};
 
+		// The register file is kept to whole cache lines, starting on one, so the registers every instruction
+		// touches never share a line with anything else
+		constexpr size_t CACHE_LINE = 64;
+		constexpr size_t NUM_REGISTERS = register_::R0 + register_::NUM_GEN_REGISTERS;
+		static_assert(sizeof(Value) == sizeof(types::word_t), "Registers are one word each");
+		static_assert(NUM_REGISTERS * sizeof(Value) % CACHE_LINE == 0, "The register file should be whole cache lines");
+
+		// A vector register: VECTOR_LANES words, worked on all at once by the vector instructions. They go straight
+		// after the registers, so they start on a cache line too.
+		constexpr size_t VECTOR_LANES = 4;
+		constexpr size_t NUM_VECTOR_REGISTERS = register_::NUM_VEC_REGISTERS;
+
+		struct alignas(16) Vector {
+			types::word_t lanes[VECTOR_LANES];
+		};
+
+		static_assert(sizeof(Vector) == 16, "Vector registers are 128 bits, the width SSE2 and NEON both have");
+
 		class Program {
+		public:
+			// HALTs after the image (and bss) in each Context's copy of it, for programs that read a little past their
+			// globals. This is the only padding there is: the Program itself has none.
 			static constexpr int FILLER_SIZE = 24;
 
-		public:
+			// The image, which PP points at. For a version 2 file this is the data and code sections, which are next
+			// to each other in the file.
 			char* start;
-			char* ip;
 			char* end;
 
-			Program(std::iostream& program) {
+			uint32_t version;
+			types::word_t bssSize;// Zeroed bytes that go after the image
+			types::word_t codeStart;// Byte offset in the image where the code section starts (0 for version 1)
+			const char* symbols;// The symbol section (nullptr if there isn't one)
+			size_t symbolsSize;
+			const char* decodedSection;// The pre-decoded section (nullptr if there isn't one)
+			size_t decodedSize;
+
+			// Maps the file copy-on-write, so the pages are shared between every VM running it until one is written
+			// to. The mapping doesn't need any padding: the decoder never reads past end (it checks that every
+			// instruction fits, and turns one that doesn't into an INVALID), and the program itself only ever sees
+			// its Context's copy of the image, which is padded with FILLER_SIZE HALTs. Falls back to reading the file
+			// like the stream constructor, and throws BAD_FORMAT if it can't be opened at all.
+			Program(const char* const& path);
+
+			Program(std::istream& program) : mappedSize(0) {
+				load(program);
+				findImage();
+			}
+
+			// Copies a program that is already in memory, such as the assembler's output
+			Program(const std::vector<char>& program) : mappedSize(0) {
+				base = new char[program.size()];
+				size = program.size();
+
+				std::copy(program.begin(), program.end(), base);
+				findImage();
+			}
+
+			~Program();
+
+		private:
+			char* base;// The whole file
+			size_t size;
+			size_t mappedSize;// 0 if base was allocated with new[]
+
+			void load(std::istream& program) {
 				// https://stackoverflow.com/questions/22984956/tellg-function-give-wrong-size-of-file
 				program.seekg(0, std::ios::beg);
 				program.ignore(std::numeric_limits<std::streamsize>::max());
 				std::streamsize length = program.gcount();
 
-				start = new char[length + FILLER_SIZE];
-				ip = start;
-				end = start + length;
+				base = new char[length];
+				size = static_cast<size_t>(length);
 
 				program.clear();
 				program.seekg(0, std::ios::beg);
-				program.read(start, length);
+				program.read(base, length);
+			}
+
+			// Finds the image and sections in the file, throwing BAD_FORMAT (after freeing it) if they don't fit
+			void findImage();
+			// Returns what's wrong with the file, or nullptr if nothing is
+			const char* parse();
+			void release();
+		};
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Decoding
 
-				std::fill(start + length, start + length + FILLER_SIZE, charFiller);
+		// A fixed-width instruction, decoded once at load time. Register arguments fill r1, r2, r3 in the order they
+		// appear in the bytecode, and the word/byte/short argument (if any) is sign-extended into imm. For static jumps
+		// imm holds the index of the target in the decoded stream instead of a byte offset.
+		struct Instr {
+			types::opcode_t opcode;
+			types::reg_t r1;
+			types::reg_t r2;
+			types::reg_t r3;
+			types::word_t imm;
+
+			Instr() : opcode(opcode::NOP), r1(0), r2(0), r3(0), imm(0) {}
+			Instr(types::opcode_t opcodeIn, types::word_t immIn) : opcode(opcodeIn), r1(0), r2(0), r3(0), imm(immIn) {}
+
+			// CALL has no registers, so its frame size goes in r2 and r3 (imm is its target)
+			types::short_t frameSize() const {
+				return static_cast<types::short_t>(r2 | r3 << 8);
 			}
 
-			~Program() {
-				delete[] start;
+			void setFrameSize(const types::short_t& size) {
+				r2 = static_cast<types::reg_t>(size);
+				r3 = static_cast<types::reg_t>(static_cast<uint16_t>(size) >> 8);
+			}
+		};
+
+		static_assert(sizeof(Instr) == 8, "Decoded instructions should be packed into 8 bytes");
+
+		// The decoded form of a Program. The .eze format doesn't say where the global table stops and the code starts,
+		// so code is found by following control flow from the entry point, plus any word immediate that could be a
+		// label address (return addresses and the like). Anything jumped to dynamically that wasn't found that way is
+		// decoded on demand. Each run of decoded code ends in a terminator, or in a JMP to code that was already decoded.
+		// With fusion on, common instruction pairs within a run are replaced by a single superinstruction. Only the
+		// first instruction of a fused pair gets an index, so a jump to the second one just decodes it again on its own.
+		// Fusion also swaps arithmetic for its flagless form (see opcode::withoutFlag) wherever FZ is dead afterwards.
+		// Any instruction that names FZ as a register is put between an FZ_SPILL and an FZ_FILL (and never fused), or
+		// another FZ_SPILL if it sets the flag.
+		//
+		// Decoding also verifies everything the executor relies on, so it never checks any of it while running: every
+		// register argument is a real register, every instruction fits inside the program, and every static jump goes
+		// to the start of a decoded instruction (a jump into the middle of one decodes a new run from there). An
+		// instruction that fails is replaced by an INVALID whose imm is the ExecutorException::ErrorType it throws, so
+		// a bad program still runs up to the point it goes wrong.
+		class DecodedProgram {
+		public:
+			std::vector<Instr> instrs;
+			std::vector<types::word_t> offsets;// Byte offset of each decoded instruction (for error reporting)
+
+			DecodedProgram(const Program& program, const bool& fuseIn);
+
+			// Index of the instruction starting at byte offset loc, decoding it if needed. Anything outside of the
+			// program resolves to a HALT, just as running off of the end of the program stops it.
+			int resolve(types::word_t loc) {
+				if (loc >= 0 && loc < length && index[loc] >= 0) return index[loc];
+				return decode(loc);
 			}
 
-			void goto_(vm::types::word_t loc) {
-				ip = start + loc;
+			// Like resolve(), without decoding anything: -1 if loc would need decoding first
+			int find(const types::word_t& loc) const {
+				if (loc >= 0 && loc < length) return index[loc];
+				return haltIndex;
 			}
 
+			int decode(types::word_t loc);
+
+			types::word_t programLength() const {
+				return length;
+			}
+
+			// Appends everything decoded so far to out, as the decoded section of an .eze file
+			void save(std::vector<char>& out) const;
+			// Replaces everything decoded with a saved section. Returns false (changing nothing) if it was saved by a
+			// different version of the decoder, with different settings, or from a different sized program.
+			bool load(const char* const& data, const size_t& size);
+
+		private:
+			// Bump whenever the decoder (or Instr) changes what it produces for the same program
+			static constexpr uint32_t SAVE_VERSION = 7;
+
+			const char* const start;
+			const types::word_t length;
+			const bool fuse;
+			std::vector<int> index;// Byte offset -> decoded instruction index (or -1)
+			std::vector<types::word_t> pending;// Offsets still to be decoded
+			std::vector<int> fixups;// Static jumps whose targets are still byte offsets
+			int haltIndex;
+
 			template<typename T>
-			void read(T* val) {
-				(*val) = *reinterpret_cast<T*>(ip);
-				ip += sizeof(T);
+			T readAt(types::word_t loc) const;
+
+			void decodeRun(types::word_t loc);
+			// Whether an instruction (decoded here, or loaded from a saved section) is safe to run unchecked
+			static bool isVerified(const Instr& instr, const size_t& count);
+			static void specialise(Instr& instr);
+			static bool fuseInto(Instr& first, const Instr& second);
+			void dropFlags(const int& first);
+			int getHaltIndex();
+		};
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Profiling
+
+		// Collected by the executor when FLAG_PROFILE is set. Every dispatch charges the cycles since the previous one
+		// to the previous opcode, and to the block it was in. A block is everything executed from a jump target up
+		// to the next jump, keyed by the index of the target in the decoded stream.
+		class Profiler {
+		public:
+			typedef unsigned long long counter_t;
+
+			counter_t opcodeCounts[256];
+			counter_t opcodeCycles[256];
+			std::vector<counter_t> blockCounts;
+			std::vector<counter_t> blockCycles;
+			counter_t decodeMicros;
+			counter_t runMicros;
+			unsigned int jitThreshold;// 0 when the run isn't tiered
+			unsigned int budget;// 0 when the run has no budget
+			counter_t budgetHits;// Times the run was preempted, and later carried on
+			int tierUpIndex;// Where the JIT took over (or -1)
+			counter_t tierUpInstructions;// Instructions interpreted before that
+			counter_t jitCycles;
+
+			Profiler();
+
+			static counter_t now() {
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
+				return __rdtsc();
+#else
+				return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+			}
+
+			void start(const int& entry);
+			void stop();
+			void tierUp(const int& target);// Everything after this runs in the JIT, and is only counted as a whole
+			void preempt();// Like stop(), when the budget runs out, so the counts carry on with resume()
+			void resume(const int& entry);
+
+			// Called before each instruction is dispatched
+			void step(const types::opcode_t& opcode) {
+				const counter_t time = now();
+				opcodeCycles[lastOpcode] += time - last;
+				blockCycles[block] += time - last;
+				opcodeCounts[opcode]++;
+				lastOpcode = opcode;
+				last = time;
+				block = nextBlock;
+			}
+
+			// Called on every jump, just before the target is dispatched
+			void jump(const int& target) {
+				if (target >= static_cast<int>(blockCounts.size())) {
+					blockCounts.resize(target + 1, 0);
+					blockCycles.resize(target + 1, 0);
+				}
+				blockCounts[target]++;
+				nextBlock = target;
 			}
+
+			// Instructions dispatched so far (only up to the tier up, in a tiered run)
+			counter_t dispatches() const;
+
+			void report(std::ostream& stream, const DecodedProgram& decoded) const;
+			bool write(const char* const& path, const DecodedProgram& decoded) const;
+
+		private:
+			counter_t last;
+			types::opcode_t lastOpcode;
+			int block;
+			int nextBlock;
+			std::chrono::steady_clock::time_point startTime;
 		};
 
+		class CallStack;
+
+		// Samples of the call stack, taken every so many safepoints, for flamegraphs. The innermost frame is where
+		// the run was going, and the rest are the return locations on the CallStack. Each frame is kept as the
+		// label it's in, from the program's symbol section (read the first time it's needed), so a recursive program
+		// has as many distinct stacks as it has depths, rather than one for each path through its calls.
+		class Sampler {
+		public:
+			typedef unsigned long long counter_t;
+
+			unsigned long long untilNext;// Safepoints to the next sample, kept from a run that was preempted (0 if there wasn't one)
+
+			Sampler() : untilNext(0), hasLabels(false) {}
+
+			void sample(const Program& program, const CallStack& calls, const DecodedProgram& decoded, const int& at);
+			void clear() {
+				stacks.clear();
+				untilNext = 0;
+			}
+
+			// Collapsed stacks, one line per distinct stack: the label each frame is in from the outermost in, split by
+			// ';', then the number of samples. Frames before any label are written as their byte offset.
+			bool write(const char* const& path) const;
+
+		private:
+			struct Label {
+				types::word_t loc;
+				std::string name;
+			};
+
+			std::vector<Label> labels;// In address order, without the globals
+			bool hasLabels;
+			std::map<std::vector<types::word_t>, counter_t> stacks;// Where each frame's label is, outermost first
+			std::vector<types::word_t> stack;// The one being sampled
+
+			void readLabels(const Program& program);
+			types::word_t labelOf(const types::word_t& loc) const;
+		};
+
+		// Backward and dynamic jumps all count down the one number, to whichever comes first out of the end of the
+		// budget and the next sample, so sampling doesn't add a check anywhere that there wasn't one already
+		struct Countdown {
+			unsigned long long left;// Safepoints until the next stop
+			unsigned long long budgetLeft;// Safepoints left in the budget when left was set (as good as forever without one)
+			unsigned long long sampleLeft;// Likewise, until the next sample
+			unsigned int sampleInterval;
+
+			explicit Countdown(const Context& context);
+
+			// left has reached 0 at a safepoint going to at. Takes the sample if that's what it was, then counts down to
+			// the next stop. Returns true if the budget has run out instead.
+			bool reached(Context& context, const int& at);
+		};
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Memory
+
+		// One reservation of address space, handed out in order, for everything a program can hold an address of: its
+		// copy of the image, its stack and the arena's memory. Programs keep addresses as offsets from base (see at()),
+		// so they're the same size on every host. The arena's own bookkeeping holds host pointers, though, so a
+		// snapshot can only be put back at the same base it was taken at. A fixed Memory is always reserved at
+		// FIXED_BASE, so everything in it lands in the same place in every run (unless something else is there first,
+		// in which case it's reserved anywhere and isFixed is false).
+		class Memory {
+		public:
+			static constexpr uintptr_t FIXED_BASE = 0x50000000;
+			static constexpr size_t CAPACITY = 0x10000000;
+			// Nothing is ever put at the start, so address 0 is never a real one (FREE ignores it, MEMCHR returns it)
+			static constexpr size_t NULL_SIZE = 16;
+
+			char* base;
+			size_t used;
+			size_t committed;// On Windows, the bytes from base that are backed by pages so far (the rest is only reserved)
+			bool isFixed;
+
+			explicit Memory(const bool& fixed);
+			~Memory();
+
+			// Throws std::bad_alloc once CAPACITY runs out
+			char* take(const size_t& size);
+
+			// Makes sure the first size bytes are backed by pages. Only Windows needs this (false if it couldn't):
+			// everywhere else the whole reservation can be used straight away.
+			bool commit(const size_t& size);
+
+			// Replaces the start of the memory with size bytes of a snapshot file, at offset (a multiple of
+			// format::SNAPSHOT_ALIGN), mapping it in copy-on-write where it can
+			bool restore(std::istream& file, const char* const& path, const uint64_t& offset, const size_t& size);
+		};
+
+		// Where address points in the Memory starting at base. Addresses are unsigned offsets, and wrap around like words.
+		template<typename T>
+		inline T* at(char* const& base, const types::word_t& address) {
+			return reinterpret_cast<T*>(base + static_cast<uint32_t>(address));
+		}
+
+		// The address of ptr, somewhere in the Memory starting at base
+		inline types::word_t addressOf(char* const& base, const char* const& ptr) {
+			return static_cast<types::word_t>(ptr - base);
+		}
+
+		// Backs ALLOC and FREE. Small blocks are rounded up to a size class, taken from that class's free list, or
+		// bump allocated out of a chunk when the free list is empty. Bigger blocks get an allocation of their own.
+		// Every block starts with a Header, so FREE knows where it goes back to. push() and pop() bracket a scope:
+		// pop() frees everything allocated since the matching push(), and release() frees everything at once (keeping
+		// the chunks for the next run). With a Memory, chunks and big blocks come from it instead of the heap, and a
+		// big block that's freed isn't reused until release().
+		class Arena {
+		public:
+			explicit Arena(Memory* const& memoryIn = nullptr);
+			~Arena();
+
+			char* alloc(const types::word_t& size);
+			void free(char* const& block);
+
+			void push();
+			void pop();
+			void release();
+
+			// Appends everything needed to put the arena back as it is now (with the same Memory contents)
+			void save(std::vector<char>& out) const;
+			// Puts back what save() wrote, returning false if it isn't valid for this arena's Memory
+			bool load(const char* const& data, const size_t& size);
+
+		private:
+			static constexpr int GRANULE = 16;
+			static constexpr int MAX_SMALL = 512;// Including the header
+			static constexpr int NUM_CLASSES = MAX_SMALL / GRANULE;
+			static constexpr size_t CHUNK_SIZE = 0x10000;
+
+			struct Header {
+				types::word_t sizeClass;// -1 for a large block
+				types::word_t largeIndex;
+			};
+
+			// Everything pop() has to put back. Each scope starts with empty free lists, so that nothing the outer
+			// scope has freed is handed out (and written over) inside it. Blocks from outside that get freed inside
+			// a scope are only reused once the whole arena is released.
+			struct Mark {
+				size_t chunk;
+				size_t used;
+				size_t large;
+				char* freeLists[NUM_CLASSES];
+			};
+
+			Memory* const memory;
+			const size_t memoryStart;// Where the arena's part of memory starts (everything after is released at once)
+			std::vector<char*> chunks;
+			size_t chunk;// Chunk currently being bump allocated from
+			size_t used;// Bytes of it used so far
+			std::vector<char*> large;
+			char* freeLists[NUM_CLASSES];// Freed blocks (the next pointer is kept just after the header)
+			std::vector<Mark> marks;
+		};
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Output
+
+		// Collects everything the program prints, and writes it to the stream in one go once flushSize bytes have
+		// built up. The executor also flushes it before reading input and when the program halts. Words are formatted
+		// by hand, since going through the stream's (locale-aware) formatting for every print costs more than the
+		// instruction itself.
+		class OutputBuffer {
+		public:
+			OutputBuffer() : stream(nullptr), capacity(0), used(0) {}
+
+			// Starts writing to a (possibly different) stream. Only allocates if the buffer needs to get bigger.
+			void attach(std::ostream& streamIn, const size_t& flushSize) {
+				flush();
+				stream = &streamIn;
+				if (buffer.size() < flushSize) buffer.resize(flushSize);
+				capacity = flushSize;
+			}
+
+			void put(const char& c) {
+				if (used == capacity) {
+					flush();
+					if (capacity == 0) {
+						stream->put(c);
+						return;
+					}
+				}
+				buffer[used++] = c;
+			}
+
+			void write(const char* const& str, const size_t& length) {
+				if (used + length > capacity) {
+					flush();
+					if (length > capacity) {
+						stream->write(str, length);
+						return;
+					}
+				}
+				std::memcpy(buffer.data() + used, str, length);
+				used += length;
+			}
+
+			void writeString(const char* const& str) {
+				write(str, std::strlen(str));
+			}
+
+			void writeWord(const types::word_t& value) {
+				char digits[12];// "-2147483648"
+				char* const digitsEnd = digits + sizeof(digits);
+				char* digit = digitsEnd;
+				// Unsigned, so that negating the most negative word doesn't overflow
+				unsigned long long magnitude = value < 0 ? 0ull - static_cast<long long>(value) : static_cast<unsigned long long>(value);
+				do {
+					*--digit = static_cast<char>('0' + magnitude % 10);
+					magnitude /= 10;
+				} while (magnitude != 0);
+				if (value < 0) *--digit = '-';
+				write(digit, digitsEnd - digit);
+			}
+
+			void flush() {
+				if (used != 0) {
+					stream->write(buffer.data(), used);
+					used = 0;
+				}
+			}
+
+		private:
+			std::ostream* stream;
+			std::vector<char> buffer;
+			size_t capacity;
+			size_t used;
+		};
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Input
+
+		// Where READ_STR, READ_STR_N and BREAK read from in a resumable run, which the host adds to as input arrives. Only whole
+		// lines are ever taken, so the program never sees half of one. Once it's closed, whatever is left counts as
+		// the last line, and every read after that gets an empty one (like getline at the end of a stream).
+		class InputBuffer {
+		public:
+			InputBuffer() : pos(0), isClosed(false) {}
+
+			void feed(const char* const& data, const size_t& length) {
+				// Drop what has been read once it's most of the buffer, so a long run doesn't keep all of its input
+				if (pos > buffer.size() / 2) {
+					buffer.erase(0, pos);
+					pos = 0;
+				}
+				buffer.append(data, length);
+			}
+
+			void close() {
+				isClosed = true;
+			}
+
+			void clear() {
+				buffer.clear();
+				pos = 0;
+				isClosed = false;
+			}
+
+			// Copies the next line to out (without its '\n', and null-terminated), or returns false if there isn't a
+			// whole one yet
+			bool readLine(char* const& out) {
+				size_t length;
+				if (!nextLine(length)) return false;
+				std::memcpy(out, buffer.data() + pos, length);
+				out[length] = '\0';
+				take(length);
+				return true;
+			}
+
+			// Like readLine, for READ_STR_N: throws INPUT_TOO_LONG (at loc) if the line and its terminator don't fit in
+			// size bytes
+			bool readLine(char* const& out, const types::word_t& size, const types::word_t& loc) {
+				size_t length;
+				if (!nextLine(length)) return false;
+				if (size <= 0 || length >= static_cast<size_t>(size)) throw ExecutorException(ExecutorException::INPUT_TOO_LONG, loc);
+				return readLine(out);
+			}
+
+			bool skipLine() {
+				size_t length;
+				if (!nextLine(length)) return false;
+				take(length);
+				return true;
+			}
+
+		private:
+			std::string buffer;
+			size_t pos;// Start of the first line not read yet
+			bool isClosed;
+
+			bool nextLine(size_t& length) const {
+				const size_t end = buffer.find('\n', pos);
+				if (end != std::string::npos) {
+					length = end - pos;
+					return true;
+				}
+				length = buffer.size() - pos;
+				return isClosed;
+			}
+
+			void take(const size_t& length) {
+				pos = std::min(buffer.size(), pos + length + 1);
+			}
+		};
+
+		// What READ_STR_N does outside a resumable run, the same way as InputBuffer::readLine
+		inline void readLine(std::istream& in, char* const& out, const types::word_t& size, const types::word_t& loc) {
+			if (size <= 0) throw ExecutorException(ExecutorException::INPUT_TOO_LONG, loc);
+			in.getline(out, size, '\n');
+			// Filling the buffer before the end of the line fails the stream, where running out of input also hits eof
+			if (in.fail() && !in.eof()) throw ExecutorException(ExecutorException::INPUT_TOO_LONG, loc);
+		}
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Bulk memory
+
+		// What MEMCPY, MEMSET, MEMCMP, MEMCHR and STRLEN do, for the interpreter and the JIT's callbacks alike. They
+		// go straight to the C library, whose versions already pick SSE2, AVX2 or NEON code for the CPU they run on.
+		// Addresses are the ones the program keeps in its registers, in the Memory at base, and a length of 0 or less
+		// does nothing.
+		namespace bulk {
+			inline void copy(char* const& base, const types::word_t& to, const types::word_t& from, const types::word_t& length) {
+				// memmove, so copying along a buffer by less than its length works too
+				if (length > 0) std::memmove(at<char>(base, to), at<char>(base, from), static_cast<size_t>(length));
+			}
+
+			inline void fill(char* const& base, const types::word_t& to, const types::char_t& value, const types::word_t& length) {
+				if (length > 0) std::memset(at<char>(base, to), static_cast<unsigned char>(value), static_cast<size_t>(length));
+			}
+
+			// -1, 0 or 1, as the first byte that differs is lower in a or b (compared unsigned, like memcmp)
+			inline types::word_t compare(char* const& base, const types::word_t& a, const types::word_t& b, const types::word_t& length) {
+				if (length <= 0) return 0;
+				const int result = std::memcmp(at<char>(base, a), at<char>(base, b), static_cast<size_t>(length));
+				return (result > 0) - (result < 0);
+			}
+
+			// The address of the first value in the length bytes at start, or 0 if there isn't one
+			inline types::word_t find(char* const& base, const types::word_t& start, const types::char_t& value, const types::word_t& length) {
+				if (length <= 0) return 0;
+				const void* const found = std::memchr(at<char>(base, start), static_cast<unsigned char>(value), static_cast<size_t>(length));
+				return found == nullptr ? 0 : addressOf(base, static_cast<const char*>(found));
+			}
+
+			inline types::word_t length(char* const& base, const types::word_t& str) {
+				return static_cast<types::word_t>(std::strlen(at<char>(base, str)));
+			}
+		}
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Vectors
+
+		// What the vector instructions do, for the interpreter and the JIT's callbacks alike. Each one is a single SSE2
+		// or NEON instruction where there is one, and a loop over the lanes everywhere else. Lanes wrap around like
+		// words do, and a comparison sets each lane to -1 where it holds and 0 where it doesn't.
+		namespace vector {
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VM_VECTOR_SSE2
+			inline __m128i get(const Vector& v) {
+				return _mm_load_si128(reinterpret_cast<const __m128i*>(v.lanes));
+			}
+
+			inline void put(Vector& v, const __m128i& value) {
+				_mm_store_si128(reinterpret_cast<__m128i*>(v.lanes), value);
+			}
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define VM_VECTOR_NEON
+			inline int32x4_t get(const Vector& v) {
+				return vld1q_s32(v.lanes);
+			}
+
+			inline void put(Vector& v, const int32x4_t& value) {
+				vst1q_s32(v.lanes, value);
+			}
+#endif
+
+			// Lane i of a op b, as unsigned so that overflow wraps
+			template<typename Op>
+			void lanewise(Vector& out, const Vector& a, const Vector& b, const Op& op) {
+				for (size_t i = 0; i < VECTOR_LANES; i++) {
+					out.lanes[i] = static_cast<types::word_t>(op(static_cast<uint32_t>(a.lanes[i]), static_cast<uint32_t>(b.lanes[i])));
+				}
+			}
+
+			// From any address in the Memory at base, aligned or not
+			inline void load(Vector& out, char* const& base, const types::word_t& address) {
+				std::memcpy(out.lanes, at<const char>(base, address), sizeof(out.lanes));
+			}
+
+			inline void store(char* const& base, const types::word_t& address, const Vector& v) {
+				std::memcpy(at<char>(base, address), v.lanes, sizeof(v.lanes));
+			}
+
+			inline void splat(Vector& out, const types::word_t& value) {
+#if defined(VM_VECTOR_SSE2)
+				put(out, _mm_set1_epi32(value));
+#elif defined(VM_VECTOR_NEON)
+				put(out, vdupq_n_s32(value));
+#else
+				for (types::word_t& lane : out.lanes) lane = value;
+#endif
+			}
+
+			inline void add(Vector& out, const Vector& a, const Vector& b) {
+#if defined(VM_VECTOR_SSE2)
+				put(out, _mm_add_epi32(get(a), get(b)));
+#elif defined(VM_VECTOR_NEON)
+				put(out, vaddq_s32(get(a), get(b)));
+#else
+				lanewise(out, a, b, [](const uint32_t& x, const uint32_t& y) { return x + y; });
+#endif
+			}
+
+			inline void sub(Vector& out, const Vector& a, const Vector& b) {
+#if defined(VM_VECTOR_SSE2)
+				put(out, _mm_sub_epi32(get(a), get(b)));
+#elif defined(VM_VECTOR_NEON)
+				put(out, vsubq_s32(get(a), get(b)));
+#else
+				lanewise(out, a, b, [](const uint32_t& x, const uint32_t& y) { return x - y; });
+#endif
+			}
+
+			inline void mul(Vector& out, const Vector& a, const Vector& b) {
+				// A 32-bit lanewise multiply only came with SSE4.1
+#if defined(VM_VECTOR_SSE2) && defined(__SSE4_1__)
+				put(out, _mm_mullo_epi32(get(a), get(b)));
+#elif defined(VM_VECTOR_NEON)
+				put(out, vmulq_s32(get(a), get(b)));
+#else
+				lanewise(out, a, b, [](const uint32_t& x, const uint32_t& y) { return x * y; });
+#endif
+			}
+
+			inline void cmpEq(Vector& out, const Vector& a, const Vector& b) {
+#if defined(VM_VECTOR_SSE2)
+				put(out, _mm_cmpeq_epi32(get(a), get(b)));
+#elif defined(VM_VECTOR_NEON)
+				put(out, vreinterpretq_s32_u32(vceqq_s32(get(a), get(b))));
+#else
+				for (size_t i = 0; i < VECTOR_LANES; i++) out.lanes[i] = a.lanes[i] == b.lanes[i] ? -1 : 0;
+#endif
+			}
+
+			inline void cmpGt(Vector& out, const Vector& a, const Vector& b) {
+#if defined(VM_VECTOR_SSE2)
+				put(out, _mm_cmpgt_epi32(get(a), get(b)));
+#elif defined(VM_VECTOR_NEON)
+				put(out, vreinterpretq_s32_u32(vcgtq_s32(get(a), get(b))));
+#else
+				for (size_t i = 0; i < VECTOR_LANES; i++) out.lanes[i] = a.lanes[i] > b.lanes[i] ? -1 : 0;
+#endif
+			}
+
+			// Every lane added together (wrapping around, like the lanes do)
+			inline types::word_t sum(const Vector& v) {
+#if defined(VM_VECTOR_SSE2)
+				const __m128i halves = _mm_add_epi32(get(v), _mm_shuffle_epi32(get(v), 0x4e));
+				return _mm_cvtsi128_si32(_mm_add_epi32(halves, _mm_shuffle_epi32(halves, 0xb1)));
+#elif defined(VM_VECTOR_NEON)
+				return vaddvq_s32(get(v));
+#else
+				uint32_t total = 0;
+				for (const types::word_t& lane : v.lanes) total += static_cast<uint32_t>(lane);
+				return static_cast<types::word_t>(total);
+#endif
+			}
+		}
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// JIT
+
+#ifdef VM_JIT
+		// Translates a DecodedProgram into x86-64 machine code, one decoded instruction at a time, in the same order,
+		// so falling through works the same way it does in the interpreter. The register file stays in memory (rbx
+		// points at it) and every instruction loads and stores the registers it uses. Loads and stores add the address
+		// to the Memory's base, which is kept in r15. Instructions that do I/O or
+		// allocate call back into callback(). Dynamic jumps go through a table from byte offset to native code; an
+		// offset that hasn't been compiled yet leaves the native code so it can be decoded and compiled, then resumes.
+		class Jit {
+		public:
+			// Why native code returned to run()
+			enum Status {
+				EXIT_HALT,
+				EXIT_RESOLVE,// Dynamic jump to a byte offset with no native code yet
+				EXIT_DIVIDE_BY_ZERO,
+				EXIT_UNKNOWN_OPCODE,
+				EXIT_CALL_STACK,// CALL with the CallStack full, or RET with it empty
+				EXIT_EXCEPTION,// callback() caught an exception, which is rethrown from run()
+				EXIT_WAIT,// A resumable read with no whole line to take yet
+				EXIT_PREEMPT,// The countdown reached 0 at a backward or dynamic jump, to the byte offset in edx
+				EXIT_PREEMPT_RETURN// Likewise at a RET, before it pops its frame, with its decoded index in edx
+			};
+
+			explicit Jit(Context& context);
+			~Jit();
+
+			// The Context's Jit, if the last run left one there, and a new one otherwise
+			static Jit& of(Context& context);
+
+			// Runs from the decoded instruction at entry until a HALT, throwing any error the program runs into. It can
+			// also stop at a resumable read with no input to take, or once the countdown's budget runs out, with the
+			// Context's entry set to carry on from. A run that stops early leaves the Jit on the Context, so carrying
+			// on doesn't compile everything again.
+			RunResult run(const int& entry, Countdown& countdown, std::istream& streamInIn);
+
+		private:
+			typedef unsigned long long (*Entry)(Jit* jit, Value* reg, const void* const* table, const void* target);
+
+			// A static jump, to be patched once its target has been compiled
+			struct Fixup {
+				size_t at;// Position of the rel32 to patch
+				int target;// Decoded instruction index
+			};
+
+			Context& context;// For SNAPSHOT, the CallStack and the decoded program (which can change when it resolves)
+			char* const base;// Of the Context's Memory, which never moves
+			Value* const reg;
+			Arena& arena;
+			OutputBuffer& output;
+			std::istream* streamIn;// For the run in progress
+
+			unsigned char* code;// Executable memory
+			size_t capacity;
+			size_t size;
+			std::vector<size_t> native;// Decoded instruction index -> offset of its native code
+			std::vector<const void*> table;// Byte offset -> native code, for dynamic jumps
+			std::vector<Fixup> fixups;
+			size_t exitCode;// Shared tail that returns from native code
+			size_t resolveCode;// Exits with EXIT_RESOLVE and the byte offset in eax
+			size_t preemptCode;// Exits with EXIT_PREEMPT and the byte offset in eax
+			std::exception_ptr error;
+			const bool hasSafepoints;// Whether jumps that could loop count down (kept in r14 while running)
+			unsigned long long countdownLeft;
+
+			void compile();
+			void compileInstr(const int& index, const Instr& instr);
+
+			static int callback(Jit* jit, int index);
+
+			// Encoding
+			void emit(const unsigned char& byte);
+			void emit32(const types::word_t& value);
+			void emit64(const unsigned long long& value);
+			void emitMem(const std::initializer_list<unsigned char>& op, const int& regField, const int& base, const types::word_t& disp);
+			void emitData(const std::initializer_list<unsigned char>& op, const int& regField, const int& address, const types::word_t& disp);
+			void emitReg(const std::initializer_list<unsigned char>& op, const int& regField, const types::reg_t& r);
+			void emitVector(const std::initializer_list<unsigned char>& op, const int& regField, const types::reg_t& v);
+			void emitJump(const std::initializer_list<unsigned char>& op, const int& target);
+			void emitJumpTo(const std::initializer_list<unsigned char>& op, const size_t& to);
+			size_t emitJump8(const unsigned char& op);
+			void patchJump8(const size_t& at);
+			void emitSetFlag(const unsigned char& cc);
+			void emitExit(const Status& status, const int& index);
+			void emitCallback(const int& index);
+			void emitCallStackTop();
+			void emitDynamicJump(const bool& isCounted);
+			void emitSafepoint(const int& target);
+		};
+#endif
+
 		class Stack {
 		public:
 			char* start;
 			char* end;
 
-			Stack(const int& size) {
-				start = new char[size];
+			// From memory if there is one, and the heap otherwise
+			Stack(const int& size, Memory* const& memory = nullptr) : isOwned(memory == nullptr) {
+				start = isOwned ? new char[size] : memory->take(size);
 				end = start + size;
 			}
 
 			~Stack() {
-				delete[] start;
+				if (isOwned) delete[] start;
+			}
+
+		private:
+			const bool isOwned;
+		};
+
+		// Where CALL keeps the byte offset to RET to, apart from the frames on the Stack so the program can't
+		// overwrite them. One word per call, so the memory it needs is the same as the Stack's.
+		class CallStack {
+		public:
+			types::word_t* start;
+			types::word_t* top;// Just past the innermost call's return location
+			types::word_t* end;
+
+			CallStack(const size_t& capacity, Memory* const& memory = nullptr) : isOwned(memory == nullptr) {
+				start = isOwned ? new types::word_t[capacity] : reinterpret_cast<types::word_t*>(memory->take(capacity * sizeof(types::word_t)));
+				top = start;
+				end = start + capacity;
 			}
+
+			~CallStack() {
+				if (isOwned) delete[] start;
+			}
+
+		private:
+			const bool isOwned;
 		};
 
 		int exec(const char* const& path, ExecutorSettings& execSettings);
+		// Runs a program that is already in memory (normally straight from the assembler); name is only for messages
+		int exec(const std::vector<char>& program, const char* const& name, ExecutorSettings& execSettings);
 		int exec_(std::iostream& file, ExecutorSettings& execSettings, std::ostream& stream, std::istream& streamIn);
+		// Runs the program once per input (each file in a directory, or each line of a file) across a pool of threads
+		int execBatch(const char* const& path, const char* const& inputsPath, ExecutorSettings& execSettings);
+		// Assembles each file and times it on every engine (benchRuns times each, after a few untimed runs), then
+		// writes the results to outputPath as JSON. The programs' output is thrown away, and they get no input.
+		int benchmark(const std::vector<const char*>& assemblyPaths, const char* const& outputPath, assembler::AssemblerSettings& assemblerSettings, ExecutorSettings& execSettings);
+		// Once a run halts, writes its samples to the samplePath (if it was taking any) and clears them
+		void writeSamples(Context& context, const ExecutorSettings& execSettings, std::ostream& stream);
+		template<bool Threaded, bool Profile, bool Tiered>
+		int run(Context& context, ExecutorSettings& execSettings, std::ostream& stream, std::istream& streamIn);
+#ifdef VM_JIT
+		int runJit(Context& context, ExecutorSettings& execSettings, std::ostream& stream, std::istream& streamIn);
+#endif
 	}
+
+	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+	// Embedding
+
+	// A loaded and decoded program. Nothing changes it after it is constructed (Contexts only ever read it, the code
+	// and the decoded stream included), so any number of Contexts, on any number of threads, can run it at once.
+	// Everything reachable by static jumps is decoded here, so only a dynamic jump somewhere new needs more.
+	class Module {
+	public:
+		executor::Program program;
+		executor::DecodedProgram decoded;
+		int entry;// Decoded index of the first instruction
+		unsigned long long decodeMicros;
+
+		Module(const char* const& path, const bool& fuse);
+		Module(std::istream& stream, const bool& fuse);
+		Module(const std::vector<char>& bytes, const bool& fuse);
+
+	private:
+		void decode();
+	};
+
+	// Everything one run of a Module changes: registers, stack, and its own copy of the program's globals. Creating
+	// a Context allocates all of it up front, so exec() and reset() don't allocate or touch any files. Only the data
+	// and bss are copied into it: the code is run from the Module's decoded stream, which the Context shares until
+	// it has to decode something new.
+	class Context {
+	public:
+		const Module& module;
+		executor::Value* const reg;// NUM_REGISTERS of them, aligned to CACHE_LINE in registerStorage
+		executor::Vector* const vreg;// NUM_VECTOR_REGISTERS of them, straight after reg
+		std::unique_ptr<executor::Memory> memory;// Where the image, stack and arena are, and what every address is an offset into
+		const size_t imageSize;
+		char* const image;// Copy of the program's data and bss (with a gap for the code between them), which PP holds the address of
+		executor::Stack stack;
+		executor::CallStack calls;
+		executor::Arena arena;// Backs ALLOC and FREE, and is released whenever the program halts
+		executor::OutputBuffer output;// Everything the program prints goes through here
+		executor::InputBuffer input;// What READ_STR, READ_STR_N and BREAK read in resume(), which the host adds to
+		bool isAsync;// Whether the run was started by resume(), so reads come from input and can stop to wait for it
+		const executor::DecodedProgram* decoded;// The module's, or ownDecoded once there is one
+		int entry;// Decoded index exec() starts from: the module's entry, just after the SNAPSHOT that was restored, or the read a resumable run stopped at
+		const char* snapshotPath;// Where SNAPSHOT writes to (from the settings exec() was given)
+		unsigned int budget;// Backward and dynamic jumps before the run is preempted (from the settings exec() was given)
+		unsigned int sampleInterval;// Backward and dynamic jumps between samples (likewise, and 0 without a samplePath)
+		executor::Sampler sampler;// Samples from every part of the run so far, until it halts and they're written out
+		std::unique_ptr<executor::Profiler> pausedProfiler;// A preempted profile run's counts, until it carries on
+		std::vector<unsigned int> hotness;// Times each loop head has been reached in a tiered run, kept from one that stopped early
+#ifdef VM_JIT
+		std::unique_ptr<executor::Jit> jit;// Compiled code, kept for every later run (it only depends on what the Context never changes)
+		bool isInJit;// Whether a tiered run stopped early in the JIT, so that the next one carries on there
+#endif
+		unsigned long long dispatches;// Instructions dispatched by the last run in profile mode
+
+		// A snapshottable Context's Memory is a fixed one
+		Context(const Module& moduleIn, const unsigned int& stackSize, const bool& isSnapshottable = false);
+
+		// Puts the registers (vector ones too) and globals back to how they were when the Context was created
+		void reset();
+
+		// Index of the instruction at byte offset loc in decoded. The first time that needs anything new decoded, the
+		// module's decoded program is copied into ownDecoded, which decoded points at from then on.
+		int resolve(const types::word_t& loc) {
+			const int at = decoded->find(loc);
+			if (at >= 0) return at;
+			if (!ownDecoded) {
+				ownDecoded.reset(new executor::DecodedProgram(module.decoded));
+				decoded = ownDecoded.get();
+			}
+			return ownDecoded->resolve(loc);
+		}
+
+		// Runs the program from entry, returning 0 once it halts (errors are thrown as ExecutorExceptions). Call
+		// reset() first to run it again from a clean state. With a budget, it can also return RUN_PREEMPTED, and
+		// calling it again carries on from there.
+		int exec(executor::ExecutorSettings& execSettings, std::ostream& streamOut, std::istream& streamIn);
+		// Like exec(), but READ_STR, READ_STR_N and BREAK read whole lines from input instead of a stream. When there
+		// isn't one yet, the run stops before the read and returns RUN_WAITING, keeping everything (registers, stack
+		// and arena) as it was, and the next resume() carries on from there. Profiling is left off, since it would
+		// only ever see the stretch since the last wait.
+		int resume(executor::ExecutorSettings& execSettings, std::ostream& streamOut);
+
+		// Writes everything the program could see (registers, globals, stack and arena) to path, for restore() to
+		// carry on from resumeLoc. Returns false if it couldn't, or if the Context's memory isn't fixed.
+		bool snapshot(const char* const& path, const types::word_t& resumeLoc);
+		// Puts back a snapshot that the same program made with the same stack size, so that exec() carries on from
+		// where it was made. Returns false if there isn't one that fits, leaving the Context reset.
+		bool restore(const char* const& path);
+
+	private:
+		// alignas on the Context wouldn't be honoured by new before C++17, so reg is lined up inside this by hand
+		char registerStorage[executor::NUM_REGISTERS * sizeof(executor::Value) + executor::NUM_VECTOR_REGISTERS * sizeof(executor::Vector) + executor::CACHE_LINE - 1];
+
+		std::unique_ptr<executor::DecodedProgram> ownDecoded;// Only made if the program jumps somewhere the module hasn't decoded
+
+		int launch(executor::ExecutorSettings& execSettings, std::ostream& streamOut, std::istream& streamIn);
+	};
+
+	// Runs any number of Contexts, through resume(), over a few threads. A Context that has to wait for input is put
+	// aside until feed() (or a watched file descriptor) gives it some, so a thread is never stuck waiting on one
+	// program and a handful of them can keep thousands of programs going. With a budget in the settings, a program
+	// that runs out of it goes to the back of the queue, so the busy ones take turns with everything else.
+	class Scheduler {
+	public:
+		// Called on the thread that ran the Context, once it halts (with no error) or fails
+		typedef std::function<void(Context& context, const std::exception_ptr& error)> Done;
+
+		// threads of 0 means one per core
+		Scheduler(const executor::ExecutorSettings& settingsIn, const unsigned int& threads = 0);
+		// Waits for the programs that are running to halt or wait, then stops. The rest are left as they are.
+		~Scheduler();
+
+		// Starts running context from its entry, with its output going to streamOut. Returns the id to feed it with.
+		int add(Context& context, std::ostream& streamOut, const Done& done = Done());
+		// Gives the Context more input, resuming it if it was waiting for some
+		void feed(const int& id, const char* const& data, const size_t& length);
+		// There's no more input coming, so reads take whatever is left
+		void close(const int& id);
+#ifdef __linux__
+		// Feeds the Context everything read from fd (a pipe or socket), as it arrives, through epoll. At the end of
+		// the file fd is closed, and so is the Context's input.
+		void watch(const int& id, const int& fd);
+#endif
+		// Blocks until every Context added so far has halted or failed
+		void wait();
+
+	private:
+		enum class State {
+			READY,
+			RUNNING,
+			WAITING,
+			DONE
+		};
+
+		struct Task {
+			Context& context;
+			std::ostream& streamOut;
+			const Done done;
+			State state;
+			std::string pending;// Input fed in while it was queued or running, handed over before it runs next
+			bool isClosed;
+
+			Task(Context& contextIn, std::ostream& streamOutIn, const Done& doneIn) : context(contextIn), streamOut(streamOutIn), done(doneIn), state(State::READY), pending(), isClosed(false) {}
+		};
+
+		executor::ExecutorSettings settings;
+		std::mutex mutex;
+		std::condition_variable readyCondition;
+		std::condition_variable doneCondition;
+		std::vector<std::unique_ptr<Task>> tasks;// By id
+		std::deque<int> ready;
+		size_t unfinished;
+		bool isStopping;
+		std::vector<std::thread> workers;
+#ifdef __linux__
+		int poller;// epoll instance, made by the first watch()
+		int wakeup;// eventfd that tells the poll thread to stop
+		std::thread pollThread;
+
+		void pollInput();
+#endif
+
+		void work();
+		void makeReady(const int& id);
+	};
 }
\ No newline at end of file
@@ -14,7 +14,32 @@ int main(int argc, const char* args[]) {
 		"-nodebug",
 		"-profile",
 		"-noprofile",
-		"-stacksize"
+		"-stacksize",
+		"-dispatch",
+		"-fuse",
+		"-nofuse",
+		"-profileout",
+		"-jit",
+		"-nojit",
+		"-jitthreshold",
+		"-batch",
+		"-threads",
+		"-flushsize",
+		"-link",
+		"-cache",
+		"-nocache",
+		"-cachelimit",
+		"-predecode",
+		"-nopredecode",
+		"-O",
+		"-O0",
+		"-snapshot",
+		"-nosnapshot",
+		"-benchmark",
+		"-benchruns",
+		"-budget",
+		"-sample",
+		"-nosample"
 	};
 
 	vm::assembler::AssemblerSettings assemblerSettings;
@@ -54,8 +79,10 @@ int main(int argc, const char* args[]) {
 					cout << IO_ERR "Not enough arguments for assembler and execution" IO_NORM IO_END;
 					return 1;
 				} else {
-					if (vm::assembler::assemble(args[i + 1], args[i + 2], assemblerSettings)) return 1;
-					if (vm::executor::exec(args[i + 2], executorSettings)) return 1;
+					// Runs the assembler's output as is, rather than reading back the file it just wrote
+					std::vector<char> program;
+					if (vm::assembler::assemble(args[i + 1], args[i + 2], assemblerSettings, program)) return 1;
+					if (vm::executor::exec(program, args[i + 2], executorSettings)) return 1;
 					i += 2;
 				}
 				break;
@@ -89,6 +116,234 @@ int main(int argc, const char* args[]) {
 					executorSettings.stackSize = uInt;
 				}
 				break;
+
+			case 8: // -dispatch
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting dispatch mode" IO_NORM IO_END;
+					return 1;
+				} else {
+					int dispatch = stringMatchAt(args[i + 1], vm::executor::dispatchStrings, ARR_LEN(vm::executor::dispatchStrings));
+					if (dispatch < 0) {
+						cout << IO_ERR "Invalid dispatch mode" IO_NORM IO_END;
+						return 1;
+					}
+					executorSettings.dispatch = static_cast<vm::executor::Dispatch>(dispatch);
+					i++;
+				}
+				break;
+
+			case 9: // -fuse
+				assemblerSettings.flags.setFlags(vm::FLAG_FUSE);
+				executorSettings.flags.setFlags(vm::FLAG_FUSE);
+				break;
+
+			case 10: // -nofuse
+				assemblerSettings.flags.unsetFlags(vm::FLAG_FUSE);
+				executorSettings.flags.unsetFlags(vm::FLAG_FUSE);
+				break;
+
+			case 11: // -profileout
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting profile output" IO_NORM IO_END;
+					return 1;
+				}
+				executorSettings.profilePath = args[i + 1];
+				i++;
+				break;
+
+			case 12: // -jit
+#ifndef VM_JIT
+				cout << IO_WARN "The JIT is only available on x86-64, so programs will still be interpreted" IO_NORM "\n";
+#endif
+				executorSettings.flags.setFlags(vm::FLAG_JIT);
+				break;
+
+			case 13: // -nojit
+				executorSettings.flags.unsetFlags(vm::FLAG_JIT);
+				break;
+
+			case 14: // -jitthreshold
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting JIT threshold" IO_NORM IO_END;
+					return 1;
+				} else if (parseUInt(args[i + 1], uInt)) {
+					cout << IO_ERR "Invalid JIT threshold" IO_NORM IO_END;
+					return 1;
+				} else {
+					executorSettings.jitThreshold = uInt;
+				}
+				i++;
+				break;
+
+			case 15: // -batch
+				if (argc - i < 3) {
+					cout << IO_ERR "Not enough arguments for batch execution" IO_NORM IO_END;
+					return 1;
+				} else {
+					if (vm::executor::execBatch(args[i + 1], args[i + 2], executorSettings)) return 1;
+					i += 2;
+				}
+				break;
+
+			case 16: // -threads
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting thread count" IO_NORM IO_END;
+					return 1;
+				} else if (parseUInt(args[i + 1], uInt)) {
+					cout << IO_ERR "Invalid thread count" IO_NORM IO_END;
+					return 1;
+				} else {
+					executorSettings.threads = uInt;
+					assemblerSettings.threads = uInt;
+				}
+				i++;
+				break;
+
+			case 17: // -flushsize
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting flush size" IO_NORM IO_END;
+					return 1;
+				} else if (parseUInt(args[i + 1], uInt)) {
+					cout << IO_ERR "Invalid flush size" IO_NORM IO_END;
+					return 1;
+				} else {
+					executorSettings.flushSize = uInt;
+				}
+				i++;
+				break;
+
+			case 18: // -link
+				{
+					// Takes every argument up to the next command
+					int last = i + 1;
+					while (last + 1 < argc && stringMatchAt(args[last + 1], commands, ARR_LEN(commands)) < 0) last++;
+					if (last - i < 2) {
+						cout << IO_ERR "Not enough arguments for linking" IO_NORM IO_END;
+						return 1;
+					}
+
+					const std::vector<const char*> assemblyPaths(args + i + 2, args + last + 1);
+					if (vm::assembler::assemble(assemblyPaths, args[i + 1], assemblerSettings)) return 1;
+					i = last;
+				}
+				break;
+
+			case 19: // -cache
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting the assembly cache" IO_NORM IO_END;
+					return 1;
+				} else {
+					assemblerSettings.cachePath = args[i + 1];
+				}
+				i++;
+				break;
+
+			case 20: // -nocache
+				assemblerSettings.cachePath = nullptr;
+				break;
+
+			case 21: // -cachelimit
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting the cache limit" IO_NORM IO_END;
+					return 1;
+				} else if (parseUInt(args[i + 1], uInt)) {
+					cout << IO_ERR "Invalid cache limit" IO_NORM IO_END;
+					return 1;
+				} else {
+					assemblerSettings.cacheLimit = static_cast<unsigned long long>(uInt) << 20;
+				}
+				i++;
+				break;
+
+			case 22: // -predecode
+				assemblerSettings.flags.setFlags(vm::FLAG_PREDECODE);
+				break;
+
+			case 23: // -nopredecode
+				assemblerSettings.flags.unsetFlags(vm::FLAG_PREDECODE);
+				break;
+
+			case 24: // -O
+				assemblerSettings.flags.setFlags(vm::FLAG_OPTIMIZE);
+				break;
+
+			case 25: // -O0
+				assemblerSettings.flags.unsetFlags(vm::FLAG_OPTIMIZE);
+				break;
+
+			case 26: // -snapshot
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting the snapshot file" IO_NORM IO_END;
+					return 1;
+				}
+				executorSettings.snapshotPath = args[i + 1];
+				i++;
+				break;
+
+			case 27: // -nosnapshot
+				executorSettings.snapshotPath = nullptr;
+				break;
+
+			case 28: // -benchmark
+				{
+					// Takes every argument up to the next command
+					int last = i + 1;
+					while (last + 1 < argc && stringMatchAt(args[last + 1], commands, ARR_LEN(commands)) < 0) last++;
+					if (last - i < 2) {
+						cout << IO_ERR "Not enough arguments for benchmarking" IO_NORM IO_END;
+						return 1;
+					}
+
+					const std::vector<const char*> assemblyPaths(args + i + 2, args + last + 1);
+					if (vm::executor::benchmark(assemblyPaths, args[i + 1], assemblerSettings, executorSettings)) return 1;
+					i = last;
+				}
+				break;
+
+			case 29: // -benchruns
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting benchmark runs" IO_NORM IO_END;
+					return 1;
+				} else if (parseUInt(args[i + 1], uInt) || uInt == 0) {
+					cout << IO_ERR "Invalid benchmark runs" IO_NORM IO_END;
+					return 1;
+				} else {
+					executorSettings.benchRuns = uInt;
+				}
+				i++;
+				break;
+
+			case 30: // -budget
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting the budget" IO_NORM IO_END;
+					return 1;
+				} else if (parseUInt(args[i + 1], uInt)) {
+					cout << IO_ERR "Invalid budget" IO_NORM IO_END;
+					return 1;
+				} else {
+					executorSettings.budget = uInt;
+				}
+				i++;
+				break;
+
+			case 31: // -sample
+				if (argc - i < 3) {
+					cout << IO_ERR "Not enough arguments for sampling" IO_NORM IO_END;
+					return 1;
+				} else if (parseUInt(args[i + 1], uInt) || uInt == 0) {
+					cout << IO_ERR "Invalid sample interval" IO_NORM IO_END;
+					return 1;
+				} else {
+					executorSettings.sampleInterval = uInt;
+					executorSettings.samplePath = args[i + 2];
+				}
+				i += 2;
+				break;
+
+			case 32: // -nosample
+				executorSettings.sampleInterval = 0;
+				executorSettings.samplePath = nullptr;
+				break;
 		}
 	}
 
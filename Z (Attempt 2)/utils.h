@@ -30,6 +30,9 @@
 #define IO_WARN IO_YELLOW "[WARNING] "
 #define IO_OK IO_GREEN
 #define IO_DEBUG IO_CYAN "[DEBUG] "
+#define IO_PROFILE IO_MAGENTA "[PROFILE] "
+#define IO_BATCH IO_BLUE "[BATCH] "
+#define IO_BENCH IO_GRAY "[BENCH] "
 
 #define IO_HEX std::hex
 #define IO_DEC std::dec